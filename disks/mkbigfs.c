@@ -0,0 +1,181 @@
+/**
+ * @file mkbigfs.c
+ * @brief outside generator for large file system images, same layout as createfs :
+ * boot block, N inodes, D data blocks, 4 KB each.
+ * Usage : ./mkbigfs -i fsdir -o student-distrib/bigfs_img [-n inodes] [-d dblocks] [-f fillers] [-r] [-e]
+ *   -n  number of inodes (default 64)
+ *   -d  number of data blocks (default 16384, 64 MB of data)
+ *   -f  number of filler files "fillNN", 1023 blocks (largest file an inode maps) each,
+ *       byte k of fillNN is (k+NN)&0xFF
+ *   -r  scatter data blocks across the disk like createfs does, otherwise files are contiguous
+ *   -e  write extent inodes (inode_ext_t in filesystem.h) instead of createfs flat inodes
+ * Build : gcc -O2 -o mkbigfs disks/mkbigfs.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE      4096
+#define DENTRY_SIZE     64
+#define FNAME_SIZE      32
+#define MAX_DENTRY      63
+#define MAX_FILE_BLOCKS 1023
+#define MAX_EXTENT      510
+#define INODE_EXT_MAGIC 0x31545845
+#define TYPE_RTC        0
+#define TYPE_DIR        1
+#define TYPE_FILE       2
+
+static uint8_t* img;
+static uint32_t inode_num = 64, dblock_num = 16384;
+static uint32_t* order;     /* order in which data blocks are handed out */
+static uint32_t next_dblock = 1, next_inode = 1;   /* inode 0 and dblock 0 belong to "." and rtc */
+static uint32_t extent;     /* write extent inodes */
+
+static uint8_t*
+block(uint32_t b) {
+    return img + (uint64_t) b * BLOCK_SIZE;
+}
+
+/**
+ * @brief append a dentry to the boot block
+ * @return ** int 0 on success, -1 on full boot block
+ */
+static int
+add_dentry(const char* name, uint32_t type, uint32_t inode) {
+    uint32_t* count = (uint32_t*) img;
+    uint8_t* d;
+    if (*count >= MAX_DENTRY) return -1;
+    d = img + DENTRY_SIZE * (1 + *count);
+    strncpy((char*) d, name, FNAME_SIZE);   /* 32 chars fill the field with no '\0', like createfs */
+    *(uint32_t*) (d + FNAME_SIZE) = type;
+    *(uint32_t*) (d + FNAME_SIZE + 4) = inode;
+    (*count)++;
+    return 0;
+}
+
+/**
+ * @brief create a regular file, data comes from fp if not NULL, otherwise from the filler pattern
+ * @return ** int 0 on success, -1 on no space
+ */
+static int
+add_file(const char* name, FILE* fp, uint32_t length, uint32_t seed) {
+    uint32_t* inode;
+    uint32_t i, k, d, n = length ? (length - 1) / BLOCK_SIZE + 1 : 1;   /* empty file still owns a block */
+    uint8_t* p;
+    if ((!extent && n > MAX_FILE_BLOCKS) || next_inode >= inode_num || next_dblock + n > dblock_num) return -1;
+    if (add_dentry(name, TYPE_FILE, next_inode)) return -1;
+    inode = (uint32_t*) block(1 + next_inode++);
+    inode[0] = length;
+    if (extent) inode[BLOCK_SIZE / 4 - 1] = INODE_EXT_MAGIC;   /* inode[1] extent count, then (start, len) pairs */
+    for (i = 0; i < n; i++) {
+        d = order[next_dblock++];
+        if (!extent) {
+            inode[1 + i] = d;
+        } else if (inode[1] && inode[2 * inode[1]] + inode[2 * inode[1] + 1] == d) {
+            inode[2 * inode[1] + 1]++;      /* d follows the last extent */
+        } else if (inode[1] < MAX_EXTENT) {
+            inode[1]++;
+            inode[2 * inode[1]] = d;
+            inode[2 * inode[1] + 1] = 1;
+        } else {
+            return -1;
+        }
+        p = block(1 + inode_num + d);
+        if (fp) {
+            if (fread(p, 1, BLOCK_SIZE, fp) == 0 && ferror(fp)) return -1;
+        } else {
+            for (k = 0; k < BLOCK_SIZE && i * BLOCK_SIZE + k < length; k++) p[k] = (uint8_t) (i * BLOCK_SIZE + k + seed);
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[]) {
+    const char *in = NULL, *out = NULL;
+    uint32_t fillers = 0, scatter = 0, i, j, t;
+    uint64_t size;
+    char path[4096], name[FNAME_SIZE + 1];
+    struct dirent* ent;
+    struct stat st;
+    DIR* dir;
+    FILE* fp;
+    int c;
+
+    while ((c = getopt(argc, argv, "i:o:n:d:f:re")) != -1) {
+        switch (c) {
+        case 'i': in = optarg; break;
+        case 'o': out = optarg; break;
+        case 'n': inode_num = strtoul(optarg, NULL, 0); break;
+        case 'd': dblock_num = strtoul(optarg, NULL, 0); break;
+        case 'f': fillers = strtoul(optarg, NULL, 0); break;
+        case 'r': scatter = 1; break;
+        case 'e': extent = 1; break;
+        default: out = NULL; optind = argc; break;
+        }
+    }
+    if (out == NULL || inode_num < 2 || dblock_num == 0) {
+        printf("usage: %s [-i dir] -o image [-n inodes] [-d dblocks] [-f fillers] [-r] [-e]\n", argv[0]);
+        return -1;
+    }
+
+    size = (uint64_t) (1 + inode_num + dblock_num) * BLOCK_SIZE;
+    if (NULL == (img = calloc(1, size)) || NULL == (order = malloc(dblock_num * sizeof(uint32_t)))) {
+        printf("cannot allocate %llu bytes for image\n", (unsigned long long) size);
+        return -1;
+    }
+    for (i = 0; i < dblock_num; i++) order[i] = i;
+    if (scatter) {
+        srand(391);
+        for (i = dblock_num - 1; i > 1; i--) {
+            j = 1 + rand() % i;
+            t = order[i]; order[i] = order[j]; order[j] = t;
+        }
+    }
+
+    ((uint32_t*) img)[1] = inode_num;
+    ((uint32_t*) img)[2] = dblock_num;
+    add_dentry(".", TYPE_DIR, 0);
+    add_dentry("rtc", TYPE_RTC, 0);
+
+    if (in != NULL) {
+        if (NULL == (dir = opendir(in))) {
+            printf("cannot open directory %s\n", in);
+            return -1;
+        }
+        while (NULL != (ent = readdir(dir))) {
+            snprintf(path, sizeof(path), "%s/%s", in, ent->d_name);
+            if (stat(path, &st) || !S_ISREG(st.st_mode)) continue;
+            if (NULL == (fp = fopen(path, "rb"))) continue;
+            if (add_file(ent->d_name, fp, st.st_size, 0)) {
+                printf("no room for %s (inodes, blocks or extents)\n", ent->d_name);
+                fclose(fp);
+                return -1;
+            }
+            fclose(fp);
+        }
+        closedir(dir);
+    }
+
+    for (i = 0; i < fillers; i++) {
+        snprintf(name, sizeof(name), "fill%02u", i);
+        if (add_file(name, NULL, MAX_FILE_BLOCKS * BLOCK_SIZE, i)) {
+            printf("no room for %s (inodes, blocks or extents)\n", name);
+            return -1;
+        }
+    }
+
+    if (NULL == (fp = fopen(out, "wb")) || fwrite(img, 1, size, fp) != size) {
+        printf("cannot write %s\n", out);
+        return -1;
+    }
+    fclose(fp);
+    printf("%s : %u files, %u inodes, %u dblocks (%u used)\n",
+           out, ((uint32_t*) img)[0], inode_num, dblock_num, next_dblock);
+    return 0;
+}
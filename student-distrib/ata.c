@@ -12,6 +12,13 @@
 #include "ata.h"
 #include "lib.h"
 #include "filesystem.h"
+#include "tests.h"
+#include "kmalloc.h"
+#include "bcache.h"
+#include "pci.h"
+#include "blk.h"
+#include "i8259.h"
+#include "process.h"
 #define SECTOR_COUNT 0x1F2
 #define LBAlo        0x1F3
 #define LBAmid       0x1F4
@@ -27,27 +34,141 @@
 #define MASTER_IN       0xE0
 #define SLAVE_IN        0xF0
 #define CACHE_FLUSH     0xE7
+#define CACHE_FLUSH_EXT 0xEA
 
 #define CMD_READ_SECTOR  0x20
 #define CMD_WRITE_SECTOR 0x30
+#define ATA_MAX_SECTORS  256  /* sector count register 0 means 256 */
+#define CMD_READ_DMA     0xC8
+#define CMD_WRITE_DMA    0xCA
+/* LBA48 variants : 48-bit LBA and 16-bit sector count, registers written twice (high byte first) */
+#define CMD_READ_SECTOR_EXT  0x24
+#define CMD_WRITE_SECTOR_EXT 0x34
+#define CMD_READ_DMA_EXT     0x25
+#define CMD_WRITE_DMA_EXT    0x35
+#define ATA_MAX_SECTORS_EXT  2048 /* 1 MB : fits the PRD table even for 4 KB scattered buffers */
+#define LBA28_LIMIT          0x10000000
 
+/* IDENTIFY DEVICE words */
+#define ID_MODEL         27    /* 20 words, bytes swapped */
+#define ID_LBA28_SECTORS 60    /* 2 words */
+#define ID_CMD_SETS      83
+#define ID_CMD_LBA48     0x0400
+#define ID_LBA48_SECTORS 100   /* 4 words */
+#define ID_TIMEOUT       1000000
 
-static uint32_t FS_LBA_BASE;
+/* bus-master IDE (PIIX) registers of the primary channel, relative to BAR4 */
+#define BM_COMMAND       0
+#define BM_STATUS        2
+#define BM_PRDT          4
+#define BM_CMD_START     0x01
+#define BM_CMD_READ      0x08  /* device to memory */
+#define BM_ST_ACTIVE     0x01
+#define BM_ST_ERR        0x02
+#define BM_ST_IRQ        0x04
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
+
+/* physical region descriptor : one piece of the buffer, never across 64 KB */
+typedef struct prd {
+	uint32_t addr;
+	uint16_t count;   /* bytes, 0 means 64 KB */
+	uint16_t flags;
+} prd_t;
+#define PRD_EOT          0x8000
+#define ATA_PRD_MAX      512   /* a 1 MB command gathered from 4 KB buffers, twice over */
+#define DMA_PHYS_END     (32<<22) /* vm_init maps RAM 1:1 below the user pages at 128 MB */
+
+/* 4 KB aligned to 4 KB : the table itself never crosses 64 KB */
+static prd_t prd_table[ATA_PRD_MAX] __attribute__((aligned(4096)));
+static uint32_t bm_base;      /* bus-master I/O base, 0 when DMA is unavailable */
+uint32_t ata_use_dma;
+ata_drive_t ata_drives[2];   /* filled by ata_init, all zero : unknown drive, LBA28 */
+
+/* command the block queue handed to the drive (ata_start), advanced by ata_service */
+static struct {
+	blk_req_t* cmd;   /* head of the command, NULL when idle */
+	blk_req_t* req;   /* request the next PIO sector belongs to */
+	uint32_t off;     /* sectors done inside req */
+	uint32_t left;    /* sectors of the command still to move */
+	uint32_t dma;     /* 1 : bus-master transfer */
+} cur;
+
+
+uint32_t FS_LBA_BASE;
 static uint32_t FS_LBA_MAX;
 
 #define SECTOR_SIZE      512
 #define HPC              16
 #define SPT              63
 
+/* where the image lives on the slave drive : partition 1 of its MBR, or
+ * FS_PART_LBA (first partition as fdisk places it) on a disk without one */
+#define FS_PART_LBA      2048
+#define MBR_PART_TABLE   446
+#define MBR_PART_TYPE    4
+#define MBR_PART_LBA     8
+#define MBR_SIGNATURE    510
+
+/* dirty tracking granularity : one file system block (4 KB) */
+#define FS_BLOCK_SIZE    4096
+#define FS_BLOCK_SECTORS (FS_BLOCK_SIZE/SECTOR_SIZE)
+#define FS_RUN_BLOCKS    (ATA_MAX_SECTORS/FS_BLOCK_SECTORS) /* 32 blocks per command */
+
+static uint32_t fs_st_addr;   /* memory address of the image, block 0 */
+static uint32_t fs_block_num; /* number of 4 KB blocks covered by the image */
+static uint32_t* dirty_map;   /* 1 bit per fs block, set when block differs from disk, sized at open_fs_ata */
+static uint32_t* present_map; /* 1 bit per fs block, set when memory holds the block, sized at open_fs_ata */
+
+/* metadata write-ahead journal, on disk right after the image :
+ * journal block 0 holds journal_header_t, blocks 1..count hold copies of the boot block / inodes
+ * of one transaction. Header and records go out in one command, the checksum tells a torn one. */
+#define JOURNAL_MAGIC     0x4C4E524A /* "JRNL" */
+#define JOURNAL_RECORDS   (FS_RUN_BLOCKS-1) /* header + records fit one command */
+#define JOURNAL_OP_BLOCKS 4  /* most metadata blocks one file system operation dirties */
+#define FLUSH_INTERVAL_MS 500 /* default : changes older than this are written back */
+#define FLUSH_DIRTY_MAX   64  /* default : this many dirty blocks are written back at once */
+
+typedef struct journal_header {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t count;                   /* records in the transaction, 0 once checkpointed */
+	uint32_t checksum;                /* over the header (checksum 0) and the records */
+	uint32_t block[JOURNAL_RECORDS];  /* home block of each record */
+} journal_header_t;
+
+static uint32_t JOURNAL_LBA;
+static uint32_t journal_seq;
+static uint32_t journal_ops;  /* operations since the last commit */
+static uint32_t flush_age;    /* ms the oldest uncommitted change has waited */
+uint32_t fs_flush_ms=FLUSH_INTERVAL_MS;
+uint32_t fs_flush_dirty=FLUSH_DIRTY_MAX;
+uint32_t fs_busy;
+uint32_t fs_dirty_blocks;
+uint32_t fs_bg_flushes;
+uint32_t fs_flush_due; /* set by the PIT tick, fs_flush_run commits */
+static uint8_t  journal_buf[(1+JOURNAL_RECORDS)*FS_BLOCK_SIZE]; /* under the sync lock */
+static uint32_t sync_held;    /* a commit is in sync_fs */
+static uint32_t sync_waiters; /* 1 bit per pid asleep until sync_held drops */
+uint32_t journal_crash_point; /* testing hook : stop a commit right after the journal write */
+
+uint32_t ata_sectors_written;
+uint32_t ata_flushes;
+
 
 #define STATUS_BSY 0x80
 #define STATUS_RDY 0x40
+#define STATUS_DRQ 0x08
+#define STATUS_DF  0x20
+#define STATUS_ERR 0x01
+
+#define EFLAGS_IF  0x200
 
 static void ATA_wait_BSY(){
 	while(inb(0x1F7)&STATUS_BSY);
 }
 static void ATA_wait_DRQ(){
-	while(!(inb(0x1F7)&STATUS_RDY));
+	while(!(inb(0x1F7)&STATUS_DRQ));
 }
 
 
@@ -72,67 +193,441 @@ detect_devtype (int32_t slavebit){
 	return 0;
 }
 
-/* This, interpreted from OSdev, somehow doesn't work */
-// int32_t 
-// identify_command(){
-//     ATA_wait_BSY();
-//     ATA_wait_DRQ();
-//     outb(0xA0,DRIVE_SELECT);
-//     outb(0,SECTOR_COUNT);
-//     outb(0,LBAlo);
-//     outb(0,LBAhi);
-//     outb(COMMAND_IO,DRIVE_SELECT);
-//     while(0==inb(STATUS_PORT));
-//     printf("!\n");
-//     while(1);
-// }
-
-/* This, from OSdev, works */
-static void 
-read_sectors_ATA_PIO(uint32_t target_address, uint32_t LBA, uint8_t sector_count,uint32_t slave_bit){
-    int32_t i,j;
+/**
+ * @brief wait while the drive is busy, with a time limit (the drive may be absent)
+ * @return ** int32_t last status, 0xFF on time out
+ */
+static int32_t
+ata_wait_ready(){
+	uint32_t i;
+	uint8_t st;
+	for(i=0;i<ID_TIMEOUT;i++){
+		st=inb(STATUS_PORT);
+		if(!(st&STATUS_BSY)) return st;
+	}
+	return 0xFF;
+}
+
+/**
+ * @brief send IDENTIFY DEVICE to a drive on the primary channel and record
+ * whether it is there, its size and whether it takes LBA48 commands
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** int32_t 0 when an ATA drive answered
+ * -1 no drive, not an ATA drive (e.g. ATAPI CD-ROM) or error
+ */
+int32_t
+ata_identify(uint32_t slave_bit){
+	uint16_t id[SECTOR_SIZE/2];
+	ata_drive_t* d=&ata_drives[slave_bit&1];
+	uint32_t i;
+	int32_t st;
+	memset(d,0,sizeof(ata_drive_t));
+	if(0xFF==ata_wait_ready()) return -1; /* floating bus : no drive at all */
+	outb(slave_bit?SLAVE_IN:MASTER_IN,DRIVE_SELECT);
+	inb(CTRL_BASE);			/* wait 400ns for drive select to work */
+	inb(CTRL_BASE);
+	inb(CTRL_BASE);
+	inb(CTRL_BASE);
+	outb(0,SECTOR_COUNT);
+	outb(0,LBAlo);
+	outb(0,LBAmid);
+	outb(0,LBAhi);
+	outb(CMD_IDENTIFY,COMMAND_IO);
+	if(0==inb(STATUS_PORT)) return -1;    /* nothing on this position */
+	if(0xFF==(st=ata_wait_ready())) return -1;
+	if(inb(LBAmid)||inb(LBAhi)) return -1; /* ATAPI / SATA signature */
+	for(i=0;i<ID_TIMEOUT&&!(st&(STATUS_DRQ|STATUS_ERR));i++) st=inb(STATUS_PORT);
+	if(!(st&STATUS_DRQ)) return -1;
+	insw(IO_BASE,id,SECTOR_SIZE/2);
+
+	d->present=1;
+	d->sectors=id[ID_LBA28_SECTORS]|(uint32_t)id[ID_LBA28_SECTORS+1]<<16;
+	if(id[ID_CMD_SETS]&ID_CMD_LBA48){
+		d->lba48=1;
+		/* LBAs are 32-bit in the kernel : anything past 2 TB is not addressed */
+		if(id[ID_LBA48_SECTORS+2]||id[ID_LBA48_SECTORS+3]) d->sectors=0xFFFFFFFF;
+		else d->sectors=id[ID_LBA48_SECTORS]|(uint32_t)id[ID_LBA48_SECTORS+1]<<16;
+	}
+	for(i=0;i<20;i++){
+		d->model[2*i]=(int8_t)(id[ID_MODEL+i]>>8);
+		d->model[2*i+1]=(int8_t)id[ID_MODEL+i];
+	}
+	for(i=40;i>0&&(d->model[i-1]==' '||d->model[i-1]==0);i--);
+	d->model[i]=0;
+	return 0;
+}
+
+/**
+ * @brief identify both drives of the primary channel and report them
+ * @return ** int32_t number of ATA drives found
+ */
+int32_t
+ata_init(){
+	uint32_t s,n=0;
+	for(s=0;s<2;s++){
+		if(ata_identify(s)) continue;
+		n++;
+		printf("ata%d: %s, %d MB, %s\n",s,ata_drives[s].model,ata_drives[s].sectors>>11,
+			ata_drives[s].lba48?"LBA48":"LBA28");
+	}
+	return n;
+}
+
+/**
+ * @brief largest command a drive takes
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** uint32_t ATA_MAX_SECTORS_EXT for LBA48 drives, ATA_MAX_SECTORS otherwise
+ */
+uint32_t
+ata_max_sectors(uint32_t slave_bit){
+	return ata_drives[slave_bit&1].lba48?ATA_MAX_SECTORS_EXT:ATA_MAX_SECTORS;
+}
+
+/**
+ * @brief LBA48 form of a read/write command
+ * @param cmd - CMD_READ_SECTOR, CMD_WRITE_SECTOR, CMD_READ_DMA or CMD_WRITE_DMA
+ * @return ** uint8_t the matching EXT command
+ */
+static uint8_t
+ext_command(uint8_t cmd){
+	switch(cmd){
+		case CMD_READ_SECTOR:  return CMD_READ_SECTOR_EXT;
+		case CMD_WRITE_SECTOR: return CMD_WRITE_SECTOR_EXT;
+		case CMD_READ_DMA:     return CMD_READ_DMA_EXT;
+		default:               return CMD_WRITE_DMA_EXT;
+	}
+}
+
+/**
+ * @brief select the drive and issue a read/write command for up to
+ * ata_max_sectors() sectors. The LBA48 form is used only when the drive has
+ * it and the command needs it (past 128 GB or more than 256 sectors).
+ * @param cmd - CMD_READ_SECTOR, CMD_WRITE_SECTOR, CMD_READ_DMA or CMD_WRITE_DMA
+ * @param LBA - first sector
+ * @param sector_count - 1 .. ata_max_sectors(slave_bit)
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** void 
+ */
+static void
+ata_command(uint8_t cmd,uint32_t LBA,uint32_t sector_count,uint32_t slave_bit){
 	ATA_wait_BSY();
+	if(ata_drives[slave_bit&1].lba48&&(sector_count>ATA_MAX_SECTORS||LBA+sector_count>LBA28_LIMIT)){
+		outb(slave_bit?SLAVE_IN:MASTER_IN,DRIVE_SELECT);
+		/* high bytes first : count 15:8, LBA 31:24, 39:32, 47:40 */
+		outb((uint8_t)(sector_count >> 8),SECTOR_COUNT);
+		outb((uint8_t)(LBA >> 24),LBAlo);
+		outb(0,LBAmid);
+		outb(0,LBAhi);
+		outb((uint8_t)sector_count,SECTOR_COUNT); /* 65536 wraps to 0 */
+		outb((uint8_t) LBA,LBAlo);
+		outb((uint8_t)(LBA >> 8),LBAmid);
+		outb((uint8_t)(LBA >> 16),LBAhi);
+		outb(ext_command(cmd),COMMAND_IO);
+		return;
+	}
 	if(slave_bit) outb(SLAVE_IN | ((LBA >>24) & 0xF),DRIVE_SELECT);
 	else outb(MASTER_IN | ((LBA >>24) & 0xF),DRIVE_SELECT);
-	outb(sector_count,SECTOR_COUNT);
+	outb((uint8_t)sector_count,SECTOR_COUNT); /* 256 wraps to 0 */
 	outb((uint8_t) LBA,LBAlo);
 	outb((uint8_t)(LBA >> 8),LBAmid);
 	outb((uint8_t)(LBA >> 16),LBAhi); 
-	outb(CMD_READ_SECTOR,STATUS_PORT); //Send the read command
+	outb(cmd,COMMAND_IO);
+}
 
-	uint16_t *target = (uint16_t*) target_address;
+/**
+ * @brief move sectors with PIO, one command per ata_max_sectors() sectors,
+ * each sector with a single rep insw/outsw
+ * @param write - 0 : disk to memory, 1 : memory to disk
+ * @param addr - memory buffer
+ * @param LBA - first sector
+ * @param sector_count - number of sectors
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** void 
+ */
+static void
+pio_transfer(uint32_t write,uint32_t addr,uint32_t LBA,uint32_t sector_count,uint32_t slave_bit){
+	uint32_t j,n,max=ata_max_sectors(slave_bit);
+	uint16_t* target=(uint16_t*)addr;
 
-	for(j=0;j<sector_count;j++){
-		ATA_wait_BSY();
-		ATA_wait_DRQ();
-		for(i=0;i<256;i++)
-			target[i] = inw(IO_BASE);
-		target+=256;
+	for(;sector_count;sector_count-=n,LBA+=n){
+		n=sector_count>max?max:sector_count;
+		ata_command(write?CMD_WRITE_SECTOR:CMD_READ_SECTOR,LBA,n,slave_bit);
+		for(j=0;j<n;j++){
+			ATA_wait_BSY();
+			ATA_wait_DRQ();
+			if(write) outsw(IO_BASE,target,SECTOR_SIZE/2);
+			else insw(IO_BASE,target,SECTOR_SIZE/2);
+			target+=SECTOR_SIZE/2;
+		}
 	}
+	ATA_wait_BSY();
 }
 
-static void 
-write_sectors_ATA_PIO(uint32_t LBA, uint8_t sector_count, uint32_t target_address,uint32_t slave_bit){
-	int32_t i,j;
-	ATA_wait_BSY();
-	if(slave_bit) outb(SLAVE_IN | ((LBA >>24) & 0xF),0x1F6);
-	else outb(MASTER_IN | ((LBA >>24) & 0xF),0x1F6);
-	outb(sector_count,SECTOR_COUNT);
-	outb((uint8_t) LBA,LBAlo );
-	outb((uint8_t)(LBA >> 8),LBAmid);
-	outb((uint8_t)(LBA >> 16),LBAhi); 
-	outb(CMD_WRITE_SECTOR,COMMAND_IO); //Send the write command
+/**
+ * @brief describe a command's buffers in the PRD table and arm the bus master.
+ * Buffers of neighbouring requests that follow each other in memory share entries.
+ * @param h - command head, requests chained in LBA order
+ * @return ** int32_t 0 when the bus master is ready
+ * -1 when a buffer can't be reached by DMA or the table is too small
+ */
+static int32_t
+dma_setup(blk_req_t* h){
+	blk_req_t* r;
+	uint32_t n=0,addr,len,chunk;
+	for(r=h;r!=NULL;r=r->chain){
+		addr=r->addr;
+		len=r->count*SECTOR_SIZE;
+		if(addr+len>DMA_PHYS_END||(addr&1)) return -1;
+		while(len){
+			chunk=0x10000-(addr&0xFFFF);
+			if(chunk>len) chunk=len;
+			if(n&&(addr&0xFFFF)&&prd_table[n-1].addr+prd_table[n-1].count==addr){
+				/* continues the last entry inside the same 64 KB */
+				prd_table[n-1].count+=chunk;
+			}else{
+				if(n==ATA_PRD_MAX) return -1;
+				prd_table[n].addr=addr;
+				prd_table[n].count=(uint16_t)chunk;
+				prd_table[n].flags=0;
+				n++;
+			}
+			addr+=chunk;
+			len-=chunk;
+		}
+	}
+	prd_table[n-1].flags=PRD_EOT;
+	outb(h->write?0:BM_CMD_READ,bm_base+BM_COMMAND);
+	outl((uint32_t)prd_table,bm_base+BM_PRDT);
+	outb(BM_ST_ERR|BM_ST_IRQ,bm_base+BM_STATUS); /* write 1 to clear */
+	return 0;
+}
+
+/**
+ * @brief move the next PIO sector of the in-flight command
+ * @return ** void 
+ */
+static void
+pio_sector(){
+	uint16_t* buf=(uint16_t*)(cur.req->addr+cur.off*SECTOR_SIZE);
+	if(cur.cmd->write) outsw(IO_BASE,buf,SECTOR_SIZE/2);
+	else insw(IO_BASE,buf,SECTOR_SIZE/2);
+	cur.left--;
+	if(++cur.off==cur.req->count&&cur.req->chain!=NULL){
+		cur.req=cur.req->chain;
+		cur.off=0;
+	}
+}
 
-	uint16_t* target=(uint16_t*)target_address;
-	for (j=0;j<sector_count;j++){
+/**
+ * @brief issue the in-flight command with PIO : the drive interrupts once per sector
+ * @return ** void 
+ */
+static void
+pio_start(){
+	blk_req_t* h=cur.cmd;
+	cur.req=h;
+	cur.off=0;
+	cur.left=h->span;
+	cur.dma=0;
+	ata_command(h->write?CMD_WRITE_SECTOR:CMD_READ_SECTOR,h->lba,h->span,h->slave);
+	if(h->write){
+		/* the first sector goes out now, the drive asks for the others by interrupt */
 		ATA_wait_BSY();
 		ATA_wait_DRQ();
-		for(i=0;i<256;i++){
-			outw(target[i],IO_BASE);
+		pio_sector();
+	}
+}
+
+/**
+ * @brief block queue driver hook : send a command (a request and the ones
+ * merged behind it) to the drive, with DMA when possible. Interrupts are off.
+ * @param h - command head
+ * @return ** int32_t 0
+ */
+int32_t
+ata_start(blk_req_t* h){
+	cur.cmd=h;
+	if(ata_use_dma&&bm_base&&0==dma_setup(h)){
+		cur.dma=1;
+		cur.left=h->span;
+		ata_command(h->write?CMD_WRITE_DMA:CMD_READ_DMA,h->lba,h->span,h->slave);
+		outb((h->write?0:BM_CMD_READ)|BM_CMD_START,bm_base+BM_COMMAND);
+		return 0;
+	}
+	pio_start();
+	return 0;
+}
+
+/**
+ * @brief block queue driver hook : advance the in-flight command after a disk
+ * interrupt (or when a waiter polls). Safe to call when nothing happened yet.
+ * @return ** int32_t BLK_PENDING, BLK_DONE or BLK_ERR
+ */
+int32_t
+ata_service(){
+	uint8_t st,bm;
+	if(cur.cmd==NULL) return BLK_PENDING;
+	if(cur.dma){
+		bm=inb(bm_base+BM_STATUS);
+		if(!(bm&(BM_ST_IRQ|BM_ST_ERR))) return BLK_PENDING;
+		st=inb(STATUS_PORT); /* acknowledges the drive interrupt */
+		if(st&STATUS_BSY) return BLK_PENDING;
+		outb(cur.cmd->write?0:BM_CMD_READ,bm_base+BM_COMMAND);
+		outb(BM_ST_ERR|BM_ST_IRQ,bm_base+BM_STATUS);
+		if((bm&BM_ST_ERR)||(st&(STATUS_ERR|STATUS_DF))){
+			pio_start(); /* redo the whole command with PIO */
+			return BLK_PENDING;
 		}
+		cur.cmd=NULL;
+		return BLK_DONE;
+	}
+	st=inb(STATUS_PORT);
+	if(st&STATUS_BSY) return BLK_PENDING;
+	if(st&(STATUS_ERR|STATUS_DF)){
+		cur.cmd=NULL;
+		return BLK_ERR;
 	}
-	outb(CACHE_FLUSH,COMMAND_IO);
+	if(cur.left&&(st&STATUS_DRQ)) pio_sector();
+	if(cur.left==0&&(!cur.cmd->write||!(st&STATUS_DRQ))){
+		cur.cmd=NULL;
+		return BLK_DONE;
+	}
+	return BLK_PENDING;
+}
+
+/**
+ * @brief IRQ 14 handler : completes the block queue's in-flight command
+ * @return ** void 
+ */
+void
+ata_handler(){
+	blk_interrupt();
+	inb(STATUS_PORT); /* an interrupt nobody waited for (e.g. cache flush) must be acknowledged too */
+	send_eoi(ATA_IRQ);
+}
+
+/**
+ * @brief let the drive raise IRQ 14 and unmask it on the PIC
+ * @return ** void 
+ */
+void
+ata_irq_init(){
+	outb(0x00,CTRL_BASE); /* nIEN cleared */
+	inb(STATUS_PORT);
+	enable_irq(ATA_IRQ);
+}
+
+/**
+ * @brief read sectors with PIO, bypassing the queue (waits for it to drain)
+ * @param target_address - destination buffer
+ * @param LBA - first sector
+ * @param sector_count - number of sectors
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** void 
+ */
+void 
+read_sectors_ATA_PIO(uint32_t target_address, uint32_t LBA, uint32_t sector_count,uint32_t slave_bit){
+	blk_drain();
+	pio_transfer(0,target_address,LBA,sector_count,slave_bit);
+}
+
+/**
+ * @brief write sectors with PIO, bypassing the queue (waits for it to drain).
+ * The drive may keep the data in its write cache : call ata_flush() where
+ * the order of writes matters.
+ * @param LBA - first sector
+ * @param sector_count - number of sectors
+ * @param target_address - source buffer
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** void 
+ */
+void 
+write_sectors_ATA_PIO(uint32_t LBA, uint32_t sector_count, uint32_t target_address,uint32_t slave_bit){
+	blk_drain();
+	if(slave_bit) bcache_invalidate(LBA,sector_count);
+	ata_sectors_written+=sector_count;
+	pio_transfer(1,target_address,LBA,sector_count,slave_bit);
+}
+
+/**
+ * @brief read sectors through the block queue (DMA when available, PIO otherwise)
+ * and wait for them
+ * @param target_address - destination buffer
+ * @param LBA - first sector
+ * @param sector_count - number of sectors
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** void 
+ */
+void
+ata_read(uint32_t target_address, uint32_t LBA, uint32_t sector_count,uint32_t slave_bit){
+	blk_rw(0,target_address,LBA,sector_count,slave_bit);
+}
+
+/**
+ * @brief write sectors through the block queue and wait for them.
+ * Like write_sectors_ATA_PIO, the data may sit in the drive cache until ata_flush().
+ * @param LBA - first sector
+ * @param sector_count - number of sectors
+ * @param target_address - source buffer
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** void 
+ */
+void
+ata_write(uint32_t LBA, uint32_t sector_count, uint32_t target_address,uint32_t slave_bit){
+	if(slave_bit) bcache_invalidate(LBA,sector_count);
+	ata_sectors_written+=sector_count;
+	blk_rw(1,target_address,LBA,sector_count,slave_bit);
+}
+
+/**
+ * @brief find the PCI IDE controller and turn on bus mastering for the primary channel
+ * @return ** int32_t 0 when DMA is usable
+ * -1 otherwise, transfers stay PIO
+ */
+int32_t
+ata_dma_init(){
+	uint32_t bdf,bar;
+	bm_base=0;
+	ata_use_dma=0;
+	if(PCI_NONE==(bdf=pci_find_class(PCI_CLASS_STORAGE,PCI_SUBCLASS_IDE))) return -1;
+	bar=pci_read32(bdf,PCI_BAR4);
+	if(!(bar&1)||!(bar&~3)) return -1; /* must be an I/O range */
+	/* upper half is the status register, writing 0 there leaves it alone */
+	pci_write32(bdf,PCI_COMMAND,(pci_read32(bdf,PCI_COMMAND)&0xFFFF)|PCI_COMMAND_IO|PCI_COMMAND_MASTER);
+	bm_base=bar&~3;
+	ata_use_dma=1;
+	return 0;
+}
+
+/**
+ * @brief flush the drive write cache : every sector written before (and queued) is on the platter
+ * @param slave_bit - 0 : master drive, 1 : slave drive
+ * @return ** void 
+ */
+void
+ata_flush(uint32_t slave_bit){
+	blk_drain();
 	ATA_wait_BSY();
+	outb(slave_bit?SLAVE_IN:MASTER_IN,DRIVE_SELECT);
+	outb(ata_drives[slave_bit&1].lba48?CACHE_FLUSH_EXT:CACHE_FLUSH,COMMAND_IO);
+	ATA_wait_BSY();
+	ata_flushes++;
+}
+
+/**
+ * @brief find the image on the slave drive : start of partition 1 if the
+ * drive has an MBR, FS_PART_LBA otherwise
+ * @return ** uint32_t first sector of the image
+ */
+static uint32_t
+fs_partition_lba(){
+	uint8_t mbr[SECTOR_SIZE];
+	uint32_t lba;
+	ata_read((uint32_t)mbr,0,1,1);
+	if(mbr[MBR_SIGNATURE]!=0x55||mbr[MBR_SIGNATURE+1]!=0xAA||mbr[MBR_PART_TABLE+MBR_PART_TYPE]==0)
+		return FS_PART_LBA;
+	lba=*(uint32_t*)(mbr+MBR_PART_TABLE+MBR_PART_LBA);
+	return lba?lba:FS_PART_LBA;
 }
 
 /* This is testing program, from 
@@ -189,45 +684,439 @@ void test_read_write(){
  */
 void  
 open_fs_ata(uint32_t st,uint32_t ed){
-	FS_LBA_BASE=((st/SECTOR_SIZE/SPT/HPC)*HPC+st/SECTOR_SIZE/SPT%HPC)*SPT+st/SECTOR_SIZE%SPT;
-	FS_LBA_MAX= ((ed/SECTOR_SIZE/SPT/HPC)*HPC+ed/SECTOR_SIZE/SPT%HPC)*SPT+ed/SECTOR_SIZE%SPT;
+	uint32_t i;
+	FS_LBA_BASE=fs_partition_lba();
+	FS_LBA_MAX=FS_LBA_BASE+(ed-st+SECTOR_SIZE-1)/SECTOR_SIZE;
+	fs_st_addr=st;
+	fs_block_num=(ed-st+FS_BLOCK_SIZE-1)/FS_BLOCK_SIZE;
+	JOURNAL_LBA=FS_LBA_BASE+fs_block_num*FS_BLOCK_SECTORS;
+	journal_ops=0;
+	fs_dirty_blocks=0;
+	if(dirty_map) kfree(dirty_map);
+	if(present_map) kfree(present_map);
+	dirty_map=present_map=NULL;
+	if(ata_drives[1].present&&JOURNAL_LBA+(JOURNAL_RECORDS+1)*FS_BLOCK_SECTORS>ata_drives[1].sectors){
+		/* a commit would write past the end of the disk */
+		printf("hdb has %d sectors : too small for the image and its journal, write back disabled\n",ata_drives[1].sectors);
+		fs_block_num=0;
+		return;
+	}
+	if(NULL==(dirty_map=kmalloc(MAP_WORDS(fs_block_num)*sizeof(uint32_t)))){
+		printf("no memory for dirty block map, write back disabled\n");
+		fs_block_num=0;
+		return;
+	}
+	/* disk content is unknown until the first dump : every block is dirty */
+	for(i=0;i<MAP_WORDS(fs_block_num);i++) dirty_map[i]=0xFFFFFFFF;
+	fs_dirty_blocks=fs_block_num;
+	flush_age=0;
+	#ifdef DISK_PREPARED
+	/* image is read back from disk, so memory and disk agree */
+	for(i=0;i<MAP_WORDS(fs_block_num);i++) dirty_map[i]=0;
+	fs_dirty_blocks=0;
+	/* data blocks come in on first use through the block cache */
+	if(bcache_init()||NULL==(present_map=kmalloc(MAP_WORDS(fs_block_num)*sizeof(uint32_t)))){
+		printf("no memory for block cache, file system read at once\n");
+		return;
+	}
+	for(i=0;i<MAP_WORDS(fs_block_num);i++) present_map[i]=0;
+	#endif
 }
 
 /**
- * @brief read file system from MASTER/SLAVE hard drive depending on the condition
- * 
+ * @brief mark the file system blocks covering [addr, addr+len) as dirty,
+ * they will be written back on the next commit
+ * @param addr - memory address inside the file system image
+ * @param len - number of bytes modified
+ * @return ** void 
+ */
+void
+mark_dirty_fs(uint32_t addr,uint32_t len){
+	uint32_t b,ed;
+	if(len==0||addr<fs_st_addr) return;
+	b=(addr-fs_st_addr)/FS_BLOCK_SIZE;
+	ed=(addr-fs_st_addr+len-1)/FS_BLOCK_SIZE;
+	for(;b<=ed&&b<fs_block_num;b++){
+		if(MAP_TEST(dirty_map,b)) continue;
+		MAP_SET(dirty_map,b);
+		fs_dirty_blocks++;
+	}
+}
+
+/**
+ * @brief bring the blocks covering [addr, addr+len) into the memory image if
+ * they are still only on disk. Called before the file system touches data blocks.
+ * @param addr - memory address inside the file system image
+ * @param len - number of bytes about to be accessed
+ * @param overwrite - 1 : the bytes are about to be overwritten, a block covered
+ * from end to end doesn't need its old content
+ * @return ** void 
+ */
+void
+fetch_fs(uint32_t addr,uint32_t len,int32_t overwrite){
+	uint32_t b,ed,st,cnt;
+	uint8_t* blk;
+	if(present_map==NULL||len==0||addr<fs_st_addr) return;
+	b=(addr-fs_st_addr)/FS_BLOCK_SIZE;
+	ed=(addr-fs_st_addr+len-1)/FS_BLOCK_SIZE;
+	for(;b<=ed&&b<fs_block_num;b++){
+		if(MAP_TEST(present_map,b)) continue;
+		MAP_SET(present_map,b);
+		st=fs_st_addr+b*FS_BLOCK_SIZE;
+		if(overwrite&&st>=addr&&st+FS_BLOCK_SIZE<=addr+len) continue;
+		if(NULL==(blk=bcache_read(FS_LBA_BASE+b*FS_BLOCK_SECTORS,FS_LBA_MAX))) continue;
+		cnt=(FS_LBA_MAX-FS_LBA_BASE)*SECTOR_SIZE-b*FS_BLOCK_SIZE; /* last block may be short */
+		memcpy((void*)st,blk,cnt<FS_BLOCK_SIZE?cnt:FS_BLOCK_SIZE);
+	}
+}
+
+/**
+ * @brief read file system from MASTER/SLAVE hard drive depending on the condition.
+ * With the block cache only the boot block and the inodes are read here,
+ * data blocks follow on demand through fetch_fs().
  * @param slave_bit 0 : read from master drive - 1 : read from slave drive
+ * @param st - starting address
+ * @param ed - ending address
  * @return ** void 
  */
 void 
 read_fs_ata(int32_t slave_bit,uint32_t st,uint32_t ed){
-	uint32_t lba;
-	int32_t i,j,size=0;
-	uint16_t  buf[512];
+	uint32_t meta_end,b;
+	uint8_t* blk;
 	
-	for(lba=FS_LBA_BASE;lba<FS_LBA_MAX;lba++){
-		read_sectors_ATA_PIO((uint32_t)buf,lba,1,slave_bit);
-		j=0;
-		for(i=((uint32_t)st)+(lba-FS_LBA_BASE)*SECTOR_SIZE;
-		i<((uint32_t)st)+(lba-FS_LBA_BASE+1)*SECTOR_SIZE;i+=2){
-			*((uint16_t*)i)=buf[j++];
-			size++;
+	if(slave_bit&&present_map){
+		fetch_fs(st,FS_BLOCK_SIZE,0);
+		meta_end=1+((uint32_t*)st)[1]; /* boot block + inodes */
+		if(meta_end>fs_block_num) meta_end=fs_block_num;
+		/* one sequential stream, read ahead no further than the last inode */
+		for(b=1;b<meta_end;b++){
+			if(NULL==(blk=bcache_read(FS_LBA_BASE+b*FS_BLOCK_SECTORS,FS_LBA_BASE+meta_end*FS_BLOCK_SECTORS))) break;
+			memcpy((void*)(st+b*FS_BLOCK_SIZE),blk,FS_BLOCK_SIZE);
+			MAP_SET(present_map,b);
 		}
+		printf("read file system metadata, %d of %d blocks\n",meta_end,fs_block_num);
+		#ifdef RUN_TESTS
+		bcache_print_stats();
+		#endif
+		return;
+	}
+	if(ata_drives[slave_bit&1].present&&FS_LBA_MAX>ata_drives[slave_bit&1].sectors){
+		printf("image does not fit on the disk : boot module used as is\n");
+		return;
 	}
-	printf("read file system with size = %d\n",size*2);
+	ata_read(st,FS_LBA_BASE,FS_LBA_MAX-FS_LBA_BASE,slave_bit);
+	printf("read file system with size = %d\n",(FS_LBA_MAX-FS_LBA_BASE)*SECTOR_SIZE);
 }
 
 /**
- * @brief dump the file system into SLAVE hard drive
- * @return ** void 
+ * @brief write the dirty blocks in [from, to) to their home on SLAVE hard drive and clean them.
+ * Every block is its own request; the block queue merges neighbouring blocks
+ * (e.g. a file laid out as one extent) into commands of up to 256 sectors.
+ * @param from - first block
+ * @param to - block after the last one
+ * @return ** uint32_t number of sectors written
  */
-void dump_fs(){
-	uint32_t lba;
+static uint32_t
+write_dirty(uint32_t from,uint32_t to){
+	static blk_req_t req[BLK_BATCH]; /* under the sync lock, callers sleep in blk_wait */
+	uint32_t b,i,n=0,lba;
 	uint32_t num=0;
-	for(lba=FS_LBA_BASE;lba<FS_LBA_MAX;lba++){
-		write_sectors_ATA_PIO(lba,1,((uint32_t)fs.sys_st_addr)+(lba-FS_LBA_BASE)*SECTOR_SIZE,1);
-		num++;
+	if(to>fs_block_num) to=fs_block_num;
+	for(b=from;b<to;b++){
+		if(!dirty_map[b>>5]){ b|=31; continue; } /* skip 32 clean blocks at once */
+		if(!MAP_TEST(dirty_map,b)) continue;
+		MAP_CLEAR(dirty_map,b);
+		fs_dirty_blocks--;
+		lba=FS_LBA_BASE+b*FS_BLOCK_SECTORS;
+		if(lba>=FS_LBA_MAX) break;
+		if(n==BLK_BATCH){
+			for(i=0;i<n;i++) blk_wait(&req[i]);
+			n=0;
+		}
+		req[n].lba=lba;
+		req[n].count=FS_LBA_MAX-lba<FS_BLOCK_SECTORS?FS_LBA_MAX-lba:FS_BLOCK_SECTORS;
+		req[n].addr=fs_st_addr+b*FS_BLOCK_SIZE;
+		req[n].write=1;
+		req[n].slave=1;
+		bcache_invalidate(lba,req[n].count);
+		ata_sectors_written+=req[n].count;
+		num+=req[n].count;
+		blk_submit(&req[n++]);
 	}
+	for(i=0;i<n;i++) blk_wait(&req[i]);
+	return num;
+}
+
+/**
+ * @brief checksum of a journal transaction : header with checksum field 0, then the records
+ * @param h - header, followed in memory by its records
+ * @return ** uint32_t checksum
+ */
+static uint32_t
+journal_sum(journal_header_t* h){
+	uint32_t i,sum=h->seq,saved=h->checksum;
+	uint32_t* w=(uint32_t*)h;
+	uint32_t* rec=(uint32_t*)((uint32_t)h+FS_BLOCK_SIZE);
+	h->checksum=0;
+	for(i=0;i<sizeof(journal_header_t)/4;i++) sum=((sum<<5)|(sum>>27))^w[i];
+	for(i=0;i<h->count*FS_BLOCK_SIZE/4;i++) sum=((sum<<5)|(sum>>27))^rec[i];
+	h->checksum=saved;
+	return sum;
+}
+
+/**
+ * @brief write the blocks of the transaction in journal_buf to their home.
+ * The copies are what was journaled : metadata changed while the commit
+ * slept on the disk stays dirty for the next transaction.
+ * @param h - header of the committed transaction, in journal_buf
+ * @return ** uint32_t number of sectors written
+ */
+static uint32_t
+journal_checkpoint(journal_header_t* h){
+	static blk_req_t req[JOURNAL_RECORDS]; /* under the sync lock */
+	uint32_t i,n=0,lba,num=0;
+	for(i=0;i<h->count;i++){
+		lba=FS_LBA_BASE+h->block[i]*FS_BLOCK_SECTORS;
+		if(lba>=FS_LBA_MAX) continue;
+		req[n].lba=lba;
+		req[n].count=FS_LBA_MAX-lba<FS_BLOCK_SECTORS?FS_LBA_MAX-lba:FS_BLOCK_SECTORS;
+		req[n].addr=(uint32_t)journal_buf+(1+i)*FS_BLOCK_SIZE;
+		req[n].write=1;
+		req[n].slave=1;
+		bcache_invalidate(lba,req[n].count);
+		ata_sectors_written+=req[n].count;
+		num+=req[n].count;
+		blk_submit(&req[n++]);
+	}
+	for(i=0;i<n;i++) blk_wait(&req[i]);
+	return num;
+}
+
+/**
+ * @brief mark the journal empty on disk : its transaction has reached home
+ * @return ** uint32_t number of sectors written
+ */
+static uint32_t
+journal_clear(){
+	journal_header_t* h=(journal_header_t*)journal_buf;
+	h->magic=JOURNAL_MAGIC;
+	h->seq=journal_seq;
+	h->count=0;
+	h->checksum=0;
+	ata_write(JOURNAL_LBA,1,(uint32_t)journal_buf,1);
+	return 1;
+}
+
+/**
+ * @brief take the sync lock. blk_wait sleeps with interrupts on, so a second
+ * process (fsync, or dump_fs crossing the journal threshold) can reach sync_fs
+ * while a commit is in flight : it sleeps here until the holder leaves.
+ * A caller that can't sleep (interrupts off, or before the shell runs) gets
+ * the lock only when it is free.
+ * @return ** int32_t 0 : lock taken
+ * -1 : held by a commit in flight and the caller can't wait
+ */
+static int32_t
+sync_lock(){
+	uint32_t flags,eflags,pid=get_pid();
+	asm volatile ("pushfl; popl %0" : "=r" (eflags));
+	cli_and_save(flags);
+	if(pid==0||!(eflags&EFLAGS_IF)){
+		if(sync_held){
+			restore_flags(flags);
+			return -1;
+		}
+	}else{
+		while(sync_held){
+			sync_waiters|=1<<pid;
+			PCB(pid)->state=SLEEPING;
+			/* sti takes effect after hlt is reached : the wake-up can't slip in between */
+			asm volatile ("sti; hlt; cli" : : : "memory");
+		}
+		PCB(pid)->state=RUNNING;
+	}
+	sync_held=1;
+	restore_flags(flags);
+	return 0;
+}
+
+/**
+ * @brief release the sync lock and wake every process waiting for it
+ * @return ** void
+ */
+static void
+sync_unlock(){
+	uint32_t flags,pid;
+	if(sync_held==0) return;
+	cli_and_save(flags);
+	sync_held=0;
+	for(pid=1;pid<=PCB_MAX;pid++){
+		if(!(sync_waiters&(1<<pid))) continue;
+		if(PCB(pid)->state==SLEEPING) PCB(pid)->state=RUNNABLE;
+	}
+	sync_waiters=0;
+	restore_flags(flags);
+}
+
+/**
+ * @brief commit everything dirtied since the last commit.
+ * Ordered like ext3 : data blocks go home first, then the dirty metadata
+ * (boot block, inodes ; the bitmaps are rebuilt from them at mount) is written
+ * sequentially to the journal as one transaction, checkpointed to its home
+ * from the journaled copies, and the journal is marked empty. A crash at any point leaves either the old
+ * or the new metadata after replay_journal_ata(). The drive cache is flushed
+ * between the steps only, not after every command.
+ * Holds fs_busy : the background flusher never starts a second commit while
+ * this one sleeps on the disk ; a second caller waits on the sync lock, or
+ * leaves the commit to the flusher when it can't sleep.
+ * @return ** void 
+ */
+void sync_fs(){
+	journal_header_t* h=(journal_header_t*)journal_buf;
+	uint32_t b,i,n=0,meta_end,num;
+	if(sync_lock()){
+		fs_flush_due=1; /* a commit sleeps on the disk : the flusher commits this later */
+		return;
+	}
+	fs_busy++;
+	journal_ops=0;
+	flush_age=0;
+	meta_end=1+fs.iblock_num; /* boot block + inodes */
+	if(meta_end>fs_block_num) meta_end=fs_block_num;
+	num=write_dirty(meta_end,fs_block_num);
+	for(b=0;b<meta_end;b++){
+		if(!MAP_TEST(dirty_map,b)) continue;
+		if(n<JOURNAL_RECORDS) h->block[n]=b;
+		n++;
+	}
+	if(n>JOURNAL_RECORDS){
+		/* larger than a transaction (first commit of an unknown disk) : plain write */
+		num+=write_dirty(0,meta_end);
+		ata_flush(1);
+		num+=journal_clear();
+	}else if(n){
+		if(num) ata_flush(1); /* data is on the platter before metadata points at it */
+		/* the copies are clean from here : a change after this goes in the next transaction */
+		for(i=0;i<n;i++){
+			memcpy(journal_buf+(1+i)*FS_BLOCK_SIZE,(void*)(fs_st_addr+h->block[i]*FS_BLOCK_SIZE),FS_BLOCK_SIZE);
+			MAP_CLEAR(dirty_map,h->block[i]);
+			fs_dirty_blocks--;
+		}
+		h->magic=JOURNAL_MAGIC;
+		h->seq=++journal_seq;
+		h->count=n;
+		h->checksum=journal_sum(h);
+		/* commit point */
+		ata_write(JOURNAL_LBA,(1+n)*FS_BLOCK_SECTORS,(uint32_t)journal_buf,1);
+		ata_flush(1);
+		num+=(1+n)*FS_BLOCK_SECTORS;
+		if(journal_crash_point){
+			for(i=0;i<n;i++){ /* home never written */
+				if(MAP_TEST(dirty_map,h->block[i])) continue;
+				MAP_SET(dirty_map,h->block[i]);
+				fs_dirty_blocks++;
+			}
+			fs_busy--;
+			sync_unlock();
+			return;
+		}
+		num+=journal_checkpoint(h);
+		ata_flush(1);
+		num+=journal_clear();
+	}
+	if(num) ata_flush(1);
+	fs_busy--;
+	sync_unlock();
+	#ifdef RUN_TESTS
 	printf("%d sectors written into disks\n",num);
+	#endif
+}
+
+/**
+ * @brief end of one file system operation. The commit is left to the
+ * background flusher (fs_flush_tick, fs_flush_run) unless the next operation might not
+ * fit in the journal.
+ * @return ** void 
+ */
+void dump_fs(){
+	uint32_t b,n=0;
+	journal_ops++;
+	for(b=0;b<=fs.iblock_num&&b<fs_block_num;b++){
+		if(!dirty_map[b>>5]){ b|=31; continue; }
+		n+=MAP_TEST(dirty_map,b);
+	}
+	if(n+JOURNAL_OP_BLOCKS>JOURNAL_RECORDS) sync_fs();
+}
+
+/**
+ * @brief write-back clock, called from the PIT interrupt. Once the oldest
+ * change has waited fs_flush_ms or fs_flush_dirty blocks are dirty, the
+ * commit is only marked due : it runs in fs_flush_run on the way back to user
+ * space, where the disk can be waited for with interrupts on. Postponed while
+ * an operation is half done (fs_busy), the commit would journal a
+ * half-updated inode.
+ * @param ms - time since the last tick
+ * @return ** void 
+ */
+void
+fs_flush_tick(uint32_t ms){
+	if(fs_dirty_blocks==0){
+		flush_age=0;
+		return;
+	}
+	flush_age+=ms;
+	if(fs_busy||(flush_age<fs_flush_ms&&fs_dirty_blocks<fs_flush_dirty)) return;
+	fs_flush_due=1;
+}
+
+/**
+ * @brief run the commit fs_flush_tick asked for, from process context
+ * (do_signal, before a process goes back to user space)
+ * @return ** void 
+ */
+void
+fs_flush_run(){
+	if(!fs_flush_due||fs_busy) return;
+	fs_flush_due=0;
+	if(fs_dirty_blocks==0) return;
+	sync_fs();
+	fs_bg_flushes++;
+}
+
+/**
+ * @brief finish the transaction found in the journal, if its commit made it to disk.
+ * Called at mount after the image is read back, before the boot block is parsed.
+ * @return ** int32_t number of metadata blocks replayed
+ */
+int32_t
+replay_journal_ata(){
+	journal_header_t* h=(journal_header_t*)journal_buf;
+	uint32_t i;
+	if(fs_block_num==0) return 0; /* write back disabled : no journal on disk */
+	ata_read((uint32_t)journal_buf,JOURNAL_LBA,1,1);
+	if(h->magic!=JOURNAL_MAGIC) return 0; /* journal never written */
+	journal_seq=h->seq;
+	if(h->count==0||h->count>JOURNAL_RECORDS) return 0;
+	ata_read((uint32_t)journal_buf,JOURNAL_LBA,(1+h->count)*FS_BLOCK_SECTORS,1);
+	if(h->checksum!=journal_sum(h)){
+		printf("torn journal transaction %d discarded\n",h->seq);
+		journal_clear();
+		ata_flush(1);
+		return 0;
+	}
+	for(i=0;i<h->count;i++){
+		if(h->block[i]>=fs_block_num) continue;
+		memcpy((void*)(fs_st_addr+h->block[i]*FS_BLOCK_SIZE),journal_buf+(1+i)*FS_BLOCK_SIZE,FS_BLOCK_SIZE);
+		if(!MAP_TEST(dirty_map,h->block[i])) fs_dirty_blocks++;
+		MAP_SET(dirty_map,h->block[i]);
+		if(present_map) MAP_SET(present_map,h->block[i]);
+	}
+	printf("journal transaction %d replayed, %d blocks\n",h->seq,h->count);
+	i=h->count;
+	write_dirty(0,fs_block_num);
+	ata_flush(1);
+	journal_clear();
+	ata_flush(1);
+	return i;
 }
 
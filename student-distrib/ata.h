@@ -5,11 +5,52 @@
 // #define DISK_PREPARED
 
 #include "types.h"
+#include "blk.h"
 
-extern int32_t identify_command();
+#define ATA_IRQ 14
+
+/* what IDENTIFY DEVICE told about a drive of the primary channel */
+typedef struct ata_drive {
+	uint32_t present;
+	uint32_t lba48;     /* takes READ/WRITE ... EXT commands */
+	uint32_t sectors;   /* addressable sectors, capped at 2^32-1 */
+	int8_t   model[41];
+} ata_drive_t;
+
+extern ata_drive_t ata_drives[2];
+extern int32_t ata_identify(uint32_t slave_bit);
+extern int32_t ata_init();
+extern uint32_t ata_max_sectors(uint32_t slave_bit);
 extern int32_t detect_devtype (int32_t slavebit);
 extern void    test_read_write();
 extern void    dump_fs();
+extern void    sync_fs();
+extern int32_t replay_journal_ata();
+extern uint32_t journal_crash_point;
+extern void    mark_dirty_fs(uint32_t addr,uint32_t len);
+extern void    fs_flush_tick(uint32_t ms);
+extern void    fs_flush_run();
+extern uint32_t fs_flush_due;         /* the flusher's commit waits for process context */
+extern uint32_t fs_flush_ms;          /* write-back delay of the background flusher */
+extern uint32_t fs_flush_dirty;       /* dirty blocks that make the flusher commit right away */
+extern uint32_t fs_busy;              /* operations in progress that may sleep or be preempted */
+extern uint32_t fs_dirty_blocks;      /* blocks changed in memory, not yet on disk */
+extern uint32_t fs_bg_flushes;        /* statistics : commits done by the flusher */
+extern uint32_t ata_sectors_written; /* statistics : sectors written since boot */
+extern void    read_sectors_ATA_PIO(uint32_t target_address, uint32_t LBA, uint32_t sector_count,uint32_t slave_bit);
+extern void    write_sectors_ATA_PIO(uint32_t LBA, uint32_t sector_count, uint32_t target_address,uint32_t slave_bit);
+extern void    ata_read(uint32_t target_address, uint32_t LBA, uint32_t sector_count,uint32_t slave_bit);
+extern void    ata_write(uint32_t LBA, uint32_t sector_count, uint32_t target_address,uint32_t slave_bit);
+extern int32_t ata_dma_init();
+extern int32_t ata_start(blk_req_t* h);
+extern int32_t ata_service();
+extern void    ata_handler();
+extern void    ata_irq_init();
+extern uint32_t ata_use_dma;          /* 1 : ata_read/ata_write use bus-master DMA */
+extern void    ata_flush(uint32_t slave_bit);
+extern uint32_t FS_LBA_BASE;          /* first sector of the file system image on the slave drive */
+extern uint32_t ata_flushes;          /* statistics : cache flushes since boot */
+extern void    fetch_fs(uint32_t addr,uint32_t len,int32_t overwrite);
 extern void    read_fs_ata(int32_t slave_bit,uint32_t st,uint32_t ed);
 extern void    open_fs_ata(uint32_t st,uint32_t ed);
 #endif 
@@ -0,0 +1,242 @@
+/**
+ * @file bcache.c
+ * @brief Block cache in front of the ATA disk holding the file system (slave drive).
+ * Blocks are 4 KB, keyed by their first LBA, found through a hash table and
+ * evicted least recently used first. A miss right where the previous disk
+ * read stopped is a sequential stream : the read-ahead window starts at
+ * BCACHE_RA_MIN and doubles up to one full disk command, so streams are pulled
+ * in with large multi-sector transfers while random misses cost one block.
+ */
+#include "bcache.h"
+#include "ata.h"
+#include "kmalloc.h"
+#include "lib.h"
+
+#define BCACHE_NONE   0xFFFFFFFF
+#define BCACHE_DISK   1 /* slave drive */
+
+typedef struct bcache_buf {
+    uint32_t lba;       /* first sector of the block, BCACHE_NONE when empty */
+    int32_t  hnext;     /* hash chain, -1 terminates */
+    int32_t  prev;      /* LRU list, head is the most recently used */
+    int32_t  next;
+    uint32_t ra;        /* brought in by read-ahead and not used yet */
+    uint8_t* data;      /* the block, a page from buf_cache */
+} bcache_buf_t;
+
+static bcache_buf_t bufs[BCACHE_BLOCKS];
+static kmem_cache_t* buf_cache;  /* page-aligned block buffers */
+static uint8_t* staging;       /* one read-ahead command worth of blocks */
+static int32_t  hash[BCACHE_HASH];
+static int32_t  lru_head, lru_tail;
+static uint32_t seq_next;      /* lba right after the last disk read */
+static uint32_t ra_window;     /* blocks in the last disk read */
+
+bcache_stats_t bcache_stats;
+
+#define BUF_DATA(i)   (bufs[(i)].data)
+#define HASH(lba)     (((lba) / BCACHE_BLOCK_SECTORS) & (BCACHE_HASH - 1))
+
+/**
+ * @brief unlink a buffer from the LRU list
+ * @param i - buffer index
+ * @return ** void
+ */
+static void
+lru_unlink(int32_t i) {
+    if (bufs[i].prev != -1) bufs[bufs[i].prev].next = bufs[i].next;
+    else lru_head = bufs[i].next;
+    if (bufs[i].next != -1) bufs[bufs[i].next].prev = bufs[i].prev;
+    else lru_tail = bufs[i].prev;
+}
+
+/**
+ * @brief put a buffer at the head (most recently used end) of the LRU list
+ * @param i - buffer index
+ * @return ** void
+ */
+static void
+lru_push_head(int32_t i) {
+    bufs[i].prev = -1;
+    bufs[i].next = lru_head;
+    if (lru_head != -1) bufs[lru_head].prev = i;
+    lru_head = i;
+    if (lru_tail == -1) lru_tail = i;
+}
+
+/**
+ * @brief take a buffer out of its hash chain
+ * @param i - buffer index
+ * @return ** void
+ */
+static void
+hash_remove(int32_t i) {
+    int32_t* link;
+    if (bufs[i].lba == BCACHE_NONE) return;
+    for (link = &hash[HASH(bufs[i].lba)]; *link != -1; link = &bufs[*link].hnext) {
+        if (*link == i) {
+            *link = bufs[i].hnext;
+            break;
+        }
+    }
+    bufs[i].lba = BCACHE_NONE;
+}
+
+/**
+ * @brief find a cached block
+ * @param lba - first sector of the block
+ * @return ** int32_t buffer index, -1 if not cached
+ */
+static int32_t
+lookup(uint32_t lba) {
+    int32_t i;
+    for (i = hash[HASH(lba)]; i != -1; i = bufs[i].hnext) {
+        if (bufs[i].lba == lba) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief recycle the least recently used buffer for a new block and make it most recently used
+ * @param lba - first sector of the new block
+ * @return ** int32_t buffer index
+ */
+static int32_t
+evict(uint32_t lba) {
+    int32_t i = lru_tail;
+    hash_remove(i);
+    lru_unlink(i);
+    lru_push_head(i);
+    bufs[i].lba = lba;
+    bufs[i].ra = 0;
+    bufs[i].hnext = hash[HASH(lba)];
+    hash[HASH(lba)] = i;
+    return i;
+}
+
+/**
+ * @brief allocate the cache buffers, every buffer starts empty
+ * @return ** int32_t 0 on success
+ * -1 on no memory
+ */
+int32_t
+bcache_init(void) {
+    int32_t i;
+    if (buf_cache == NULL && NULL == (buf_cache = kmem_cache_create("bcache", BCACHE_BLOCK_SIZE, PGSIZE, NULL))) {
+        return -1;
+    }
+    for (i = 0; i < BCACHE_BLOCKS; i++) {
+        if (bufs[i].data == NULL && NULL == (bufs[i].data = kmem_cache_alloc(buf_cache))) return -1;
+    }
+    if (staging == NULL && NULL == (staging = kmalloc(BCACHE_RA_MAX * BCACHE_BLOCK_SIZE))) {
+        return -1;
+    }
+    for (i = 0; i < BCACHE_HASH; i++) hash[i] = -1;
+    lru_head = lru_tail = -1;
+    for (i = 0; i < BCACHE_BLOCKS; i++) {
+        bufs[i].lba = BCACHE_NONE;
+        bufs[i].hnext = -1;
+        bufs[i].ra = 0;
+        lru_push_head(i);
+    }
+    seq_next = BCACHE_NONE;
+    ra_window = 0;
+    memset(&bcache_stats, 0, sizeof(bcache_stats));
+    return 0;
+}
+
+/**
+ * @brief get a 4 KB block of the disk. On a miss the block and the blocks
+ * after it (read-ahead) come in with one multi-sector command.
+ * @param lba - first sector of the block
+ * @param ra_limit - read-ahead never reads at or past this sector
+ * @return ** uint8_t* cached block, valid until the next bcache call
+ * NULL if the cache is not initialized
+ */
+uint8_t*
+bcache_read(uint32_t lba, uint32_t ra_limit) {
+    int32_t i, k, n, ret = -1;
+    if (staging == NULL) return NULL;
+    if (-1 != (i = lookup(lba))) {
+        bcache_stats.hits++;
+        if (bufs[i].ra) {
+            bcache_stats.ra_hits++;
+            bufs[i].ra = 0;
+        }
+        lru_unlink(i);
+        lru_push_head(i);
+        return BUF_DATA(i);
+    }
+    bcache_stats.misses++;
+
+    /* a miss where the last read stopped continues a stream : double the window,
+     * a random miss reads only its block */
+    n = 1;
+    if (lba == seq_next) n = (ra_window * 2 < BCACHE_RA_MIN) ? BCACHE_RA_MIN : ra_window * 2;
+    if (n > BCACHE_RA_MAX) n = BCACHE_RA_MAX;
+    if (ra_limit < lba + n * BCACHE_BLOCK_SECTORS) {
+        n = (ra_limit > lba) ? (ra_limit - lba) / BCACHE_BLOCK_SECTORS : 0;
+        if (n < 1) n = 1;
+    }
+    /* stop before a block that is cached already */
+    for (k = 1; k < n; k++) {
+        if (-1 != lookup(lba + k * BCACHE_BLOCK_SECTORS)) break;
+    }
+    n = k;
+
+    ata_read((uint32_t) staging, lba, n * BCACHE_BLOCK_SECTORS, BCACHE_DISK);
+    bcache_stats.reads++;
+    bcache_stats.sectors += n * BCACHE_BLOCK_SECTORS;
+    bcache_stats.ra_blocks += n - 1;
+    seq_next = lba + n * BCACHE_BLOCK_SECTORS;
+    ra_window = n;
+
+    /* read-ahead blocks first, so the requested one ends up most recently used */
+    for (k = n - 1; k >= 0; k--) {
+        i = evict(lba + k * BCACHE_BLOCK_SECTORS);
+        memcpy(BUF_DATA(i), staging + k * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+        bufs[i].ra = (k != 0);
+        if (k == 0) ret = i;
+    }
+    return BUF_DATA(ret);
+}
+
+/**
+ * @brief drop cached blocks overlapping sectors [lba, lba+count), called on every disk write
+ * @param lba - first sector written
+ * @param count - number of sectors written
+ * @return ** void
+ */
+void
+bcache_invalidate(uint32_t lba, uint32_t count) {
+    int32_t i;
+    if (staging == NULL) return;
+    for (i = 0; i < BCACHE_BLOCKS; i++) {
+        if (bufs[i].lba != BCACHE_NONE && bufs[i].lba < lba + count
+            && bufs[i].lba + BCACHE_BLOCK_SECTORS > lba) {
+            hash_remove(i);
+            /* an empty buffer is the first one to reuse */
+            lru_unlink(i);
+            bufs[i].prev = lru_tail;
+            bufs[i].next = -1;
+            if (lru_tail != -1) bufs[lru_tail].next = i;
+            lru_tail = i;
+            if (lru_head == -1) lru_head = i;
+        }
+    }
+}
+
+/**
+ * @brief print hit/miss statistics
+ * @return ** void
+ */
+void
+bcache_print_stats(void) {
+    uint32_t total = bcache_stats.hits + bcache_stats.misses;
+    printf("bcache : %d hits, %d misses (%d%% hit), %d disk reads, %d sectors\n",
+           bcache_stats.hits, bcache_stats.misses,
+           total ? bcache_stats.hits * 100 / total : 0,
+           bcache_stats.reads, bcache_stats.sectors);
+    printf("bcache : %d blocks read ahead, %d of them used\n",
+           bcache_stats.ra_blocks, bcache_stats.ra_hits);
+}
@@ -0,0 +1,31 @@
+/* block cache in front of the ATA disk */
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include "types.h"
+
+#define BCACHE_BLOCK_SIZE    4096
+#define BCACHE_BLOCK_SECTORS (BCACHE_BLOCK_SIZE/512)
+#define BCACHE_BLOCKS        64   /* 256 KB of cached disk */
+#define BCACHE_HASH          128  /* buckets, power of 2 */
+#define BCACHE_RA_MIN        2    /* blocks read when a sequential stream is detected */
+#define BCACHE_RA_MAX        32   /* most blocks one disk command can carry (256 sectors) */
+
+/* hit/miss statistics, since boot */
+typedef struct bcache_stats {
+    uint32_t hits;      /* block found in cache */
+    uint32_t misses;    /* block had to come from disk */
+    uint32_t ra_blocks; /* blocks brought in ahead of a request */
+    uint32_t ra_hits;   /* read-ahead blocks that were used later */
+    uint32_t reads;     /* disk read commands issued */
+    uint32_t sectors;   /* sectors read from disk */
+} bcache_stats_t;
+
+extern bcache_stats_t bcache_stats;
+
+extern int32_t  bcache_init(void);
+extern uint8_t* bcache_read(uint32_t lba, uint32_t ra_limit);
+extern void     bcache_invalidate(uint32_t lba, uint32_t count);
+extern void     bcache_print_stats(void);
+
+#endif
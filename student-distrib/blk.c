@@ -0,0 +1,260 @@
+/**
+ * @file blk.c
+ * @brief Block request queue. Submitters enqueue reads/writes and return,
+ * the queue is kept sorted by LBA and served like an elevator going up
+ * (C-LOOK), a request touching the end or start of a waiting one of the same
+ * kind is merged into its command, and the disk interrupt completes commands
+ * and starts the next one. A process waiting with interrupts on sleeps until
+ * its request is done; before interrupts are up (boot, mount) the waiter
+ * polls the drive instead.
+ */
+#include "blk.h"
+#include "ata.h"
+#include "lib.h"
+#include "pit.h"
+#include "process.h"
+
+#define EFLAGS_IF      0x200
+#define BLK_RW_BATCH   8     /* pieces blk_rw keeps on its stack */
+
+blk_stats_t blk_stats;
+
+static blk_req_t* queue;     /* waiting commands, sorted by LBA */
+static blk_req_t* inflight;  /* command the drive is working on */
+static uint32_t head_pos;    /* LBA after the last command started */
+static uint32_t irq_on;      /* disk interrupt installed, waiters may sleep */
+static uint32_t tsc_khz;
+
+/**
+ * @brief start the next command if the drive is idle : the first one at or
+ * above the head position, or the lowest one when the sweep is over
+ * Called with interrupts off.
+ * @return ** void
+ */
+static void
+blk_kick(void) {
+    blk_req_t** pick;
+    if (inflight != NULL || queue == NULL) return;
+    for (pick = &queue; *pick != NULL && (*pick)->lba < head_pos; pick = &(*pick)->next);
+    if (*pick == NULL) pick = &queue;
+    inflight = *pick;
+    *pick = inflight->next;
+    inflight->next = NULL;
+    head_pos = inflight->lba + inflight->span;
+    blk_stats.commands++;
+    ata_start(inflight);
+}
+
+/**
+ * @brief hand the result of the in-flight command to every request in it,
+ * wake the sleepers and start the next command. Called with interrupts off.
+ * @param status - BLK_DONE or BLK_ERR
+ * @return ** void
+ */
+static void
+blk_complete(int32_t status) {
+    blk_req_t *r = inflight, *nx;
+    uint32_t pid, us;
+    inflight = NULL;
+    for (; r != NULL; r = nx) {
+        /* the submitter may reuse r once status is set : read it first */
+        nx = r->chain;
+        pid = r->pid;
+        if (tsc_khz >= 1000) {
+            us = (rdtsc() - r->t_submit) / (tsc_khz / 1000);
+            blk_stats.lat_us_total += us;
+            if (us > blk_stats.lat_us_max) blk_stats.lat_us_max = us;
+        }
+        blk_stats.completed++;
+        blk_stats.depth--;
+        if (status == BLK_ERR) blk_stats.errors++;
+        r->status = status;
+        if (pid && PCB(pid)->state == SLEEPING) PCB(pid)->state = RUNNABLE;
+    }
+    blk_kick();
+}
+
+/**
+ * @brief merge r into the waiting command q when they are the same kind and
+ * touch, as long as the command stays within what the drive takes (ata_max_sectors)
+ * @param pp - link holding q, updated when r becomes the new head
+ * @param r - new request
+ * @return ** int32_t 1 if merged, 0 otherwise
+ */
+static int32_t
+blk_merge(blk_req_t** pp, blk_req_t* r) {
+    blk_req_t *q = *pp, *t;
+    if (q->write != r->write || q->slave != r->slave || q->span + r->count > ata_max_sectors(q->slave)) return 0;
+    if (q->lba + q->span == r->lba) {
+        for (t = q; t->chain != NULL; t = t->chain);
+        t->chain = r;
+        q->span += r->count;
+        return 1;
+    }
+    if (r->lba + r->count == q->lba) {
+        r->chain = q;
+        r->span = r->count + q->span;
+        r->next = q->next;
+        q->next = NULL;
+        *pp = r;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief install the disk interrupt : from now on waiters with interrupts on sleep
+ * @return ** void
+ */
+void
+blk_init(void) {
+    tsc_khz = pit_tsc_khz();
+    ata_irq_init();
+    irq_on = 1;
+}
+
+/**
+ * @brief queue a request and return, the drive starts it when it is free
+ * @param r - request with lba, count, addr, write, slave filled in
+ * @return ** void
+ */
+void
+blk_submit(blk_req_t* r) {
+    blk_req_t** pp;
+    uint32_t flags;
+    r->status = BLK_PENDING;
+    r->pid = 0;
+    r->span = r->count;
+    r->next = r->chain = NULL;
+    r->t_submit = rdtsc();
+    cli_and_save(flags);
+    blk_stats.submitted++;
+    if (++blk_stats.depth > blk_stats.max_depth) blk_stats.max_depth = blk_stats.depth;
+    for (pp = &queue; *pp != NULL; pp = &(*pp)->next) {
+        if (blk_merge(pp, r)) {
+            blk_stats.merged++;
+            blk_kick();
+            restore_flags(flags);
+            return;
+        }
+        if ((*pp)->lba > r->lba) break;
+    }
+    r->next = *pp;
+    *pp = r;
+    blk_kick();
+    restore_flags(flags);
+}
+
+/**
+ * @brief wait for a request. A process running with interrupts on sleeps and
+ * the disk interrupt wakes it; otherwise the drive is polled.
+ * @param r - submitted request
+ * @return ** int32_t 0 on success
+ * -1 on disk error
+ */
+int32_t
+blk_wait(blk_req_t* r) {
+    uint32_t flags, eflags, pid = get_pid();
+    asm volatile ("pushfl; popl %0" : "=r" (eflags));
+    if (irq_on && (eflags & EFLAGS_IF) && pid != 0) {
+        cli_and_save(flags);
+        while (r->status == BLK_PENDING) {
+            r->pid = pid;
+            PCB(pid)->state = SLEEPING;
+            blk_stats.sleeps++;
+            /* sti takes effect after hlt is reached : the wake-up can't slip in between */
+            asm volatile ("sti; hlt; cli" : : : "memory");
+        }
+        r->pid = 0;
+        PCB(pid)->state = RUNNING;
+        restore_flags(flags);
+    } else {
+        while (r->status == BLK_PENDING) {
+            cli_and_save(flags);
+            blk_interrupt();
+            restore_flags(flags);
+        }
+    }
+    return r->status == BLK_DONE ? 0 : -1;
+}
+
+/**
+ * @brief synchronous read/write of any length : pieces of one command each
+ * (ata_max_sectors) are queued together, then waited for
+ * @param write - 0 : disk to memory, 1 : memory to disk
+ * @param addr - memory buffer
+ * @param lba - first sector
+ * @param count - number of sectors
+ * @param slave - 0 : master drive, 1 : slave drive
+ * @return ** int32_t 0 on success
+ * -1 if any piece failed
+ */
+int32_t
+blk_rw(uint32_t write, uint32_t addr, uint32_t lba, uint32_t count, uint32_t slave) {
+    blk_req_t req[BLK_RW_BATCH];
+    uint32_t i, n, max = ata_max_sectors(slave);
+    int32_t ret = 0;
+    while (count) {
+        for (n = 0; n < BLK_RW_BATCH && count; n++) {
+            req[n].lba = lba;
+            req[n].count = count > max ? max : count;
+            req[n].addr = addr;
+            req[n].write = write;
+            req[n].slave = slave;
+            blk_submit(&req[n]);
+            lba += req[n].count;
+            addr += req[n].count * 512;
+            count -= req[n].count;
+        }
+        for (i = 0; i < n; i++) {
+            if (blk_wait(&req[i])) ret = -1;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief wait until every queued command has completed, e.g. before a cache flush
+ * @return ** void
+ */
+void
+blk_drain(void) {
+    uint32_t flags, eflags;
+    asm volatile ("pushfl; popl %0" : "=r" (eflags));
+    while (inflight != NULL || queue != NULL) {
+        cli_and_save(flags);
+        if (!irq_on || !(eflags & EFLAGS_IF)) {
+            blk_interrupt();
+            restore_flags(flags);
+            continue;
+        }
+        if (inflight != NULL || queue != NULL) asm volatile ("sti; hlt; cli" : : : "memory");
+        restore_flags(flags);
+    }
+}
+
+/**
+ * @brief advance the in-flight command, from the disk interrupt or a polling
+ * waiter. Called with interrupts off.
+ * @return ** void
+ */
+void
+blk_interrupt(void) {
+    int32_t status;
+    if (inflight == NULL) return;
+    if (BLK_PENDING == (status = ata_service())) return;
+    blk_complete(status);
+}
+
+/**
+ * @brief print queue counters
+ * @return ** void
+ */
+void
+blk_print_stats(void) {
+    printf("blk : %d requests, %d merged, %d commands, %d errors, %d sleeps\n",
+           blk_stats.submitted, blk_stats.merged, blk_stats.commands, blk_stats.errors, blk_stats.sleeps);
+    printf("blk : depth %d (max %d), latency avg %d us max %d us\n",
+           blk_stats.depth, blk_stats.max_depth,
+           blk_stats.completed ? blk_stats.lat_us_total / blk_stats.completed : 0, blk_stats.lat_us_max);
+}
@@ -0,0 +1,52 @@
+/* block request queue between the file system and the disk driver */
+#ifndef _BLK_H
+#define _BLK_H
+
+#include "types.h"
+
+#define BLK_PENDING      0
+#define BLK_DONE         1
+#define BLK_ERR          (-1)
+
+#define BLK_BATCH        64   /* requests one caller keeps in flight */
+
+/* one read or write of contiguous sectors, owned by the submitter until it completes */
+typedef struct blk_req {
+    uint32_t lba;
+    uint32_t count;                 /* sectors */
+    uint32_t addr;                  /* memory buffer */
+    uint8_t  write;                 /* 1 : memory to disk */
+    uint8_t  slave;                 /* 1 : slave drive */
+    volatile int32_t status;        /* BLK_PENDING, BLK_DONE or BLK_ERR */
+    uint32_t pid;                   /* process sleeping on the request, 0 : none */
+    uint32_t t_submit;              /* rdtsc at submit, for latency */
+    uint32_t span;                  /* head of a command : sectors of the whole chain */
+    struct blk_req* next;           /* elevator queue, command heads only */
+    struct blk_req* chain;          /* requests merged behind this one, in LBA order */
+} blk_req_t;
+
+/* counters, since boot */
+typedef struct blk_stats {
+    uint32_t submitted;     /* requests */
+    uint32_t merged;        /* requests that rode along in another command */
+    uint32_t commands;      /* commands sent to the drive */
+    uint32_t completed;
+    uint32_t errors;
+    uint32_t depth;         /* requests queued or in flight now */
+    uint32_t max_depth;
+    uint32_t sleeps;        /* times a submitter slept instead of spinning */
+    uint32_t lat_us_total;  /* submit to completion, summed over requests */
+    uint32_t lat_us_max;
+} blk_stats_t;
+
+extern blk_stats_t blk_stats;
+
+extern void    blk_init(void);
+extern void    blk_submit(blk_req_t* r);
+extern int32_t blk_wait(blk_req_t* r);
+extern int32_t blk_rw(uint32_t write, uint32_t addr, uint32_t lba, uint32_t count, uint32_t slave);
+extern void    blk_drain(void);
+extern void    blk_interrupt(void);
+extern void    blk_print_stats(void);
+
+#endif
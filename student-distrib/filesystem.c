@@ -20,6 +20,8 @@
 #include "lib.h"
 #include "tests.h"
 #include "ata.h"
+#include "kmalloc.h"
+#include "pcache.h"
 static int32_t open_fs(uint32_t addr);
 static int32_t close_fs();
 
@@ -32,6 +34,7 @@ fs_t fs = {
 static int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 static int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 static int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
+static int32_t data_addr(uint32_t inode, uint32_t offset, uint32_t length);
 static int32_t create_file(const uint8_t* fname,int32_t nbytes);
 static int32_t write_data(uint32_t inode, uint32_t offset,const uint8_t* buf, uint32_t length);
 static int32_t remove_file(const uint8_t* fname,int32_t nbytes);
@@ -43,6 +46,7 @@ static int32_t file_open(file_t* ret, const uint8_t* fname, int32_t findex);
 static int32_t directory_open(file_t* ret, const uint8_t* fname, int32_t findex);
 static int32_t file_read(file_t* file, void* buf, int32_t nbytes);
 static int32_t directory_read(file_t* file, void* buf, int32_t nbytes);
+static int32_t directory_getdents(file_t* file, dirent_t* buf, int32_t nbytes);
 static int32_t file_write(file_t* file, const void* buf, int32_t nbytes);
 static int32_t directory_write(file_t* file, const void* buf, int32_t nbytes);
 static int32_t file_close(file_t* file);
@@ -50,10 +54,27 @@ static int32_t directory_close(file_t* file);
 /* program loader function set */
 static int32_t load_prog(const uint8_t* prog_name, uint32_t addr, uint32_t nbytes);
 static int32_t check_exec(const uint8_t* prog_name);
+static int32_t stat_inode(uint32_t inode, uint32_t type, stat_t* st);
+static int32_t file_is_exec(uint32_t inode);
 /* scan filesytem function set */
 static int32_t mark_dblock(uint32_t inode);
 static int32_t mark_after_fname(uint32_t dentry_addr,dentry_t* dentry);
 static int32_t mark_inode_and_dblock();
+static inline uint32_t dblock_count(uint32_t length);
+/* inode block mapping function set : flat and extent inodes */
+static inline int32_t inode_is_ext(uint32_t inode_addr);
+static int32_t inode_map(uint32_t inode_addr,uint32_t blk,uint32_t max,uint32_t* run);
+static int32_t inode_append(uint32_t inode_addr,uint32_t blk,uint32_t dnum);
+/* allocation bitmap function set */
+static int32_t alloc_maps();
+static void    map_init(uint32_t* map,uint32_t nbits);
+static int32_t map_find_zero(const uint32_t* map,uint32_t nbits,uint32_t start);
+static uint32_t map_count_zero(const uint32_t* map,uint32_t nbits,uint32_t max);
+/* filename hash index function set */
+static void    dentry_hash_build();
+static void    dentry_hash_insert(uint32_t index);
+static void    dentry_hash_remove(uint32_t index);
+static int32_t dentry_hash_lookup(const uint8_t* fname);
 
 /* file create remove operation */
 static int32_t create_file(const uint8_t* fname,int32_t nbytes);
@@ -61,6 +82,10 @@ static int32_t create_file(const uint8_t* fname,int32_t nbytes);
 
 
 
+/* filename -> dentry index table, chained through dentry_next, -1 terminates */
+static int32_t dentry_hash[DENTRY_HASH_SIZE];
+static int32_t dentry_next[MAX_DENTRY];
+
 /* shortcut for calculating address */
 
 inline uint32_t INODE_ADDR(uint32_t inode){
@@ -73,6 +98,7 @@ inline uint32_t DENTRY_ADDR(uint32_t index){
 
 inline void WRITE_FNUM(uint32_t num){
     *((uint32_t*)fs.sys_st_addr)=num;
+    mark_dirty_fs(fs.sys_st_addr,4);
 }
 /**
  * @brief read 4 Bytes from memory
@@ -119,6 +145,7 @@ open_fs(uint32_t addr) {
     open_fs_ata(_addr->mod_start,_addr->mod_end);
     #ifdef DISK_PREPARED
     read_fs_ata(1,_addr->mod_start,_addr->mod_end);
+    replay_journal_ata(); /* finish a metadata transaction cut short by a crash */
     #endif
 
     /* extended functionality : program loader */
@@ -132,6 +159,7 @@ open_fs(uint32_t addr) {
     fs.f_rw.create_file=create_file;
     fs.f_rw.remove_file=remove_file;
     fs.f_rw.rename_file=rename_file;
+    fs.f_rw.data_addr=data_addr;
 
     fs.openr = openr; /* open file/directory as read-oonly*/
     fs.check_exec = check_exec; /* check if file is exec */ 
@@ -145,6 +173,8 @@ open_fs(uint32_t addr) {
     fs.d_ioctl.open = directory_open;
     fs.d_ioctl.close = directory_close;
     fs.d_ioctl.read = directory_read;
+    fs.getdents = directory_getdents;
+    fs.stat = stat_inode;
     fs.d_ioctl.write = directory_write;
 
     // initialize all shared variables
@@ -168,26 +198,36 @@ open_fs(uint32_t addr) {
     fs.filename_size = 32;
 
 
+    if((1+fs.iblock_num+fs.dblock_num)>(fs.sys_ed_addr-fs.sys_st_addr)/fs.block_size){
+        printf("boot block claims more blocks than the image holds\n");
+        return -1;
+    }
     /* start initializing iblock, datablock map */
-    for(i=0;i<fs.iblock_num;i++) fs.imap[i]=0;
-    for(i=0;i<fs.dblock_num;i++) fs.dmap[i]=0;
+    if(-1==alloc_maps()){
+        printf("no memory for inode/dblock map\n");
+        return -1;
+    }
+    map_init(fs.imap,fs.iblock_num);
+    map_init(fs.dmap,fs.dblock_num);
+    memset(fs.flength,0,fs.iblock_num*sizeof(uint32_t));
+    memset(fs.fexec,FEXEC_UNKNOWN,fs.iblock_num);
+    memset(fs.fmapped,0,fs.iblock_num*sizeof(uint16_t));
+    fs.inode_hint=fs.dblock_hint=0;
     if(-1==mark_inode_and_dblock()){
         printf("file system boot failed\n");
         return -1;
     }
+    dentry_hash_build();
     
     #ifdef RUN_TESTS
     for(i=0;i<fs.iblock_num;i++){
-        if(fs.imap[i]){
+        if(MAP_TEST(fs.imap,i)){
             printf("inode %d is filled with %d length of file ",i,fs.flength[i]);
         }
     }
 
     for(i=0;i<fs.dblock_num;i++){
-        if(fs.dmap[i]){
-            printf("dblock %d is used \n",i);
-            filled_rate+=100;
-        }
+        if(MAP_TEST(fs.dmap,i)) filled_rate+=100;
     }
     printf("file system dblock is filled with rate %d%%\n",filled_rate/fs.dblock_num);
     #endif
@@ -299,7 +339,7 @@ file_read(file_t* file, void* buf, int32_t nbytes) {
  */
 static int32_t
 directory_read(file_t* file, void* buf, int32_t nbytes) {
-    int32_t ret, i;
+    int32_t ret, i, len;
     if (file == NULL || buf == NULL)
         return -1;
     if (fs_sanity_check(file->inode, fs.sys_st_addr))
@@ -311,14 +351,45 @@ directory_read(file_t* file, void* buf, int32_t nbytes) {
     if (ret == -1)
         return 0;
     file->pos++; /* each time advance one file */
-    if (nbytes > strlen((int8_t*) dentry.filename))
-        nbytes = strlen((int8_t*) dentry.filename);
+    len = strlen((int8_t*) dentry.filename);
+    if (nbytes > len)
+        nbytes = len;
     for (i = 0; i < nbytes; i++)
         ((uint8_t*) buf)[i] = dentry.filename[i];
     ((uint8_t*) buf)[nbytes] = '\0'; /* terminate with NUL */
     return nbytes;
 }
 
+/**
+ * @brief Read as many directory entries as fit in buf, from the position on,
+ * in one call instead of one read per name
+ * @param file - directory file struct, its position moves past the entries read
+ * @param buf - entries go here
+ * @param nbytes - size of buf
+ * @return ** int32_t bytes filled, a multiple of sizeof(dirent_t), 0 at the end
+ * -1 on failure
+ */
+static int32_t
+directory_getdents(file_t* file, dirent_t* buf, int32_t nbytes) {
+    int32_t n;
+    dentry_t dentry;
+    if (file == NULL || buf == NULL)
+        return -1;
+    if (fs_sanity_check(file->inode, fs.sys_st_addr))
+        return -1;
+    for (n = 0; (n + 1) * (int32_t) sizeof(dirent_t) <= nbytes; n++) {
+        if (-1 == fs.f_rw.read_dentry_by_index(file->pos, &dentry))
+            break;
+        file->pos++;
+        buf[n].inode = dentry.inode_num;
+        buf[n].type = dentry.filetype;
+        buf[n].size = (dentry.filetype == DESCRIPTOR_ENTRY_FILE) ? fs.flength[dentry.inode_num] : 0;
+        memcpy(buf[n].name, dentry.filename, sizeof(buf[n].name));
+        buf[n].name[sizeof(buf[n].name) - 1] = '\0';
+    }
+    return n * sizeof(dirent_t);
+}
+
 /**
  * @brief write to a file with buf of length nbytes
  * @param file - file to write
@@ -336,11 +407,15 @@ file_write(file_t* file, const void* buf, int32_t nbytes) {
         return -1;
     if (nbytes <= 0)
         return 0;
+    fs_busy++; /* write runs with interrupts on : keep the flusher out */
     ret = fs.f_rw.write_data(file->inode, file->pos, (uint8_t*) buf, nbytes);
-    if (ret == -1)
+    if (ret == -1) {
+        fs_busy--;
         return -1;
+    }
     file->pos += ret; /* update file offset */
     dump_fs();
+    fs_busy--;
     return ret;
 }
 /**
@@ -422,37 +497,35 @@ close_fs() {
 
 /**
  * @brief Read from buffer with maximum length length.
- * This function operates on each data block.
+ * This function operates on a run of physically contiguous data blocks.
  * @param offset - pointer to offset
- * @param dnum - data block number, specifying which data block this function reads
+ * @param dnum - data block number, specifying the first data block this function reads
+ * @param run - number of contiguous data blocks starting at dnum
  * @param buf - read result will go to buf
- * @param length - maximum length can be read from this data block
+ * @param length - maximum length can be read from this run
  * @param buf_ptr - pointer pointing at bottom of buf
  * @return ** int32_t - number of bytes read
  * <=0 when failed
  */
 static int32_t
-read_from_block(uint32_t* offset, uint32_t dnum, uint8_t* buf, uint32_t length, uint32_t* buf_ptr) {
+read_from_block(uint32_t* offset, uint32_t dnum, uint32_t run, uint8_t* buf, uint32_t length, uint32_t* buf_ptr) {
     /* data block starting addres : starting address + (number of blocks before this dblock)*block_size */
     /* number of blocks before dblock : dblock_index + 1 (bootblock) + number of iblocks (N) */
     if (offset == NULL || buf == NULL || buf_ptr == NULL)
         return -1;
     uint32_t data_block_addr = fs.sys_st_addr + (1 + fs.iblock_num + dnum) * fs.block_size;
     
-    length = length > (fs.block_size-(*offset)) ? 
-    (fs.block_size-(*offset)) : length; /* length = min (length, block_size) */
+    length = length > (run * fs.block_size - (*offset)) ? 
+    (run * fs.block_size - (*offset)) : length; /* length = min (length, run size) */
 
     data_block_addr += (*offset);
     *offset = 0;
-    // if (fs_sanity_check(0, data_block_addr))
-    //     return -1;
-    uint32_t i;
-
-    for (i = 0; i < length; i++) {
-        if (fs_sanity_check(0, data_block_addr + i))
-            return -1;
-        buf[(*buf_ptr)++] = read_1B(data_block_addr + i);
-    }
+    /* the span never leaves the run : checking both ends covers every byte */
+    if (fs_sanity_check(0, data_block_addr) || fs_sanity_check(0, data_block_addr + length - 1))
+        return -1;
+    fetch_fs(data_block_addr, length, 0); /* data blocks are loaded from disk on first use */
+    memcpy(buf + *buf_ptr, (void*) data_block_addr, length);
+    *buf_ptr += length;
     return length;
 }
 
@@ -475,10 +548,10 @@ read_from_block(uint32_t* offset, uint32_t dnum, uint8_t* buf, uint32_t length,
  */
 static int32_t
 read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
-    uint32_t data_block_num, buf_ptr = 0, ret;
-    uint32_t inode_addr, file_length, data_block_offset, data_block_entry_addr;
-    int32_t read_length,max_read_length;
-    if (buf == NULL|| 0 == fs.imap[inode])
+    uint32_t buf_ptr = 0, ret, run;
+    uint32_t inode_addr, file_length, data_block_offset;
+    int32_t data_block_num, read_length, max_read_length;
+    if (buf == NULL || inode >= fs.iblock_num || 0 == MAP_TEST(fs.imap, inode))
         return -1;
     if (fs_sanity_check(inode, fs.sys_st_addr))
         return -1; /* inode out of bound */
@@ -502,30 +575,59 @@ read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
     data_block_offset = offset / fs.block_size;
     offset %= fs.block_size; /* discard offset that fully occupies previous blocks*/
 
-    /* calculate first data block address */
-    data_block_entry_addr = inode_addr +
-        fs.dblock_entry_offset +
-        data_block_offset * fs.dblock_entry_size;
-    if (fs_sanity_check(0, data_block_entry_addr))
-        return -1;
-
     /* !This always assume length in inode is accurate! */
     length = (max_read_length) > length ? length : (max_read_length); /* Actual reading length */
     ret = length;                                         /* set return value to this length */
     while (length > 0) {
-        data_block_num = read_4B(data_block_entry_addr);
+        /* largest run of contiguous blocks covering what is left to read */
+        data_block_num = inode_map(inode_addr, data_block_offset,
+                                   (offset + length - 1) / fs.block_size + 1, &run);
+        if (data_block_num == -1)
+            return -1;
         read_length = read_from_block(&offset,
                                       data_block_num,
+                                      run,
                                       buf,
                                       length,
-                                      &buf_ptr); /* read from data block, update buf using buf_ptr */
+                                      &buf_ptr); /* read from data blocks, update buf using buf_ptr */
         if (read_length <= 0)
             return -1;
-        length -= read_length;                                  /* the length left to read */
-        data_block_entry_addr += fs.dblock_entry_size; /* move to next data block */
+        length -= read_length;                         /* the length left to read */
+        data_block_offset += run;                      /* move to next run */
     }
     return ret;
 }
+
+/**
+ * @brief Address in memory of bytes offset..offset+length-1 of a file, loaded
+ * from disk if they are not there yet, when they sit in one run of contiguous
+ * data blocks. The span may reach past the file length up to the end of its
+ * last block. Used to hand file data over without a copy (mmap, sendfile).
+ * @param inode - number of inode
+ * @param offset - first byte in the file
+ * @param length - number of bytes, > 0
+ * @return ** int32_t address of the first byte
+ * -1 on bad inode, a span past the blocks of the file, or a span over two runs
+ */
+static int32_t
+data_addr(uint32_t inode, uint32_t offset, uint32_t length) {
+    uint32_t inode_addr, run, blk, nblk, addr;
+    int32_t dnum;
+    if (length == 0 || inode >= fs.iblock_num || 0 == MAP_TEST(fs.imap, inode))
+        return -1;
+    inode_addr = (uint32_t) fs.sys_st_addr + (inode + 1) * fs.block_size;
+    blk = offset / fs.block_size;
+    nblk = (offset % fs.block_size + length - 1) / fs.block_size + 1;
+    if (fs_sanity_check(0, inode_addr) || blk + nblk > dblock_count(read_4B(inode_addr)))
+        return -1;
+    if (-1 == (dnum = inode_map(inode_addr, blk, nblk, &run)) || run < nblk)
+        return -1;
+    addr = fs.sys_st_addr + (1 + fs.iblock_num + dnum) * fs.block_size + offset % fs.block_size;
+    if (fs_sanity_check(0, addr) || fs_sanity_check(0, addr + length - 1))
+        return -1;
+    fetch_fs(addr, length, 0);
+    return addr;
+}
 /**
  * @brief After reading filename into dentry, this function fills the rest of dentry fields
  * Internally used
@@ -550,7 +652,7 @@ read_after_fname(uint32_t dentry_addr, dentry_t* dentry) {
     dentry->inode_num = read_4B(dentry_addr);
 
     /* bad inode # */
-    if(dentry->inode_num>=fs.iblock_num||0==fs.imap[dentry->inode_num]) return -1;
+    if(dentry->inode_num>=fs.iblock_num||0==MAP_TEST(fs.imap,dentry->inode_num)) return -1;
 
     dentry_addr += 4;
     for (i = 0; i < 6; i++) {
@@ -574,22 +676,14 @@ read_dentry_by_index(uint32_t index, dentry_t* dentry) {
     if (dentry == NULL || index >= fs.iblock_num ) {
         return -1;
     }
-    uint32_t dentry_addr = fs.sys_st_addr + fs.boot_block_padding + index * fs.dentry_size;
-    if (fs_sanity_check(0, dentry_addr))
+    uint32_t dentry_addr = DENTRY_ADDR(index);
+    if (fs_sanity_check(0, dentry_addr) || fs_sanity_check(0, dentry_addr + fs.dentry_size - 1))
         return -1;
-    uint32_t i, check_EOS = 0;
-    /* duplicate filename */
-    for (i = 0; i < fs.filename_size; i++) {
-        if (fs_sanity_check(0, dentry_addr + i))
-            return -1;
-        dentry->filename[i] = read_1B(dentry_addr + i);
-        if (dentry->filename[i] == '\0'){
-            if(i==0) return -1; /* no file name */
-            check_EOS = 1;
-        }
-    }
-    if (!check_EOS)
-        dentry->filename[fs.filename_size] = '\0'; /* no zero padding, add at the end */
+    /* duplicate filename : whole name checked once above */
+    memcpy(dentry->filename, (void*) dentry_addr, fs.filename_size);
+    if (dentry->filename[0] == '\0')
+        return -1; /* no file name */
+    dentry->filename[fs.filename_size] = '\0'; /* no zero padding, add at the end */
     return read_after_fname(dentry_addr, dentry);
 }
 
@@ -610,34 +704,10 @@ read_dentry_by_name(const uint8_t* fname, dentry_t* dentry) {
     if (strlen((int8_t*) fname) > fs.filename_size) {
         return -1;
     }
-    uint32_t dentry_addr = fs.sys_st_addr + fs.boot_block_padding;
-    if (fs_sanity_check(0, dentry_addr))
+    int32_t dentry_index = dentry_hash_lookup(fname);
+    if (dentry_index == -1)
         return -1;
-    uint32_t i, dentry_index;
-    uint32_t check_EOS;
-    /* search in whole file system */
-    for (dentry_index = 0; dentry_index < fs.iblock_num; dentry_index++) {
-        if (fs_sanity_check(0, dentry_addr))
-            return -1;
-        check_EOS = 0;
-        /* search through 32 bytes */
-        for (i = 0; i < fs.filename_size; i++) {
-            if (fs_sanity_check(0, dentry_addr + i))
-                return -1;
-            dentry->filename[i] = read_1B(dentry_addr + i);
-            if (dentry->filename[i] == '\0')
-                check_EOS = 1;
-        }
-        /* if without EOS add one NUL character */
-        if (!check_EOS)
-            dentry->filename[fs.filename_size] = '\0'; /* no zero padding, add at the end */
-        if (strncmp((int8_t*) fname, (int8_t*) dentry->filename, strlen((int8_t*) fname) + 1) == 0) {
-            /* strlen((int8_t*)fname)+1 : both string ends at the same time */
-            return read_after_fname(dentry_addr, dentry);
-        }
-        dentry_addr += fs.dentry_size;
-    }
-    return -1;
+    return read_dentry_by_index(dentry_index, dentry);
 }
 
 /**
@@ -648,8 +718,8 @@ read_dentry_by_name(const uint8_t* fname, dentry_t* dentry) {
  *      Read Failure
  * 
  * Internal implementation note: 
- *      Copy 4KB at a time, because this is how inside copy works, 
- *      so no overhead will be generated in this way.
+ *      One read of the whole file, read_data copies each contiguous
+ *      run of data blocks at once.
  * @param prog_name - program name to read
  * @param addr  - virtual memory address you want to copy to
  * @param nbytes - number of bytes you want to copy to
@@ -658,27 +728,16 @@ read_dentry_by_name(const uint8_t* fname, dentry_t* dentry) {
  */
 static int32_t
 load_prog(const uint8_t* prog_name, uint32_t addr, uint32_t nbytes) {
-    uint32_t read_block_size = (4 << 10); /* each time, try 4KB blocks, no time overhead */
     dentry_t dentry;
     if (read_dentry_by_name(prog_name, &dentry) == -1) {
         return -1;
     }
-    int32_t ret = 0, offset = 0, bytes_read;
-    /* read the whole executable */
-    while (1) {
-        bytes_read = fs.f_rw.read_data(dentry.inode_num, offset, (uint8_t*) addr, read_block_size);
-        if (bytes_read == -1) return -1;
-        if (bytes_read == 0) return bytes_read;
-        /* read next data block */
-        addr += bytes_read;
-        ret += bytes_read;
-        offset += bytes_read;
-        if (ret > nbytes) {
-            printf("executable too large\n");
-            return -1;
-        }
+    if (fs.flength[dentry.inode_num] > nbytes) {
+        printf("executable too large\n");
+        return -1;
     }
-    return ret;
+    /* read the whole executable */
+    return fs.f_rw.read_data(dentry.inode_num, 0, (uint8_t*) addr, fs.flength[dentry.inode_num]);
 }
 
 /**
@@ -694,15 +753,55 @@ load_prog(const uint8_t* prog_name, uint32_t addr, uint32_t nbytes) {
 static int32_t
 check_exec(const uint8_t* prog_name){
     dentry_t dentry;
+    stat_t st;
     if(-1==fs.f_rw.read_dentry_by_name(prog_name,&dentry)){
         return -1;
     }
-    uint8_t buf[5];
-    if(-1==fs.f_rw.read_data(dentry.inode_num,0,buf,4)){
+    if(-1==stat_inode(dentry.inode_num,dentry.filetype,&st)){
+        return 0;
+    }
+    return st.exec;
+}
+
+/**
+ * @brief whether a file starts with the ELF magic. The answer is cached in
+ * fs.fexec, so only the first check after a write reads the file.
+ * @param inode - number of inode, a regular file
+ * @return ** int32_t 1 : executable, 0 : not
+ */
+static int32_t
+file_is_exec(uint32_t inode){
+    uint8_t buf[4];
+    if(fs.fexec[inode]==FEXEC_UNKNOWN){
+        fs.fexec[inode]=(4==fs.f_rw.read_data(inode,0,buf,4)
+            &&(buf[0]==0x7f)&&(buf[1]==0x45)&&(buf[2]==0x4c)&&(buf[3]==0x46))?FEXEC_YES:FEXEC_NO;
+    }
+    return fs.fexec[inode]==FEXEC_YES;
+}
+
+/**
+ * @brief metadata of a directory entry, from the cached lengths : nothing is
+ * read but the first 4 bytes of a file the first time (see file_is_exec)
+ * @param inode - number of inode, ignored unless type is DESCRIPTOR_ENTRY_FILE
+ * @param type - type of the entry
+ * @param st - result
+ * @return ** int32_t 0 on success
+ * -1 on bad inode
+ */
+static int32_t
+stat_inode(uint32_t inode, uint32_t type, stat_t* st){
+    if(st==NULL) return -1;
+    st->type=type;
+    if(type!=DESCRIPTOR_ENTRY_FILE){
+        st->inode=st->size=st->blocks=st->exec=0;
         return 0;
-    }else{
-        return (buf[0]==0x7f)&&(buf[1]==0x45)&&(buf[2]==0x4c)&&(buf[3]==0x46);
     }
+    if(inode>=fs.iblock_num||0==MAP_TEST(fs.imap,inode)) return -1;
+    st->inode=inode;
+    st->size=fs.flength[inode];
+    st->blocks=dblock_count(st->size);
+    st->exec=file_is_exec(inode);
+    return 0;
 }
 
 
@@ -715,30 +814,30 @@ check_exec(const uint8_t* prog_name){
  */
 static int32_t
 mark_dblock(uint32_t inode){
-    uint32_t i;
+    uint32_t i, blk, run, owned;
+    int32_t dblock_ind;
     uint32_t inode_addr = INODE_ADDR(inode);
-    uint32_t data_block_entry_addr = inode_addr +
-        fs.dblock_entry_offset;
-    if(fs_sanity_check(0,inode_addr)||fs_sanity_check(0,data_block_entry_addr)){
+    if(fs_sanity_check(0,inode_addr)||fs_sanity_check(0,inode_addr+fs.block_size-1)){
         printf("toxic inode/dblock_entry address at inode %d\n",inode);
         return -1;
     }
     fs.flength[inode] = read_4B(inode_addr);
-    uint32_t dblock_num = ((int32_t)fs.flength[inode]-1)/(int32_t)fs.block_size+1;
-    uint32_t dblock_ind;
-    if(dblock_num>=fs.dblock_num){
-        printf("%d\n",dblock_num);
+    owned = dblock_count(fs.flength[inode]);
+    if(owned>=fs.dblock_num||(!inode_is_ext(inode_addr)&&owned>MAX_FLAT_DBLOCK)){
+        printf("%d\n",owned);
         printf("bad file length at inode %d\n",inode);
         return -1;
     }
-    for(i=0;i<dblock_num;i++){
-        dblock_ind=read_4B(data_block_entry_addr);
-        if(dblock_ind>=fs.dblock_num){
+    for(blk=0;blk<owned;blk+=run){
+        if(-1==(dblock_ind=inode_map(inode_addr,blk,owned-blk,&run))){
+            printf("inode %d maps fewer blocks than its length\n",inode);
+            return -1;
+        }
+        if(dblock_ind+run>fs.dblock_num){
             printf("toxic dblock index at inode %d\n",inode);
             continue;
         }
-        fs.dmap[dblock_ind]=1; /* mark datablock */
-        data_block_entry_addr+=fs.dblock_entry_size;
+        for(i=0;i<run;i++) MAP_SET(fs.dmap,dblock_ind+i); /* mark datablock */
     }
     return 0;
 }   
@@ -798,7 +897,7 @@ mark_inode_and_dblock(){
         if (!check_EOS)
             dentry.filename[fs.filename_size] = '\0'; /* no zero padding, add at the end */
         if(0==mark_after_fname(dentry_addr, &dentry)){
-            fs.imap[dentry.inode_num]=1;
+            MAP_SET(fs.imap,dentry.inode_num);
         }
     }
     return 0;
@@ -819,62 +918,213 @@ find_file(const uint8_t* fname){
     if (fname == NULL || strlen((int8_t*) fname) == 0 ) {
         return NULL;
     }
-    dentry_t dentry;
     if (strlen((int8_t*) fname) > fs.filename_size) {
         return NULL;
     }
-    uint32_t dentry_addr = fs.sys_st_addr + fs.boot_block_padding;
-    if (fs_sanity_check(0, dentry_addr))
+    int32_t dentry_index = dentry_hash_lookup(fname);
+    if (dentry_index == -1)
         return NULL;
-    uint32_t i, dentry_index;
-    uint32_t check_EOS;
-    /* search in whole file system */
-    for (dentry_index = 0; dentry_index < fs.iblock_num; dentry_index++) {
-        if (fs_sanity_check(0, dentry_addr))
-            return NULL;
-        check_EOS = 0;
-        /* search through 32 bytes */
-        for (i = 0; i < fs.filename_size; i++) {
-            if (fs_sanity_check(0, dentry_addr + i))
-                return NULL;
-            dentry.filename[i] = read_1B(dentry_addr + i);
-            if (dentry.filename[i] == '\0')
-                check_EOS = 1;
+    return (wdentry_t*)DENTRY_ADDR(dentry_index);
+}
+
+/* filename hash index */
+
+/**
+ * @brief hash a filename stored in at most filename_size bytes (FNV-1a)
+ * @param fname - file name, NUL terminated or filename_size long
+ * @return ** uint32_t bucket index in dentry_hash
+ */
+static uint32_t
+fname_hash(const uint8_t* fname){
+    uint32_t i, h = 2166136261U;
+    for (i = 0; i < fs.filename_size && fname[i] != '\0'; i++) {
+        h ^= fname[i];
+        h *= 16777619U;
+    }
+    return h & (DENTRY_HASH_SIZE - 1);
+}
+
+/**
+ * @brief compare a NUL terminated name with the (maybe unterminated) name in a dentry
+ * @param fname - file name to look for
+ * @param index - dentry index
+ * @return ** int32_t 1 on same name, 0 otherwise
+ */
+static int32_t
+fname_match(const uint8_t* fname, uint32_t index){
+    const uint8_t* dname = (const uint8_t*) DENTRY_ADDR(index);
+    uint32_t len = strlen((int8_t*) fname);
+    if (strncmp((int8_t*) fname, (int8_t*) dname, len) != 0)
+        return 0;
+    return len == fs.filename_size || dname[len] == '\0';
+}
+
+/**
+ * @brief add dentry index to the filename table, keyed by the name stored in the dentry
+ * @param index - dentry index
+ * @return ** void 
+ */
+static void
+dentry_hash_insert(uint32_t index){
+    uint32_t h;
+    if (index >= MAX_DENTRY) return;
+    h = fname_hash((const uint8_t*) DENTRY_ADDR(index));
+    dentry_next[index] = dentry_hash[h];
+    dentry_hash[h] = index;
+}
+
+/**
+ * @brief drop dentry index from the filename table, must be called before the name changes
+ * @param index - dentry index
+ * @return ** void 
+ */
+static void
+dentry_hash_remove(uint32_t index){
+    int32_t* link;
+    if (index >= MAX_DENTRY) return;
+    link = &dentry_hash[fname_hash((const uint8_t*) DENTRY_ADDR(index))];
+    for (; *link != -1; link = &dentry_next[*link]) {
+        if (*link == index) {
+            *link = dentry_next[index];
+            return;
         }
-        /* if without EOS add one NUL character */
-        if (!check_EOS)
-            dentry.filename[fs.filename_size] = '\0'; /* no zero padding, add at the end */
-        if (strncmp((int8_t*) fname, (int8_t*) dentry.filename, strlen((int8_t*) fname) + 1) == 0) {
-            /* strlen((int8_t*)fname)+1 : both string ends at the same time */
-            return (wdentry_t*)DENTRY_ADDR(dentry_index);
+    }
+}
+
+/**
+ * @brief build filename table from all dentries in boot block
+ * @return ** void 
+ */
+static void
+dentry_hash_build(){
+    int32_t i;
+    for (i = 0; i < DENTRY_HASH_SIZE; i++) dentry_hash[i] = -1;
+    /* insert backwards so that the first of duplicated names wins, same as linear scan */
+    for (i = fs.file_num - 1; i >= 0; i--) {
+        if (i >= MAX_DENTRY || fs_sanity_check(0, DENTRY_ADDR(i) + fs.dentry_size - 1))
+            continue;
+        if (read_1B(DENTRY_ADDR(i)) == '\0')
+            continue; /* no file name */
+        dentry_hash_insert(i);
+    }
+}
+
+/**
+ * @brief find dentry index by filename
+ * @param fname - file name, at most filename_size characters
+ * @return ** int32_t dentry index, -1 if not exist
+ */
+static int32_t
+dentry_hash_lookup(const uint8_t* fname){
+    int32_t index;
+    for (index = dentry_hash[fname_hash(fname)]; index != -1; index = dentry_next[index]) {
+        if (fname_match(fname, index))
+            return index;
+    }
+    return -1;
+}
+/**
+ * @brief (re)allocate inode/dblock map, length/exec cache and mapping counts for the mounted image
+ * @return ** int32_t 0 on success
+ * -1 on no memory
+ */
+static int32_t
+alloc_maps(){
+    if(fs.imap) kfree(fs.imap);
+    if(fs.dmap) kfree(fs.dmap);
+    if(fs.flength) kfree(fs.flength);
+    if(fs.fexec) kfree(fs.fexec);
+    if(fs.fmapped) kfree(fs.fmapped);
+    fs.imap=kmalloc(MAP_WORDS(fs.iblock_num)*sizeof(uint32_t));
+    fs.dmap=kmalloc(MAP_WORDS(fs.dblock_num)*sizeof(uint32_t));
+    fs.flength=kmalloc(fs.iblock_num*sizeof(uint32_t));
+    fs.fexec=kmalloc(fs.iblock_num);
+    fs.fmapped=kmalloc(fs.iblock_num*sizeof(uint16_t));
+    if(!fs.imap||!fs.dmap||!fs.flength||!fs.fexec||!fs.fmapped) return -1;
+    return 0;
+}
+
+/**
+ * @brief clear a bitmap, bits past nbits in the last word stay set so they are never handed out
+ * @param map - bitmap
+ * @param nbits - number of usable bits
+ * @return ** void 
+ */
+static void
+map_init(uint32_t* map,uint32_t nbits){
+    uint32_t i;
+    for(i=0;i<MAP_WORDS(nbits);i++) map[i]=0;
+    for(i=nbits;i<(MAP_WORDS(nbits)<<5);i++) MAP_SET(map,i);
+}
+
+/**
+ * @brief find first clear bit at or after start, a word at a time with bsf,
+ * wrapping around to the beginning of the map
+ * @param map - bitmap
+ * @param nbits - number of usable bits
+ * @param start - bit to start from
+ * @return ** int32_t index of clear bit
+ * -1 on map full
+ */
+static int32_t
+map_find_zero(const uint32_t* map,uint32_t nbits,uint32_t start){
+    uint32_t w,word,i,bit,nwords=MAP_WORDS(nbits);
+    if(nbits==0) return -1;
+    if(start>=nbits) start=0;
+    w=start>>5;
+    word=map[w]|((1U<<(start&31))-1); /* bits before start are looked at after wrapping */
+    for(i=0;i<=nwords;i++){
+        if(~word){
+            bit=(w<<5)+bsf(~word);
+            if(bit<nbits) return bit;
         }
-        dentry_addr += fs.dentry_size;
+        if(++w==nwords) w=0;
+        word=map[w];
+    }
+    return -1;
+}
+
+/**
+ * @brief count clear bits, a word at a time, stopping once max are found
+ * @param map - bitmap, bits past nbits are set
+ * @param nbits - number of usable bits
+ * @param max - enough : the caller only needs to know there are this many
+ * @return ** uint32_t clear bits found, at most max rounded up to the word
+ */
+static uint32_t
+map_count_zero(const uint32_t* map,uint32_t nbits,uint32_t max){
+    uint32_t w,word,n=0;
+    for(w=0;w<MAP_WORDS(nbits)&&n<max;w++){
+        for(word=~map[w];word;word&=word-1) n++;
     }
-    return NULL;
+    return n;
 }
+
 /**
- * @brief allocate new inode
+ * @brief allocate new inode, searching from the rotating hint
  * 
  * @return ** int32_t inode index 
  * -1 on not available 
  */
 static int32_t
 assign_inode(){
-    int32_t i;
-    for(i=0;i<fs.iblock_num;i++) if(fs.imap[i]==0) return i;
-    return -1;
+    int32_t i=map_find_zero(fs.imap,fs.iblock_num,fs.inode_hint);
+    if(i!=-1) fs.inode_hint=i+1;
+    return i;
 }
 /**
  * @brief allocate new data block
- * 
+ * @param prev - data block preceding the new one in the file, -1 if none.
+ * The block right after it is preferred so that files stay contiguous.
  * @return ** int32_t data block index
  * -1 on not available 
  */
 static int32_t
-assign_dblock(){
-    int32_t i;
-    for(i=0;i<fs.dblock_num;i++) if(fs.dmap[i]==0) return i;
-    return -1;
+assign_dblock(int32_t prev){
+    uint32_t goal=(prev>=0&&prev+1<fs.dblock_num)?prev+1:fs.dblock_hint;
+    int32_t i=map_find_zero(fs.dmap,fs.dblock_num,goal);
+    if(i!=-1) fs.dblock_hint=i+1;
+    return i;
 }
 
 
@@ -888,9 +1138,11 @@ assign_dblock(){
 static int32_t 
 create_file(const uint8_t* fname,int32_t nbytes){
     if(nbytes>fs.filename_size) return -1; /* file name too long */
+    if(fs.file_num>=MAX_DENTRY) return -1; /* boot block full */
+    if(find_file(fname)!=NULL) return -1; /* file already exists */
     int32_t new_inode=assign_inode();
-    int32_t new_dblock=assign_dblock(); 
-    inode_t* inode_addr= (inode_t*)INODE_ADDR(new_inode);
+    int32_t new_dblock=assign_dblock(-1);
+    inode_ext_t* inode_addr= (inode_ext_t*)INODE_ADDR(new_inode);
 
     if(new_inode==-1||new_dblock==-1){
         printf("no available inode or datablock : file creation failed\n");
@@ -908,13 +1160,21 @@ create_file(const uint8_t* fname,int32_t nbytes){
 
     new_dentry->filetype=DESCRIPTOR_ENTRY_FILE;
     new_dentry->inode_num=new_inode;
-    /* "in-disk" field */
+    dentry_hash_insert(fs.file_num-1);
+    /* "in-disk" field : new files use the extent format */
+    memset(inode_addr,0,fs.block_size);
     inode_addr->filelength=0; /* file length */
-    inode_addr->dblock[0]=new_dblock; /* 1st data block */
+    inode_addr->extent_num=1;
+    inode_addr->extent[0].start=new_dblock; /* 1st data block */
+    inode_addr->extent[0].len=1;
+    inode_addr->magic=INODE_EXT_MAGIC;
     /* fs parameters */
-    fs.imap[new_inode]=1;
-    fs.dmap[new_dblock]=1;
+    MAP_SET(fs.imap,new_inode);
+    MAP_SET(fs.dmap,new_dblock);
     fs.flength[new_inode]=0;
+    fs.fexec[new_inode]=FEXEC_UNKNOWN;
+    mark_dirty_fs((uint32_t)new_dentry,fs.dentry_size);
+    mark_dirty_fs((uint32_t)inode_addr,fs.block_size);
     dump_fs();
     return 0;
 }
@@ -934,10 +1194,15 @@ rename_file(const uint8_t* src,const uint8_t* dest,int32_t nbytes){
     if(src==NULL||dest==NULL||nbytes>fs.filename_size) return -1; /* bad file name */
     wdentry_t* dentry=find_file(src);
     if(dentry==NULL||fs_sanity_check(dentry->inode_num,fs.sys_st_addr)) return -1; /* bad file */
+    if(find_file(dest)!=NULL) return -1; /* destination name taken */
     uint32_t  cp_len=nbytes;
+    uint32_t  index=((uint32_t)dentry-DENTRY_ADDR(0))/fs.dentry_size;
     if(cp_len>fs.filename_size) cp_len=fs.filename_size;
+    dentry_hash_remove(index);
     strncpy((int8_t*)dentry->filename,(int8_t*)dest,cp_len);
-    dentry->filename[cp_len]='\0';
+    if(cp_len<fs.filename_size) dentry->filename[cp_len]='\0';
+    dentry_hash_insert(index);
+    mark_dirty_fs((uint32_t)dentry,fs.filename_size);
     dump_fs();
     return 0;
 }
@@ -952,19 +1217,24 @@ rename_file(const uint8_t* src,const uint8_t* dest,int32_t nbytes){
 static int32_t
 remove_inode(int32_t inode){
     inode_t* inode_addr=(inode_t*)INODE_ADDR(inode);
-    int32_t  num_dblock=((inode_addr->filelength-1)/(int32_t)fs.block_size)+1;
-    int32_t i;
-    for(i=0;i<num_dblock;i++){
+    uint32_t owned=dblock_count(inode_addr->filelength);
+    uint32_t i,blk,run;
+    int32_t  dnum;
+    for(blk=0;blk<owned;blk+=run){
+        if(-1==(dnum=inode_map((uint32_t)inode_addr,blk,owned-blk,&run))) break;
         /* clear fs parameters */
-        fs.dmap[inode_addr->dblock[i]]=0;
-        /* clear "in-disk" fields */
-        inode_addr->dblock[i]=0;
+        for(i=0;i<run;i++){
+            if(dnum+i<fs.dblock_num) MAP_CLEAR(fs.dmap,dnum+i);
+        }
     }
     /* clear fs parameters */
     fs.flength[inode]=0;
-    fs.imap[inode]=0;
-    /* clear "in-disk" fields */
-    inode_addr->filelength=0;
+    fs.fexec[inode]=FEXEC_UNKNOWN;
+    pcache_invalidate(inode);
+    MAP_CLEAR(fs.imap,inode);
+    /* clear "in-disk" fields : length, block entries/extents and format magic */
+    memset(inode_addr,0,fs.block_size);
+    mark_dirty_fs((uint32_t)inode_addr,fs.block_size);
     return 0;
 }
 
@@ -982,6 +1252,14 @@ remove_file(const uint8_t* fname,int32_t nbytes){
     wdentry_t* dentry=find_file(fname);
     int32_t i;
     if(dentry==NULL||fs_sanity_check(dentry->inode_num,fs.sys_st_addr)) return -1; /* bad file */
+    if(fs.fmapped[dentry->inode_num]){
+        printf("file is mapped : removal failed\n");
+        return -1; /* its data blocks are still mapped in place */
+    }
+    uint32_t index=((uint32_t)dentry-DENTRY_ADDR(0))/fs.dentry_size;
+    /* last dentry is moved into the removed slot below */
+    dentry_hash_remove(index);
+    dentry_hash_remove(fs.file_num-1);
     /* clear "in-disk" fields */
     for(i=0;i<fs.filename_size;i++) dentry->filename[i]='\0';
     dentry->filetype=0;
@@ -995,126 +1273,272 @@ remove_file(const uint8_t* fname,int32_t nbytes){
     temp_dentry=*dentry;
     *dentry=*swap_dentry;
     *swap_dentry=temp_dentry;
+    if(index!=fs.file_num) dentry_hash_insert(index);
+    mark_dirty_fs((uint32_t)dentry,fs.dentry_size);
+    mark_dirty_fs((uint32_t)swap_dentry,fs.dentry_size);
     dump_fs();
     return 0;
 
 }
 
 /**
- * @brief write to the data block
+ * @brief number of data blocks an inode owns for a given file length.
+ * An empty file still owns its first data block (see create_file).
+ * @param length - file length in bytes
+ * @return ** uint32_t number of data blocks
+ */
+static inline uint32_t
+dblock_count(uint32_t length) {
+    return length == 0 ? 1 : (length - 1) / fs.block_size + 1;
+}
+
+/**
+ * @brief check whether an inode is in the extent format
+ * @param inode_addr - address of the inode
+ * @return ** int32_t 1 for inode_ext_t, 0 for flat inode_t written by createfs
+ */
+static inline int32_t
+inode_is_ext(uint32_t inode_addr) {
+    return ((inode_ext_t*) inode_addr)->magic == INODE_EXT_MAGIC;
+}
+
+/**
+ * @brief map a block of a file to its data block, and count how many blocks
+ * from there on are physically contiguous, so they can be copied at once
+ * @param inode_addr - address of the inode
+ * @param blk - block index inside the file
+ * @param max - largest run wanted, must not reach past the blocks the file owns
+ * @param run - number of contiguous data blocks starting at the returned one, 1..max
+ * @return ** int32_t data block index
+ * -1 if the inode does not map blk
+ */
+static int32_t
+inode_map(uint32_t inode_addr, uint32_t blk, uint32_t max, uint32_t* run) {
+    uint32_t i;
+    if (max == 0) max = 1;
+    if (inode_is_ext(inode_addr)) {
+        inode_ext_t* ext = (inode_ext_t*) inode_addr;
+        for (i = 0; i < ext->extent_num && i < MAX_EXTENT; i++) {
+            if (blk < ext->extent[i].len) {
+                *run = ext->extent[i].len - blk;
+                if (*run > max) *run = max;
+                return ext->extent[i].start + blk;
+            }
+            blk -= ext->extent[i].len;
+        }
+        return -1;
+    }
+    inode_t* flat = (inode_t*) inode_addr;
+    if (blk >= MAX_FLAT_DBLOCK) return -1;
+    /* flat inode : one entry per block, merge entries that happen to be consecutive */
+    for (i = 1; i < max && blk + i < MAX_FLAT_DBLOCK && flat->dblock[blk + i] == flat->dblock[blk] + i; i++);
+    *run = i;
+    return flat->dblock[blk];
+}
+
+/**
+ * @brief map a newly allocated data block as the next block of a file.
+ * An extent inode extends its last extent when dnum follows it.
+ * @param inode_addr - address of the inode
+ * @param blk - block index inside the file, equal to the number of blocks it owns
+ * @param dnum - data block index
+ * @return ** int32_t 0 on success
+ * -1 when the inode has no room for one more block entry/extent
+ */
+static int32_t
+inode_append(uint32_t inode_addr, uint32_t blk, uint32_t dnum) {
+    if (inode_is_ext(inode_addr)) {
+        inode_ext_t* ext = (inode_ext_t*) inode_addr;
+        extent_t* last;
+        if (ext->extent_num) {
+            last = &ext->extent[ext->extent_num - 1];
+            if (last->start + last->len == dnum) {
+                last->len++;
+                mark_dirty_fs((uint32_t) last, sizeof(extent_t));
+                return 0;
+            }
+        }
+        if (ext->extent_num >= MAX_EXTENT) return -1;
+        ext->extent[ext->extent_num].start = dnum;
+        ext->extent[ext->extent_num].len = 1;
+        mark_dirty_fs((uint32_t) &ext->extent[ext->extent_num], sizeof(extent_t));
+        ext->extent_num++;
+        mark_dirty_fs((uint32_t) &ext->extent_num, sizeof(uint32_t));
+        return 0;
+    }
+    if (blk >= MAX_FLAT_DBLOCK) return -1;
+    ((inode_t*) inode_addr)->dblock[blk] = dnum;
+    mark_dirty_fs((uint32_t) &((inode_t*) inode_addr)->dblock[blk], fs.dblock_entry_size);
+    return 0;
+}
+
+/**
+ * @brief write to a run of physically contiguous data blocks
  * @param offset - pointer to offset
- * @param dnum - data block number, specifying which data block this function reads
- * @param buf - read result will go to buf
- * @param length - maximum length can be read from this data block
+ * @param dnum - data block number, specifying the first data block this function writes
+ * @param run - number of contiguous data blocks starting at dnum
+ * @param buf - write source, NULL to fill the span with zeros
+ * @param length - maximum length can be written to this run
  * @param buf_ptr - pointer pointing at bottom of buf
  * @return ** int32_t - number of bytes write
  * <=0 when failed
  */
 static int32_t
-write_to_block(uint32_t* offset, uint32_t dnum,const uint8_t* buf, uint32_t length, uint32_t* buf_ptr) {
+write_to_block(uint32_t* offset, uint32_t dnum, uint32_t run, const uint8_t* buf, uint32_t length, uint32_t* buf_ptr) {
     /* data block starting addres : starting address + (number of blocks before this dblock)*block_size */
     /* number of blocks before dblock : dblock_index + 1 (bootblock) + number of iblocks (N) */
-    if (offset == NULL || buf == NULL || buf_ptr == NULL)
+    if (offset == NULL || buf_ptr == NULL)
         return -1;
     uint32_t data_block_addr = fs.sys_st_addr + (1 + fs.iblock_num + dnum) * fs.block_size;
     
-    length = length > (fs.block_size-(*offset)) ? 
-    (fs.block_size-(*offset)) : length; /* length = min (length, block_size) */
+    length = length > (run * fs.block_size - (*offset)) ? 
+    (run * fs.block_size - (*offset)) : length; /* length = min (length, run size) */
 
     data_block_addr += (*offset);
     *offset = 0;
-    // if (fs_sanity_check(0, data_block_addr))
-    //     return -1;
-    uint32_t i;
-
-    for (i = 0; i < length; i++) {
-        if (fs_sanity_check(0, data_block_addr + i))
-            return -1;
-        *((uint8_t*)(data_block_addr + i))=buf[(*buf_ptr)++];
+    /* the span never leaves the run : checking both ends covers every byte */
+    if (fs_sanity_check(0, data_block_addr) || fs_sanity_check(0, data_block_addr + length - 1))
+        return -1;
+    fetch_fs(data_block_addr, length, 1);
+    if (buf == NULL) {
+        memset((void*) data_block_addr, 0, length);
+    } else {
+        memcpy((void*) data_block_addr, buf + *buf_ptr, length);
+        *buf_ptr += length;
     }
+    mark_dirty_fs(data_block_addr,length);
     return length;
 }
 
+/**
+ * @brief write a span of a file, allocating data blocks past the ones the inode owns
+ * Internally used by write_data
+ * @param inode_addr - address of the inode
+ * @param owned - pointer to number of data blocks the inode owns, updated on allocation
+ * @param offset - offset in file from which the write starts
+ * @param buf - write source, NULL to fill the span with zeros
+ * @param length - number of bytes to write
+ * @return ** int32_t bytes written, may be short when the file system is full
+ * -1 on failure before anything is written
+ */
+static int32_t
+write_span(uint32_t inode_addr, uint32_t* owned, uint32_t offset, const uint8_t* buf, uint32_t length) {
+    uint32_t buf_ptr = 0, ret = 0, run, need;
+    uint32_t data_block_offset;
+    int32_t data_block_num, write_length;
+
+    /* calculate in-block offset*/
+    data_block_offset = offset / fs.block_size;
+    offset %= fs.block_size; /* discard offset that fully occupies previous blocks*/
+
+    while (length > 0) {
+        if (data_block_offset < *owned) {
+            /* largest run of owned contiguous blocks covering what is left to write */
+            need = (offset + length - 1) / fs.block_size + 1;
+            if (need > *owned - data_block_offset) need = *owned - data_block_offset;
+            if (-1 == (data_block_num = inode_map(inode_addr, data_block_offset, need, &run)))
+                break;
+        } else {
+            /* grow the file by one block : inode owns blocks contiguously from index 0 */
+            if (-1 == (data_block_num = assign_dblock(data_block_offset ?
+                    inode_map(inode_addr, data_block_offset - 1, 1, &run) : -1))) {
+                printf("file system full\n");
+                break;
+            }
+            if (-1 == inode_append(inode_addr, data_block_offset, data_block_num)) {
+                printf("file too large\n");
+                break;
+            }
+            /* update file system properties */
+            MAP_SET(fs.dmap, data_block_num);
+            (*owned)++;
+            run = 1;
+        }
+        write_length = write_to_block(&offset,
+                                      data_block_num,
+                                      run,
+                                      buf,
+                                      length,
+                                      &buf_ptr); /* write to data blocks, update buf using buf_ptr */
+        if (write_length <= 0)
+            break;
+        ret += write_length;
+        length -= write_length;                        /* the length left to write */
+        data_block_offset += run;                      /* move to next run */
+    }
+    return ret ? ret : -1;
+}
+
 /**
  * @brief write data to file given inode offset,
- * write buffer and write length 
+ * write buffer and write length. The file grows when the write passes its end,
+ * a gap between the old end and offset is filled with zeros, if the free data
+ * blocks can hold it.
  * @param inode - number of inode
- * @param offset - offset in file from which the read starts
- * @param buf - where the read result goes
- * @param length - read at most length bytes
+ * @param offset - offset in file from which the write starts
+ * @param buf - write source
+ * @param length - write at most length bytes
  * @return ** int32_t bytes write
  * >=0 on success
- * <0 read failed
+ * <0 write failed
  */
 static int32_t
 write_data(uint32_t inode, uint32_t offset,const uint8_t* buf, uint32_t length) {
-    uint32_t data_block_num, buf_ptr = 0, ret;
-    uint32_t inode_addr;
-    uint32_t file_length, data_block_offset, data_block_entry_addr;
-    int32_t write_length,rest_len;
-    if (buf == NULL|| 0 == fs.imap[inode])
+    uint32_t inode_addr, file_length, owned, need;
+    int32_t ret;
+    if (buf == NULL || inode >= fs.iblock_num || 0 == MAP_TEST(fs.imap, inode))
         return -1;
     if (fs_sanity_check(inode, fs.sys_st_addr))
         return -1; /* inode out of bound */
     if (length <= 0)
-        return 0; /* no need to read */
+        return 0; /* no need to write */
 
     /* calculate inode address */
     inode_addr = INODE_ADDR(inode);
 
-    if (fs_sanity_check(0, inode_addr) || fs_sanity_check(0, inode_addr + 3))
+    if (fs_sanity_check(0, inode_addr) || fs_sanity_check(0, inode_addr + fs.block_size - 1))
         return -1;
 
     /* extract file length */
     file_length = read_4B(inode_addr);
-    /* "in-disk" length = max(file_length, offset+length) */
-    *((uint32_t*)inode_addr)=file_length>(offset+length)?file_length:(offset+length);
-    /* file system properties */
-    fs.flength[inode]=read_4B(inode_addr);
-
-    rest_len=file_length-offset; /* how many bytes left to overwrite */
-
-    /* calculate in-block offset*/
-    data_block_offset = offset / fs.block_size;
-    offset %= fs.block_size; /* discard offset that fully occupies previous blocks*/
-
-    /* calculate first data block address */
-    data_block_entry_addr = inode_addr +
-        fs.dblock_entry_offset +
-        data_block_offset * fs.dblock_entry_size;
-
-    if (fs_sanity_check(0, data_block_entry_addr))
-        return -1;
-
-    /* !This always assume length in inode is accurate! */
-    ret = length;            
-    // printf("%d\n",rest_len);                             /* set return value to this length */
-    while (length > 0) {
-        if(rest_len>=0&&offset) /* equality with non-zero in-block offset : last file still at current block */
-            data_block_num = read_4B(data_block_entry_addr); 
-        else{
-            data_block_num=assign_dblock();
-            /* "in-disk" field */
-            *((uint32_t*)data_block_entry_addr)=data_block_num==-1?0:data_block_num;
-        }
-        if(data_block_num==-1){
+    owned = dblock_count(file_length);
+
+    /* zero the gap so a sparse write never exposes stale block contents.
+     * A gap the free blocks can't hold is refused before anything is written. */
+    if (offset > file_length) {
+        need = dblock_count(offset + 1) - owned;
+        if (offset >= fs.dblock_num * fs.block_size
+            || map_count_zero(fs.dmap, fs.dblock_num, need) < need) {
             printf("file system full\n");
             return -1;
         }
-        /* update file system properties */
-        fs.dmap[data_block_num]=1;
-        write_length = write_to_block(&offset,
-                                      data_block_num,
-                                      buf,
-                                      length,
-                                      &buf_ptr); /* read from data block, update buf using buf_ptr */
-        
-        if (write_length <= 0)
+        ret = write_span(inode_addr, &owned, file_length, NULL, offset - file_length);
+        if (ret > 0) {
+            /* the zeroed blocks stay reachable from the inode, even if the data write fails */
+            file_length += ret;
+            *((uint32_t*)inode_addr) = file_length;
+            mark_dirty_fs(inode_addr, 4);
+            fs.flength[inode] = file_length;
+            fs.fexec[inode] = FEXEC_UNKNOWN;
+            pcache_invalidate(inode);
+        }
+        if (file_length != offset)
             return -1;
-        length -= write_length;   
-        rest_len -= write_length;                /* the length left to read */
-        data_block_entry_addr += fs.dblock_entry_size; /* move to next data block */
     }
+
+    ret = write_span(inode_addr, &owned, offset, buf, length);
+    if (ret == -1)
+        return -1;
+
+    /* "in-disk" length = max(file_length, offset+written) */
+    if (offset + ret > file_length) {
+        *((uint32_t*)inode_addr) = offset + ret;
+        mark_dirty_fs(inode_addr, 4);
+    }
+    /* file system properties */
+    fs.flength[inode] = read_4B(inode_addr);
+    fs.fexec[inode] = FEXEC_UNKNOWN; /* the magic may have changed */
+    pcache_invalidate(inode); /* and so may the program */
     return ret;
 }
 
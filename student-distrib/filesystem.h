@@ -3,17 +3,25 @@
 #include "types.h"
 #include "x86_desc.h"
 /* flags for file struct table */
-/* lower 2 bits will be used to identify file type : directory(0), rtc(1), file(2), terminal (3), sb16 (4) */
+/* lower 3 bits will be used to identify file type : directory(0), rtc(1), file(2), terminal (3), sb16 (4), meminfo (5) */
 #define DESCRIPTOR_ENTRY_RTC 0
 #define DESCRIPTOR_ENTRY_DIR 1
 #define DESCRIPTOR_ENTRY_FILE 2
 #define DESCRIPTOR_ENTRY_TERMINAL 3
 #define DESCRIPTOR_ENTRY_SB16 4
+#define DESCRIPTOR_ENTRY_MEMINFO 5
 #define F_OPEN (1 << 3)
 #define F_CLOSE 0
 
-#define MAX_INODE   256
-#define MAX_DBLOCK  1024
+#define MAX_FLAT_DBLOCK 1023 /* dblock entries in a createfs (flat) inode */
+#define MAX_DENTRY  63   /* (4096 - 64) / 64 dentries fit in the boot block */
+#define DENTRY_HASH_SIZE 128 /* buckets in filename -> dentry index table, power of 2 */
+
+/* packed allocation bitmaps : one bit per inode/dblock, 32 per word */
+#define MAP_WORDS(n)      (((n) + 31) >> 5)
+#define MAP_TEST(map, i)  (((map)[(i) >> 5] >> ((i) & 31)) & 1)
+#define MAP_SET(map, i)   ((map)[(i) >> 5] |= (1U << ((i) & 31)))
+#define MAP_CLEAR(map, i) ((map)[(i) >> 5] &= ~(1U << ((i) & 31)))
 
 /* directory entry, 64 Bytes : for read */
 typedef struct
@@ -25,6 +33,32 @@ typedef struct
     uint32_t reserved[6];
 } dentry_t;
 
+/* directory entry handed to users by getdents, fixed layout (48 Bytes) */
+typedef struct
+    dirent
+{
+    uint32_t inode;       /* inode number */
+    uint32_t size;        /* file length in bytes, 0 for devices and the directory */
+    uint32_t type;        /* DESCRIPTOR_ENTRY_RTC, _DIR or _FILE */
+    uint8_t  name[33];    /* NUL terminated */
+} dirent_t;
+
+/* file metadata for stat/fstat, fixed layout (20 Bytes) */
+typedef struct
+    stat
+{
+    uint32_t inode;       /* inode number, 0 for devices and the directory */
+    uint32_t type;        /* DESCRIPTOR_ENTRY_* */
+    uint32_t size;        /* file length in bytes */
+    uint32_t blocks;      /* data blocks the file owns */
+    uint32_t exec;        /* 1 : starts with the ELF magic */
+} stat_t;
+
+/* fexec : whether a file is executable, found on first use and forgotten on write */
+#define FEXEC_UNKNOWN 0
+#define FEXEC_YES     1
+#define FEXEC_NO      2
+
 /* dentry for write */
 typedef struct
     wdentry
@@ -38,9 +72,32 @@ typedef struct
     inode
 {
     int32_t filelength;
-    int32_t dblock[1023];
+    int32_t dblock[MAX_FLAT_DBLOCK];
 } inode_t;
 
+/* extent inode (version 1) : the last word of the block holds INODE_EXT_MAGIC, which can never
+ * be a dblock index in the flat format, so inodes written by createfs are still read as inode_t */
+#define INODE_EXT_MAGIC 0x31545845 /* "EXT1" */
+#define MAX_EXTENT      510        /* (4096 - 4 * 4) / 8 */
+
+/* run of len data blocks starting at dblock start */
+typedef struct
+    extent
+{
+    uint32_t start;
+    uint32_t len;
+} extent_t;
+
+typedef struct
+    inode_ext
+{
+    int32_t filelength;
+    uint32_t extent_num;
+    extent_t extent[MAX_EXTENT];
+    uint32_t reserved;
+    uint32_t magic;
+} inode_ext_t;
+
 /**
  * @brief jump table for file system read_write operation
  */
@@ -54,6 +111,7 @@ typedef struct
     int32_t (*create_file)(const uint8_t *, int32_t);
     int32_t (*remove_file)(const uint8_t *, int32_t);
     int32_t (*rename_file)(const uint8_t *, const uint8_t *, int32_t);
+    int32_t (*data_addr)(uint32_t, uint32_t, uint32_t);
 } fsjmp_t;
 
 /**
@@ -76,6 +134,13 @@ typedef struct
  * dentry_size - the size of one dentry
  * filename_size - the size of a filename stored in dentry
  * (Note we can miss '/0' according to Appendix A, so we need 33 bytes to store the filename)
+ * imap, dmap - allocation bitmaps, bits past iblock_num/dblock_num are kept set
+ * flength - cached length of each inode
+ * fexec - cached FEXEC_* of each inode
+ * fmapped - mappings (mmap) of each inode : a mapped file can't be removed,
+ * its data blocks are mapped in place
+ * (imap, dmap, flength, fexec, fmapped are kmalloc'ed at open_fs, sized from the boot block)
+ * inode_hint, dblock_hint - where the next allocation search starts
  */
 typedef struct
     filesystem
@@ -90,6 +155,8 @@ typedef struct
     int32_t (*close_fs)(void);
     int32_t (*load_prog)(const uint8_t *, uint32_t, uint32_t);
     int32_t (*check_exec)(const uint8_t *);
+    int32_t (*getdents)(file_t *, dirent_t *, int32_t); /* batched directory read */
+    int32_t (*stat)(uint32_t, uint32_t, stat_t *);      /* metadata of inode, of a given type */
     /* A series of shared variables you might want to make use of */
     uint32_t file_num;
     uint32_t r_times, w_times;
@@ -104,9 +171,13 @@ typedef struct
     uint32_t boot_block_padding;
     uint32_t dentry_size;
     uint32_t filename_size;
-    uint8_t imap[MAX_INODE];
-    uint8_t dmap[MAX_DBLOCK];
-    uint32_t flength[MAX_INODE];
+    uint32_t inode_hint;
+    uint32_t dblock_hint;
+    uint32_t* imap;
+    uint32_t* dmap;
+    uint32_t* flength;
+    uint8_t* fexec;
+    uint16_t* fmapped;
 } fs_t;
 
 extern fs_t fs;
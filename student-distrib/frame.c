@@ -0,0 +1,248 @@
+/**
+ * @file frame.c
+ * @brief Physical page frame allocator. kernel.c passes the usable regions of
+ * the multiboot memory map to frame_add(); frame_init() then puts one
+ * descriptor per 4 KB frame below the top of RAM in the first free memory
+ * above the kernel, and links every frame nobody owns into a free list. A
+ * frame is handed out with one reference; frames shared by several owners
+ * (program text mapped by every process running it) take one reference each
+ * and go back to the free list with the last one. The buddy arena and the 4 MB
+ * program pages are runs of frames taken at boot and at exec.
+ * Single frames come from the top of memory, runs are searched from the
+ * bottom, so the two rarely get in each other's way.
+ */
+#include "frame.h"
+#include "mmu.h"
+#include "lib.h"
+
+/* the kernel maps RAM 1:1, except where user pages live : those frames are never handed out */
+#define USER_WINDOW(pa)  ((pa) >= UVM_START && (pa) < MMAP_START + UVM_SIZE)
+#define FRAME_FREE(f)    ((FRAME_RAM == frames[f].flags) && 0 == frames[f].refs)
+
+typedef struct frame_region {
+    uint32_t base;
+    uint32_t end;
+} frame_region_t;
+
+static frame_region_t regions[FRAME_REGIONS];
+static uint32_t nregions;
+static frame_region_t holds[FRAME_REGIONS]; /* boot data in RAM : multiboot info, modules */
+static uint32_t nholds;
+static uint32_t free_head = FRAME_NONE;
+
+frame_t* frames;
+uint32_t frame_count;
+frame_stats_t frame_stats;
+
+/**
+ * @brief put a frame at the head of the free list
+ * @param f - frame number
+ * @return ** void
+ */
+static void
+free_push(uint32_t f) {
+    frames[f].prev = FRAME_NONE;
+    frames[f].next = free_head;
+    if (free_head != FRAME_NONE) frames[free_head].prev = f;
+    free_head = f;
+    frame_stats.free++;
+}
+
+/**
+ * @brief take a frame out of the free list
+ * @param f - frame number
+ * @return ** void
+ */
+static void
+free_remove(uint32_t f) {
+    if (frames[f].prev != FRAME_NONE) frames[frames[f].prev].next = frames[f].next;
+    else free_head = frames[f].next;
+    if (frames[f].next != FRAME_NONE) frames[frames[f].next].prev = frames[f].prev;
+    frame_stats.free--;
+}
+
+/**
+ * @brief record a region of usable RAM from the memory map, before frame_init
+ * @param base - first byte
+ * @param len - bytes, clipped at FRAME_MEM_MAX
+ * @return ** void
+ */
+void
+frame_add(uint32_t base, uint32_t len) {
+    uint32_t end;
+    if (nregions == FRAME_REGIONS || base >= FRAME_MEM_MAX) return;
+    end = (len > FRAME_MEM_MAX - base) ? FRAME_MEM_MAX : base + len;
+    base = PGROUNDUP(base);
+    end = PGROUNDDOWN(end);
+    if (base >= end) return;
+    regions[nregions].base = base;
+    regions[nregions].end = end;
+    nregions++;
+}
+
+/**
+ * @brief keep a range of RAM the boot loader filled (multiboot info, memory
+ * map, modules) out of the free list, before frame_init. The file system
+ * image is used in place, so its module must never be handed out.
+ * @param base - first byte
+ * @param len - bytes
+ * @return ** void
+ */
+void
+frame_reserve(uint32_t base, uint32_t len) {
+    if (len == 0) return;
+    if (nholds == FRAME_REGIONS) panic("frame_reserve : too many boot ranges");
+    holds[nholds].base = PGROUNDDOWN(base);
+    holds[nholds].end = (len > 0xFFFFFFFF - base) ? 0xFFFFFFFF : PGROUNDUP(base + len);
+    nholds++;
+}
+
+/**
+ * @brief the first byte past a range that must stay untouched and overlaps
+ * [base, base+size) : the user window or a boot range
+ * @param base - first byte
+ * @param size - bytes
+ * @return ** uint32_t the byte to move base to, 0 if [base, base+size) is clear
+ */
+static uint32_t
+held_until(uint32_t base, uint32_t size) {
+    uint32_t i;
+    if (base < MMAP_START + UVM_SIZE && base + size > UVM_START) return MMAP_START + UVM_SIZE;
+    for (i = 0; i < nholds; i++) {
+        if (base < holds[i].end && base + size > holds[i].base) return holds[i].end;
+    }
+    return 0;
+}
+
+/**
+ * @brief build the frame descriptors from the recorded regions, before paging is on.
+ * Frames below FRAME_KERNEL_END, in the user window, in the boot ranges
+ * (frame_reserve) and holding the descriptors themselves are reserved, every
+ * other frame of RAM is free.
+ * @return ** void
+ */
+void
+frame_init(void) {
+    uint32_t i, j, f, pa, base, next, size, top = 0;
+    for (i = 0; i < nregions; i++) {
+        if (regions[i].end > top) top = regions[i].end;
+    }
+    frame_count = top / PGSIZE;
+    size = PGROUNDUP(frame_count * sizeof(frame_t));
+
+    /* the descriptors go in the first region with room above the kernel, clear of the boot ranges */
+    frames = NULL;
+    for (i = 0; i < nregions && frames == NULL; i++) {
+        base = (regions[i].base < FRAME_KERNEL_END) ? FRAME_KERNEL_END : regions[i].base;
+        while (base < regions[i].end && (next = held_until(base, size)) != 0) base = next;
+        if (base < regions[i].end && regions[i].end - base >= size) frames = (frame_t*) base;
+    }
+    if (frames == NULL) panic("frame_init : no memory for the frame descriptors");
+    memset(frames, 0, frame_count * sizeof(frame_t));
+
+    for (i = 0; i < nregions; i++) {
+        for (f = regions[i].base / PGSIZE; f < regions[i].end / PGSIZE; f++) frames[f].flags = FRAME_RAM;
+    }
+    memset(&frame_stats, 0, sizeof(frame_stats));
+    free_head = FRAME_NONE;
+    for (f = 0; f < frame_count; f++) {
+        if (!(frames[f].flags & FRAME_RAM)) continue;
+        frame_stats.ram++;
+        pa = f * PGSIZE;
+        for (j = 0; j < nholds && !(pa >= holds[j].base && pa < holds[j].end); j++);
+        if (pa < FRAME_KERNEL_END || USER_WINDOW(pa) || j < nholds
+            || (pa >= (uint32_t) frames && pa < (uint32_t) frames + size)) {
+            frames[f].flags |= FRAME_RESERVED;
+            frame_stats.reserved++;
+        } else {
+            free_push(f); /* ascending : the head is the highest frame */
+        }
+    }
+    printf("frames : %d KB of RAM, %d KB free, descriptors at 0x%x\n",
+           frame_stats.ram * 4, frame_stats.free * 4, (uint32_t) frames);
+}
+
+/**
+ * @brief take one frame, O(1)
+ * @return ** uint32_t physical address of the frame, one reference
+ * 0 if memory is full
+ */
+uint32_t
+frame_alloc(void) {
+    uint32_t f = free_head;
+    if (f == FRAME_NONE) {
+        frame_stats.fails++;
+        return 0;
+    }
+    free_remove(f);
+    frames[f].refs = 1;
+    frame_stats.allocs++;
+    return f * PGSIZE;
+}
+
+/**
+ * @brief take a run of physically contiguous frames, searched from the bottom of memory.
+ * For the buddy arena and 4 MB program pages : O(frames), not for hot paths.
+ * @param size - bytes, a multiple of PGSIZE
+ * @param align - alignment of the first frame in bytes, a power of 2, at least PGSIZE
+ * @return ** uint32_t physical address of the run, every frame with one reference
+ * 0 if there is no such run
+ */
+uint32_t
+frame_alloc_contig(uint32_t size, uint32_t align) {
+    uint32_t n = size / PGSIZE, step = align / PGSIZE, f, i;
+    if (n == 0 || step == 0) return 0;
+    for (f = 0; f + n <= frame_count; f += step) {
+        for (i = 0; i < n && FRAME_FREE(f + i); i++);
+        if (i == n) {
+            for (i = 0; i < n; i++) {
+                free_remove(f + i);
+                frames[f + i].refs = 1;
+            }
+            frame_stats.allocs += n;
+            return f * PGSIZE;
+        }
+        f = (f + i) & ~(step - 1); /* skip past the frame in use */
+    }
+    frame_stats.fails++;
+    return 0;
+}
+
+/**
+ * @brief one more owner of a frame in use
+ * @param pa - physical address in the frame
+ * @return ** void
+ */
+void
+frame_get(uint32_t pa) {
+    uint32_t f = pa / PGSIZE;
+    if (f < frame_count && frames[f].refs) frames[f].refs++;
+}
+
+/**
+ * @brief an owner lets a frame go, the last one frees it
+ * @param pa - physical address in the frame
+ * @return ** int32_t references left
+ * -1 if the frame is not in use
+ */
+int32_t
+frame_put(uint32_t pa) {
+    uint32_t f = pa / PGSIZE;
+    if (f >= frame_count || FRAME_RAM != frames[f].flags || frames[f].refs == 0) return -1;
+    if (--frames[f].refs == 0) {
+        free_push(f);
+        frame_stats.frees++;
+    }
+    return frames[f].refs;
+}
+
+/**
+ * @brief owners of a frame
+ * @param pa - physical address in the frame
+ * @return ** uint32_t references, 0 if free or not RAM
+ */
+uint32_t
+frame_refs(uint32_t pa) {
+    uint32_t f = pa / PGSIZE;
+    return (f < frame_count) ? frames[f].refs : 0;
+}
@@ -0,0 +1,46 @@
+/* physical page frame allocator : the RAM the boot loader reports, one descriptor with a reference count per frame */
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include "types.h"
+
+#define FRAME_MEM_MAX    (1U << 30)  /* RAM above 1 GB is not used */
+#define FRAME_REGIONS    16          /* usable regions kept from the memory map */
+#define FRAME_KERNEL_END (8 << 20)   /* kernel, boot modules and PCBs : never handed out */
+#define FRAME_NONE       0xFFFFFFFF  /* ends the free list */
+
+/* frame flags */
+#define FRAME_RAM        1           /* usable RAM in the memory map */
+#define FRAME_RESERVED   2           /* RAM the kernel keeps : below FRAME_KERNEL_END, boot data, the descriptors, the user window */
+
+typedef struct frame {
+    uint16_t refs;      /* owners and mappings, 0 : free */
+    uint16_t flags;
+    uint32_t prev;      /* free list, frame numbers */
+    uint32_t next;
+} frame_t;
+
+/* counters, since boot */
+typedef struct frame_stats {
+    uint32_t ram;       /* frames of usable RAM */
+    uint32_t reserved;  /* ... kept by the kernel */
+    uint32_t free;
+    uint32_t allocs;    /* frames handed out */
+    uint32_t frees;     /* frames whose last reference went */
+    uint32_t fails;     /* allocations that found no frame (or no run of frames) */
+} frame_stats_t;
+
+extern frame_t* frames;
+extern uint32_t frame_count;   /* descriptors : frames below the top of usable RAM */
+extern frame_stats_t frame_stats;
+
+extern void     frame_add(uint32_t base, uint32_t len);
+extern void     frame_reserve(uint32_t base, uint32_t len);
+extern void     frame_init(void);
+extern uint32_t frame_alloc(void);
+extern uint32_t frame_alloc_contig(uint32_t size, uint32_t align);
+extern void     frame_get(uint32_t pa);
+extern int32_t  frame_put(uint32_t pa);
+extern uint32_t frame_refs(uint32_t pa);
+
+#endif
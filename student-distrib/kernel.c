@@ -19,8 +19,10 @@
 #include "process.h"
 #include "signal.h"
 #include "ata.h"
+#include "blk.h"
 #include "vga.h"
 #include "sb16.h"
+#include "frame.h"
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -31,10 +33,12 @@
 void entry(unsigned long magic, unsigned long addr) {
 
     multiboot_info_t *mbi;
+    module_t fs_mod;
     int32_t i;
 
     /* Clear the screen. */
     clear();
+    fs_mod.mod_start=fs_mod.mod_end=0;
 
     /* Am I booted by a Multiboot-compliant boot loader? */
     if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
@@ -44,6 +48,8 @@ void entry(unsigned long magic, unsigned long addr) {
 
     /* Set MBI to the address of the Multiboot information structure. */
     mbi = (multiboot_info_t *) addr;
+    /* the frame allocator must not hand out what the boot loader left in RAM */
+    frame_reserve(addr, sizeof(multiboot_info_t));
 
     /* Print out the flags. */
     printf("flags = 0x%#x\n", (unsigned)mbi->flags);
@@ -64,10 +70,12 @@ void entry(unsigned long magic, unsigned long addr) {
         int mod_count = 0;
         int i;
         module_t* mod = (module_t*)mbi->mods_addr;
+        frame_reserve(mbi->mods_addr, mbi->mods_count * sizeof(module_t));
         while (mod_count < mbi->mods_count) {
+            frame_reserve(mod->mod_start, mod->mod_end - mod->mod_start);
             /* start of file system address for Module 0 */
-            if(mod_count==FILESYS_MOD){ /* open file system given module address */
-                fs.open_fs((uint32_t)mod);
+            if(mod_count==FILESYS_MOD){ /* file system is opened once kmalloc is up */
+                fs_mod=*mod;
             }
             printf("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start); 
             /* end of file system address for Module 0 */
@@ -100,9 +108,10 @@ void entry(unsigned long magic, unsigned long addr) {
         memory_map_t *mmap;
         printf("mmap_addr = 0x%#x, mmap_length = 0x%x\n",
                 (unsigned)mbi->mmap_addr, (unsigned)mbi->mmap_length);
+        frame_reserve(mbi->mmap_addr, mbi->mmap_length);
         for (mmap = (memory_map_t *)mbi->mmap_addr;
                 (unsigned long)mmap < mbi->mmap_addr + mbi->mmap_length;
-                mmap = (memory_map_t *)((unsigned long)mmap + mmap->size + sizeof (mmap->size)))
+                mmap = (memory_map_t *)((unsigned long)mmap + mmap->size + sizeof (mmap->size))) {
             printf("    size = 0x%x, base_addr = 0x%#x%#x\n    type = 0x%x,  length    = 0x%#x%#x\n",
                     (unsigned)mmap->size,
                     (unsigned)mmap->base_addr_high,
@@ -110,6 +119,13 @@ void entry(unsigned long magic, unsigned long addr) {
                     (unsigned)mmap->type,
                     (unsigned)mmap->length_high,
                     (unsigned)mmap->length_low);
+            /* type 1 is usable RAM : the page frame allocator gets what lies below 4 GB */
+            if (mmap->type == 1 && mmap->base_addr_high == 0)
+                frame_add(mmap->base_addr_low, mmap->length_high ? 0xFFFFFFFF : mmap->length_low);
+        }
+    } else if (CHECK_FLAG(mbi->flags, 0)) {
+        /* no memory map : the RAM above 1 MB */
+        frame_add(0x100000, mbi->mem_upper << 10);
     }
 
     if(CHECK_FLAG(mbi->flags,7)){
@@ -163,6 +179,13 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
     vm_init();
+
+    /* find the drives (LBA48 or not), then bus-master DMA if the IDE controller supports it */
+    ata_init();
+    ata_dma_init();
+
+    /* open file system given module address, its maps are sized by the image */
+    if(fs_mod.mod_end) fs.open_fs((uint32_t)&fs_mod);
     
     /* Init the PIC */
     i8259_init();
@@ -174,8 +197,9 @@ void entry(unsigned long magic, unsigned long addr) {
     cursor_init();
     sb16_init();
     psmouse_init();
+    blk_init();     /* disk interrupt : waiting processes sleep from now on */
 
-    dump_fs();
+    sync_fs();
 
     terminal_index=1; /* default : terminal 1 */
     terminal[1].open(1,(int32_t*)get_terbuf_addr(terminal_index)); /* open active terminal */
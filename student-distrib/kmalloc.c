@@ -1,9 +1,10 @@
 #include "kmalloc.h"
+#include "filesystem.h"
+#include "frame.h"
 
 #define CHECK_ALIGNMENT(x)  \
     (!!(x) && (!((x) & ((x) - 1))))
 
-#define HEADER_SIZE  (sizeof(buddy_block_t))
 #define START        (buddy_allocator.start)
 #define END          (buddy_allocator.end)
 #define ALIGN        (buddy_allocator.align)
@@ -18,7 +19,7 @@
     ({                                      \
         uint32_t sz = ALIGN;                \
         uint32_t t;                         \
-        t = ROUNDUP_SIZE(x + HEADER_SIZE);  \
+        t = ROUNDUP_SIZE(x) + ALIGN;        \
         while (sz < t) { sz <<= 1; }        \
         sz;                                 \
     })
@@ -30,98 +31,91 @@
         sz;                                 \
     })
 
+#define ORDER(sz)           (bsf(sz) - bsf(ALIGN))
+#define FREE_LIST(o)        (buddy_allocator.free_list[o])
+
+// The buddy of a block lies at its offset from START with the bit of its size flipped.
+#define GET_BUDDY(b)        \
+    ((buddy_block_t*) ((uint8_t*) START + (((uint8_t*) (b) - (uint8_t*) START) ^ (b)->size)))
+
+static void
+free_push(buddy_block_t* b) {
+    uint32_t o = ORDER(b->size);
+    b->free = true;
+    b->prev = NULL;
+    b->next = FREE_LIST(o);
+    if (b->next) {
+        b->next->prev = b;
+    }
+    FREE_LIST(o) = b;
+    buddy_allocator.nfree[o]++;
+}
+
+static void
+free_remove(buddy_block_t* b) {
+    uint32_t o = ORDER(b->size);
+    if (b->prev) {
+        b->prev->next = b->next;
+    } else {
+        FREE_LIST(o) = b->next;
+    }
+    if (b->next) {
+        b->next->prev = b->prev;
+    }
+    buddy_allocator.nfree[o]--;
+}
+
+/*!
+ * @brief Halve a block until it is the smallest one holding `size`, the upper halves go to their free lists.
+ * @param b is block to split, it stays free (and listed) if it was.
+ * @param size is bytes the block must keep, header included.
+ * @return the block, NULL on invalid arguments.
+ */
 buddy_block_t*
 buddy_split(buddy_block_t* b, uint32_t size) {
+    bool was_free;
+    buddy_block_t* upper;
     if (!b || !size) {
         return NULL;  // Invalid arguments!
     }
 
-    while (size < b->size) {
+    if ((was_free = b->free)) {
+        free_remove(b);
+    }
+    while (size <= b->size >> 1 && ALIGN < b->size) {
         b->size >>= 1;
-        GET_NEXT(b)->size = b->size;
-        GET_NEXT(b)->free = true;
+        upper = GET_NEXT(b);
+        upper->size = b->size;
+        free_push(upper);
+    }
+    if (was_free) {
+        free_push(b);
     }
 
     return b;
 }
 
+/*!
+ * @brief Take the smallest free block holding `size` : the first non-empty free list from the order of `size` up,
+ * split down to that order. O(log n) in the size of the arena.
+ * @param size is bytes needed, header included.
+ * @return block, no longer free, NULL if none is large enough.
+ */
 buddy_block_t*
 buddy_search(uint32_t size) {
-    buddy_block_t* res = NULL;
-    buddy_block_t* curr = START;
-    buddy_block_t* next = GET_NEXT(START);
-
-    if (next >= END && curr->free) {
-        return buddy_split(curr, size);  // Buddy out of bounds.
-    }
-
-    while (curr < END && next < END) {
-        if (curr->free && next->free && curr->size == next->free) {
-            curr->size <<= 1;  // Coalesce two blocks.
-
-            if (size <= curr->size && (NULL == res || curr->size <= res->size)) {
-                res = curr;  // Update result block.
-            }
-
-            // Increment curr & next pointer.
-            if (END > (curr = GET_NEXT(next))) {
-                next = GET_NEXT(curr);
-            }
-            continue;
-        }
-
-        if (curr->free && size <= curr->size && (NULL == res || curr->size <= res->size)) {
-            res = curr;
-        }
-
-        // Implicitly prefer the left (curr) block.
-        if (next->free && size <= next->size && (NULL == res || next->size < res->size)) {
-            res = next;
-        }
+    buddy_block_t* b;
+    uint32_t o, want;
 
-        if (curr->size <= next->size) {
-            // Skip the next block -- it either has been or will not be a candidate.
-            if (END > (curr = GET_NEXT(next))) {
-                next = GET_NEXT(curr);
-            }
-            continue;
-        }
-        curr = next;
-        next = GET_NEXT(curr);
+    for (want = 0; want < BUDDY_ORDERS && (ALIGN << want) < size; ++want);
+    for (o = want; o < BUDDY_ORDERS && NULL == FREE_LIST(o); ++o);
+    if (BUDDY_ORDERS == o) {
+        return NULL;
     }
 
-    return res ? buddy_split(res, size) : NULL;
-}
-
-void
-buddy_coalesce(void) {
-    buddy_block_t* curr;
-    buddy_block_t* next;
-    bool done;
-
-    while (1) {
-        curr = START;
-        next = GET_NEXT(START);
-        done = true;
-
-        while (curr < END && next < END) {
-            if (curr->free && next->free && curr->size == next->size) {
-                curr->size <<= 1;  // Coalesce two blocks.
-
-                // Skip the coalesced block.
-                if (END > (curr = GET_NEXT(curr))) {
-                    next = GET_NEXT(curr);
-                    done = false;
-                }
-                continue;
-            }
-
-            curr = next;
-            next = GET_NEXT(curr);
-        }
-
-        if (done) { return; }
-    }
+    b = FREE_LIST(o);
+    free_remove(b);
+    b->free = false;
+    return buddy_split(b, size);
 }
 
 void
@@ -140,9 +134,13 @@ buddy_init(void* mem, uint32_t size, uint32_t align) {
     // Initialize the first buddy block & buddy allocator.
     START = mem;
     START->size = size;
-    START->free = true;
     END = GET_NEXT(START);
     ALIGN = align;
+    memset(buddy_allocator.free_list, 0, sizeof(buddy_allocator.free_list));
+    memset(buddy_allocator.nfree, 0, sizeof(buddy_allocator.nfree));
+    buddy_allocator.allocs = buddy_allocator.frees = buddy_allocator.fails = 0;
+    free_push(START);
+    slab_init();
 
     // DEBUG
     printf("\nBuddy allocator initialized!\n");
@@ -190,139 +188,342 @@ buddy_traverse(void) {
 void*
 buddy_alloc(uint32_t size) {
     buddy_block_t* res;
-    uint32_t sz;
     if (0 == size) { return NULL; }
 
-    sz = GET_BLOCK_SIZE(size);
-    if (NULL == (res = buddy_search(sz))) {
-        buddy_coalesce();
-        res = buddy_search(sz);
-    }
-
-    if (NULL == res) {
+    if (NULL == (res = buddy_search(GET_BLOCK_SIZE(size)))) {
+        buddy_allocator.fails++;
         return NULL;
     }
-    res->free = false;
+    buddy_allocator.allocs++;
+    res->owner = NULL;
     return (void*) ((uint8_t*) res + ALIGN);
 }
 
+/*!
+ * @brief Give a block back, merging it with its buddy for as long as the buddy is free and whole.
+ * @param mem is pointer returned by `buddy_alloc`.
+ * @return 0 on success, 1 if `mem` is not an allocated buddy block, or is an object of a cache.
+ */
 int32_t
 buddy_free(void* mem) {
     buddy_block_t* b;
+    buddy_block_t* buddy;
     if (NULL == mem) {
         panic("buddy free, attempted to free a nullptr");
     }
     b = (buddy_block_t*) ((uint8_t*) mem - ALIGN);
-    if (START > b || END <= b) {
+    if (START > b || END <= b || ((uint8_t*) b - (uint8_t*) START) % ALIGN || b->free || b->owner) {
         return 1;
     }
-    b->free = true;
-    memset((uint8_t*) b + HEADER_SIZE, MEM_MAGIC, b->size - HEADER_SIZE);
+    while (b->size < (uint32_t) ((uint8_t*) END - (uint8_t*) START)) {
+        buddy = GET_BUDDY(b);
+        if (!buddy->free || buddy->size != b->size) {
+            break;
+        }
+        free_remove(buddy);
+        if (buddy < b) {
+            b = buddy;
+        }
+        b->size <<= 1;
+    }
+    free_push(b);
+    buddy_allocator.frees++;
     return 0;
 }
 
+#define SLAB_CLASS(sz)      (bsf(sz) - bsf(MIN_SIZE))
+#define SLAB_OF(mem)        ((slab_t*) PGROUNDDOWN((uint32_t) (mem)))
+#define BLOCK_OF(mem)       ((buddy_block_t*) ((uint8_t*) (mem) - ALIGN))
+#define LINK(c, obj)        (*(void**) ((uint8_t*) (obj) + (c)->link))
+#define ROUNDUP_TO(x, a)    (((x) + (a) - 1) & ~((a) - 1))
+
+static void
+slab_list_push(slab_t** list, slab_t* s) {
+    s->prev = NULL;
+    s->next = *list;
+    if (s->next) {
+        s->next->prev = s;
+    }
+    *list = s;
+}
+
+static void
+slab_list_remove(slab_t** list, slab_t* s) {
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        *list = s->next;
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+}
+
+/*!
+ * @brief Fill in a cache and put it on the list of caches.
+ * @param c is cache to set up.
+ * @param name is name shown in statistics.
+ * @param size is object bytes.
+ * @param align is object alignment, a power of 2 up to PGSIZE.
+ * @param ctor is constructor run once per object, NULL for none.
+ * @return 0 on success, -1 on invalid arguments.
+ */
+static int32_t
+kmem_cache_setup(kmem_cache_t* c, const int8_t* name, uint32_t size, uint32_t align, void (*ctor)(void*)) {
+    align = align < MIN_SIZE ? MIN_SIZE : align;
+    if (0 == size || !CHECK_ALIGNMENT(align) || PGSIZE < align) {
+        return -1;
+    }
+    memset(c, 0, sizeof(*c));
+    strncpy(c->name, name, KMEM_NAME_LEN - 1);
+    c->size = size;
+    c->align = align;
+    c->ctor = ctor;
+
+    // A constructed object keeps its contents while free : its link goes after it.
+    if (ctor) {
+        c->link = ROUNDUP_TO(size, sizeof(void*));
+        c->stride = c->link + sizeof(void*);
+    } else {
+        c->stride = size < sizeof(void*) ? sizeof(void*) : size;
+    }
+    c->stride = ROUNDUP_TO(c->stride, align);
+    c->offset = ROUNDUP_TO(SLAB_HDR, align);
+    if (c->offset + c->stride > PGSIZE) {
+        c->offset = 0;  // Larger than a slab : buddy blocks, page-aligned.
+    }
+
+    c->next = kmem_caches;
+    kmem_caches = c;
+    return 0;
+}
+
+/*!
+ * @brief Set up the size classes of kmalloc, called by `buddy_init`.
+ */
+void
+slab_init(void) {
+    int32_t i;
+    int8_t name[KMEM_NAME_LEN] = "kmalloc-";
+    kmem_caches = NULL;
+    for (i = SLAB_CLASSES - 1; i >= 0; --i) {
+        itoa(MIN_SIZE << i, name + 8, 10);
+        kmem_cache_setup(&slab_caches[i], name, MIN_SIZE << i, MIN_SIZE, NULL);
+    }
+}
+
 void
 slab_traverse(void) {
-    slab_t* s = slab_head;
-    struct mem* m;
-    int32_t i = 0;
-    int32_t j;
+    kmem_cache_t* c;
+    slab_t* s;
+    uint32_t n, used, total;
     printf("\nSlab Allocator Traverse\n");
 
-    while (s) {
-        printf("Slab #%d\n", i++);
-        printf("slab.size: %u\n", s->size);
-        m = s->freelist;
-        j = 0;
-        while (m) {
-//            printf("slab object at 0x%x\n", m);
-            j++;
-            m = m->next;
+    for (c = kmem_caches; c; c = c->next) {
+        n = used = total = 0;
+        for (s = c->full; s; s = s->next, ++n) { used += s->refcount; total += s->total; }
+        for (s = c->partial; s; s = s->next, ++n) { used += s->refcount; total += s->total; }
+        for (s = c->empty; s; s = s->next, ++n) { total += s->total; }
+        if (0 == c->offset) {
+            used = c->allocs - c->frees;
+            total = used + c->nstash;
+        }
+        if (c->allocs) {
+            printf("%s (%u B): %u slabs (%u empty), %u of %u objects used, %u allocs %u frees %u fails.\n",
+                   c->name, c->size, n, c->nempty, used, total, c->allocs, c->frees, c->fails);
         }
-        printf("%u slab objects found.\n", j);
-        s = s->next;
     }
 }
 
+/*!
+ * @brief Take a page from the buddy allocator and cut it into objects of a cache, constructing each one. The slab
+ * goes to the partial list.
+ * @param c is cache whose objects fit a slab.
+ * @return new slab, NULL if the buddy allocator is out of memory.
+ */
 slab_t*
-slab_create(uint32_t size) {
+slab_create(kmem_cache_t* c) {
     int32_t i;
     slab_t* s;
-    struct mem* mem;
+    uint8_t* obj;
     if (NULL == (s = buddy_alloc(PGSIZE))) {
         return NULL;  // No available memory in buddy allocator.
     }
-    memset(s, 0, PGSIZE);
-
-    // Add the new slab to the global slab list.
-    s->next = slab_head;
-    slab_head = s;
+    memset(s, 0, SLAB_HDR);
 
     // Initialize struct slab.
-    s->size = size;
-    mem = (struct mem*) ((uint8_t*) s + sizeof(*s));
-    s->freelist = mem;
-
-    for (i = 1; (uint8_t*) mem + size < (uint8_t*) s + PGSIZE; ++i) {
-        mem->next = (struct mem*) ((uint8_t*) s->freelist + i * size);
-        mem = mem->next;
+    s->cache = c;
+    s->magic = SLAB_MAGIC;
+
+    // An object must end inside the page : the next page may hold a buddy header.
+    s->total = (PGSIZE - c->offset) / c->stride;
+    for (i = s->total - 1; i >= 0; --i) {
+        obj = (uint8_t*) s + c->offset + i * c->stride;
+        if (c->ctor) {
+            c->ctor(obj);
+        }
+        LINK(c, obj) = s->freelist;
+        s->freelist = obj;
     }
 
+    c->grows++;
+    slab_list_push(&c->partial, s);
     return s;
 }
 
-static struct mem*
-_slab_alloc(slab_t* s) {
-    struct mem* mem;
-    mem = s->freelist;
-    s->freelist = s->freelist->next;
-    s->refcount++;
-    return mem;
+/*!
+ * @brief Create a named cache of objects : they stay constructed while free and are aligned to `align`.
+ * @param name is name shown in statistics.
+ * @param size is object bytes.
+ * @param align is object alignment, a power of 2 up to PGSIZE, e.g. CACHE_LINE.
+ * @param ctor is constructor run once per object when its memory is taken from the buddy allocator, NULL for
+ * none. Objects must be given back in the constructed state.
+ * @return cache, NULL on invalid arguments or no memory.
+ */
+kmem_cache_t*
+kmem_cache_create(const char* name, uint32_t size, uint32_t align, void (*ctor)(void*)) {
+    kmem_cache_t* c;
+    if (NULL == name || NULL == (c = kmalloc(sizeof(kmem_cache_t)))) {
+        return NULL;
+    }
+    if (0 != kmem_cache_setup(c, (const int8_t*) name, size, align, ctor)) {
+        kfree(c);
+        return NULL;
+    }
+    return c;
 }
 
+/*!
+ * @brief Allocate an object from a cache : a partial slab first, then an empty one, then a new page. Constant time.
+ * @param c is cache.
+ * @return constructed object, NULL if out of memory.
+ */
 void*
-slab_alloc(uint32_t size) {
-    slab_t* s = slab_head;
-    size = (size < MIN_SIZE) ? MIN_SIZE : GET_SLAB_SIZE(size);
-    while (s) {
-        if (s->freelist && size == s->size) {
-            goto SLAB_ALLOC;
+kmem_cache_alloc(kmem_cache_t* c) {
+    slab_t* s;
+    void* obj;
+
+    if (0 == c->offset) {
+        if (c->nstash) {
+            obj = c->stash[--c->nstash];
+        } else if (NULL != (obj = buddy_alloc(c->size))) {
+            BLOCK_OF(obj)->owner = c;
+            c->grows++;
+            if (c->ctor) {
+                c->ctor(obj);
+            }
+        } else {
+            c->fails++;
+            return NULL;
         }
-        s = s->next;
+        c->allocs++;
+        return obj;
     }
-    if (NULL == (s = slab_create(size))) {
-        return NULL;
+
+    if (NULL == (s = c->partial)) {
+        if (NULL != (s = c->empty)) {
+            slab_list_remove(&c->empty, s);
+            c->nempty--;
+            slab_list_push(&c->partial, s);
+        } else if (NULL == (s = slab_create(c))) {
+            c->fails++;
+            return NULL;
+        }
     }
 
-SLAB_ALLOC:
-    return (void*) _slab_alloc(s);
+    obj = s->freelist;
+    s->freelist = LINK(c, obj);
+    if (++s->refcount == s->total) {
+        slab_list_remove(&c->partial, s);
+        slab_list_push(&c->full, s);
+    }
+    c->allocs++;
+    return obj;
 }
 
+/*!
+ * @brief Give an object back to its cache. A slab that becomes empty is kept for the next allocation, beyond
+ * SLAB_EMPTY_MAX per cache its page goes back to the buddy allocator.
+ * @param c is cache the object came from.
+ * @param obj is object from `kmem_cache_alloc`, in its constructed state.
+ * @return 0 on success, -1 if `obj` is not an object of `c`.
+ */
 int32_t
-slab_free(void* mem) {
-    struct mem* m = mem;
-    slab_t** indirect = &slab_head;
-    slab_t* target;
+kmem_cache_free(kmem_cache_t* c, void* obj) {
+    slab_t* s = SLAB_OF(obj);
+    buddy_block_t* b;
 
-    for (; *indirect; indirect = &(*indirect)->next) {
-        if ((void*) (*indirect) > mem || (uint8_t*) (*indirect) + PGSIZE < (uint8_t*) mem) {
-            continue;
+    if (0 == c->offset) {
+        // Only a block this cache handed out : kfree'd memory or another cache's object is refused.
+        b = BLOCK_OF(obj);
+        if (START > b || END <= b || ((uint8_t*) b - (uint8_t*) START) % ALIGN || b->free || c != b->owner) {
+            return -1;
         }
-        if (0 == (*indirect)->refcount--) {
-            panic("slab double free!");
-        }
-        if (!(*indirect)->refcount) {
-            target = *indirect;
-            *indirect = (*indirect)->next;
-            buddy_free(target);
+        if (c->nstash < KMEM_STASH) {
+            c->stash[c->nstash++] = obj;
         } else {
-            m->next = (*indirect)->freelist;
-            (*indirect)->freelist = m;
+            b->owner = NULL;
+            buddy_free(obj);
+            c->shrinks++;
         }
+        c->frees++;
         return 0;
     }
 
-    return -1;
+    if ((uint8_t*) s < (uint8_t*) START || (uint8_t*) s >= (uint8_t*) END || SLAB_MAGIC != s->magic
+        || c != s->cache || (uint8_t*) obj < (uint8_t*) s + c->offset
+        || ((uint8_t*) obj - (uint8_t*) s - c->offset) % c->stride) {
+        return -1;
+    }
+    if (0 == s->refcount) {
+        panic("slab double free!");
+    }
+
+    if (s->refcount-- == s->total) {
+        slab_list_remove(&c->full, s);
+        slab_list_push(&c->partial, s);
+    }
+    LINK(c, obj) = s->freelist;
+    s->freelist = obj;
+    c->frees++;
+
+    if (0 == s->refcount) {
+        slab_list_remove(&c->partial, s);
+        if (c->nempty < SLAB_EMPTY_MAX) {
+            slab_list_push(&c->empty, s);
+            c->nempty++;
+        } else {
+            s->magic = 0;
+            buddy_free(s);
+            c->shrinks++;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief Allocate from the size class holding `size`.
+ * @param size is bytes needed, at most BUDDY_MIN.
+ * @return object, NULL if out of memory.
+ */
+void*
+slab_alloc(uint32_t size) {
+    size = (size < MIN_SIZE) ? MIN_SIZE : GET_SLAB_SIZE(size);
+    return kmem_cache_alloc(&slab_caches[SLAB_CLASS(size)]);
+}
+
+/*!
+ * @brief Give an object back to the cache of the slab holding it, found by masking the pointer.
+ * @param mem is object from `slab_alloc` or `kmem_cache_alloc`.
+ * @return 0 on success, -1 if `mem` is not a slab object.
+ */
+int32_t
+slab_free(void* mem) {
+    slab_t* s = SLAB_OF(mem);
+    if ((uint8_t*) s < (uint8_t*) START || (uint8_t*) s >= (uint8_t*) END || SLAB_MAGIC != s->magic) {
+        return -1;
+    }
+    return kmem_cache_free(s->cache, mem);
 }
 
 void*
@@ -343,10 +544,185 @@ kfree_range(void* start, void* end) {
     }
 }
 
+/*!
+ * @brief Free memory from `kmalloc`. Buddy blocks are page-aligned and slab objects never are, so the offset in the
+ * page picks the allocator without probing either.
+ * @param mem is pointer from `kmalloc`.
+ * @return 0 on success, 1 if `mem` was not allocated.
+ */
 int32_t
 kfree(void* mem) {
-    if (0 == slab_free(mem) || 0 == buddy_free(mem)) {
-        return 0;
+    if ((uint32_t) mem & (PGSIZE - 1)) {
+        return slab_free(mem) ? 1 : 0;
     }
-    return 1;
+    return buddy_free(mem);
+}
+
+// Statistics report, written by `kmem_stats`.
+static int8_t* stat_pos;
+static int8_t* stat_end;
+
+/*!
+ * @brief Append a string to the report, padded to a column.
+ * @param s is string.
+ * @param width is column width : right-aligned if positive, left-aligned if negative.
+ */
+static void
+stat_put(const int8_t* s, int32_t width) {
+    int32_t len = strlen(s);
+    int32_t pad = (width < 0 ? -width : width) - len;
+    if (width > 0) {
+        for (; pad > 0 && stat_pos < stat_end; --pad) { *stat_pos++ = ' '; }
+    }
+    for (; *s && stat_pos < stat_end; ++s) { *stat_pos++ = *s; }
+    for (; pad > 0 && stat_pos < stat_end; --pad) { *stat_pos++ = ' '; }
+}
+
+static void
+stat_num(uint32_t v, int32_t width) {
+    int8_t num[11];
+    stat_put(itoa(v, num, 10), width);
+}
+
+/*!
+ * @brief Write a compact report of the allocators : page frames, free blocks and bytes per buddy order, the largest
+ * free block, objects used per slab cache, and alloc/free/failure counts. Walks the slabs but never the buddy blocks.
+ * @param buf is buffer for the text, NUL-terminated.
+ * @param size is bytes in `buf`, at least 1.
+ * @return length of the text.
+ */
+int32_t
+kmem_stats(int8_t* buf, uint32_t size) {
+    kmem_cache_t* c;
+    slab_t* s;
+    uint32_t o, free = 0, largest = 0, n, used, total;
+
+    stat_pos = buf;
+    stat_end = buf + size - 1;
+    for (o = 0; o < BUDDY_ORDERS; ++o) {
+        if (buddy_allocator.nfree[o]) {
+            free += buddy_allocator.nfree[o] * (ALIGN << o);
+            largest = ALIGN << o;
+        }
+    }
+    stat_put("frames ", 0);
+    stat_num(frame_stats.ram * PGSIZE, 0);
+    stat_put(" bytes of RAM, ", 0);
+    stat_num(frame_stats.free * PGSIZE, 0);
+    stat_put(" free, ", 0);
+    stat_num(frame_stats.reserved * PGSIZE, 0);
+    stat_put(" kernel\nframes ", 0);
+    stat_num(frame_stats.allocs, 0);
+    stat_put(" allocs, ", 0);
+    stat_num(frame_stats.frees, 0);
+    stat_put(" frees, ", 0);
+    stat_num(frame_stats.fails, 0);
+    stat_put(" fails\n", 0);
+
+    stat_put("buddy ", 0);
+    stat_num((uint8_t*) END - (uint8_t*) START, 0);
+    stat_put(" bytes, ", 0);
+    stat_num(free, 0);
+    stat_put(" free, largest ", 0);
+    stat_num(largest, 0);
+    stat_put("\nbuddy ", 0);
+    stat_num(buddy_allocator.allocs, 0);
+    stat_put(" allocs, ", 0);
+    stat_num(buddy_allocator.frees, 0);
+    stat_put(" frees, ", 0);
+    stat_num(buddy_allocator.fails, 0);
+    stat_put(" fails\n", 0);
+
+    stat_put("   block  free     bytes\n", 0);
+    for (o = 0; o < BUDDY_ORDERS; ++o) {
+        if (buddy_allocator.nfree[o]) {
+            stat_num(ALIGN << o, 8);
+            stat_num(buddy_allocator.nfree[o], 6);
+            stat_num(buddy_allocator.nfree[o] * (ALIGN << o), 10);
+            stat_put("\n", 0);
+        }
+    }
+
+    stat_put("cache           size slabs    used   total  allocs   frees fails\n", 0);
+    for (c = kmem_caches; c; c = c->next) {
+        n = used = total = 0;
+        for (s = c->full; s; s = s->next, ++n) { used += s->refcount; total += s->total; }
+        for (s = c->partial; s; s = s->next, ++n) { used += s->refcount; total += s->total; }
+        for (s = c->empty; s; s = s->next, ++n) { total += s->total; }
+        if (0 == c->offset) {
+            n = c->grows - c->shrinks;  // Buddy blocks, one object each.
+            used = c->allocs - c->frees;
+            total = used + c->nstash;
+        }
+        stat_put(c->name, -KMEM_NAME_LEN);
+        stat_num(c->size, 4);
+        stat_num(n, 6);
+        stat_num(used, 8);
+        stat_num(total, 8);
+        stat_num(c->allocs, 8);
+        stat_num(c->frees, 8);
+        stat_num(c->fails, 6);
+        stat_put("\n", 0);
+    }
+    *stat_pos = '\0';
+    return stat_pos - buf;
+}
+
+static int8_t meminfo_buf[KMEM_STAT_SIZE];
+
+/**
+ * @brief read the allocator statistics, taken afresh at every read
+ * @param file - file struct of "meminfo"
+ * @param buf - user buffer
+ * @param nbytes - bytes to read
+ * @return ** int32_t bytes read, 0 at the end of the report
+ */
+static int32_t
+meminfo_read(file_t* file, void* buf, int32_t nbytes) {
+    int32_t len = kmem_stats(meminfo_buf, KMEM_STAT_SIZE);
+    if (nbytes < 0) return -1;
+    if (file->pos >= len) return 0;
+    if (nbytes > len - (int32_t) file->pos) nbytes = len - file->pos;
+    memcpy(buf, meminfo_buf + file->pos, nbytes);
+    file->pos += nbytes;
+    return nbytes;
+}
+
+/**
+ * @brief "meminfo" is read-only
+ * @return ** int32_t always -1
+ */
+static int32_t
+meminfo_write(file_t* file, const void* buf, int32_t nbytes) {
+    return -1;
+}
+
+/**
+ * @brief close "meminfo"
+ * @param file - file struct
+ * @return ** int32_t always 0
+ */
+static int32_t
+meminfo_close(file_t* file) {
+    file->flags = F_CLOSE;
+    file->pos = 0;
+    return 0;
+}
+
+/**
+ * @brief open the pseudo-file "meminfo" : a text report of the allocators, see kmem_stats
+ * @param file - file struct to set
+ * @param fname - dumped
+ * @param dump - dumped
+ * @return ** int32_t always 0
+ */
+int32_t
+meminfo_open(file_t* file, const uint8_t* fname, int32_t dump) {
+    file->flags = DESCRIPTOR_ENTRY_MEMINFO | F_OPEN;
+    file->fops.write = meminfo_write;
+    file->fops.read = meminfo_read;
+    file->fops.close = meminfo_close;
+    file->pos = 0;
+    file->inode = -1;
+    return 0;
 }
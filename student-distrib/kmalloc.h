@@ -4,35 +4,87 @@
 #include "lib.h"
 #include "mmu.h"
 
-#define MEM_MAGIC       0xA5
 #define MIN_SIZE        0x8
 #define BUDDY_MIN       (1U << 11)
-#define BUDDY_START     (1U << 26)
-#define BUDDY_SIZE      (1U << 25)
+#define BUDDY_SIZE      (1U << 25)  // Kernel heap, taken from the page frame allocator at boot.
+#define BUDDY_SIZE_MIN  (1U << 22)  // ... or the largest power of 2 that fits, down to this.
+#define BUDDY_ORDERS    32
 
 typedef struct buddy_block {
     uint32_t size;
     bool free;
+    struct kmem_cache* owner;  // Cache of an object larger than a slab, NULL for kmalloc and slab pages.
+    struct buddy_block* prev;  // Free list of its order, only while free.
+    struct buddy_block* next;
 } buddy_block_t;
 
 struct {
     buddy_block_t* start;
     buddy_block_t* end;
     uint32_t align;
+    buddy_block_t* free_list[BUDDY_ORDERS];  // Free blocks of `align << order` bytes.
+    uint32_t nfree[BUDDY_ORDERS];            // ... and how many.
+    // Statistics since `buddy_init`.
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t fails;                          // Allocations that found no block large enough.
 } buddy_allocator;
 
-struct mem {
-    struct mem* next;
-};
+#define SLAB_MAGIC      0x51AB51AB
+#define SLAB_CLASSES    9           // Object sizes MIN_SIZE (8) ... BUDDY_MIN (2048).
+#define SLAB_EMPTY_MAX  1           // Empty slabs a cache keeps before pages go back to the buddy allocator.
+#define CACHE_LINE      64
+#define KMEM_NAME_LEN   16
+#define KMEM_STASH      8           // Freed objects a cache of objects larger than a slab keeps.
+#define KMEM_STAT_SIZE  4096        // Longest statistics report.
 
+struct kmem_cache;
+
+// One PGSIZE page from the buddy allocator : this header, then objects. Found from an object by masking.
 typedef struct slab {
-    struct mem* freelist;
-    struct slab* next;
-    uint32_t refcount;
-    uint32_t size;
+    void* freelist;         // First free object, the next one is stored at its cache's `link`.
+    struct slab* next;      // List of its cache : full, partial or empty.
+    struct slab* prev;
+    uint32_t refcount;      // Objects in use.
+    struct kmem_cache* cache;
+    uint32_t total;         // Objects in the page.
+    uint32_t magic;
 } slab_t;
 
-slab_t* slab_head;
+#define SLAB_HDR        ((sizeof(slab_t) + 31) & ~31)  // Objects start here in a slab page : 32 bytes or more.
+
+/*
+ * A cache of objects of one size : slabs by how many of their objects are free. With a constructor, objects are
+ * built once when their slab is made and must be freed in their constructed state; the free-list link then sits
+ * past the object so it doesn't overwrite it. Objects that don't fit a slab are buddy blocks, a few freed ones kept.
+ */
+typedef struct kmem_cache {
+    int8_t name[KMEM_NAME_LEN];
+    uint32_t size;          // Object bytes.
+    uint32_t align;
+    uint32_t stride;        // Bytes from one object to the next in a slab.
+    uint32_t link;          // Offset of the free-list link in a free object.
+    uint32_t offset;        // First object in a slab, 0 : objects are buddy blocks.
+    void (*ctor)(void* obj);
+    slab_t* full;
+    slab_t* partial;
+    slab_t* empty;
+    uint32_t nempty;
+    void* stash[KMEM_STASH];
+    uint32_t nstash;
+    // Statistics since the cache was created.
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t fails;         // Allocations that found no memory.
+    uint32_t grows;         // Slabs (or buddy blocks) taken from the buddy allocator.
+    uint32_t shrinks;       // ... and given back.
+    struct kmem_cache* next;  // All caches, from kmem_caches.
+} kmem_cache_t;
+
+typedef kmem_cache_t slab_cache_t;
+
+slab_cache_t slab_caches[SLAB_CLASSES];  // The size classes of kmalloc.
+kmem_cache_t* kmem_caches;
 
 uint32_t buddy_cnt;
 uint32_t slab_cnt;
@@ -42,13 +94,18 @@ int32_t kfree(void* mem);
 void buddy_init(void* mem, uint32_t size, uint32_t alignment);
 buddy_block_t* buddy_search(uint32_t size);
 buddy_block_t* buddy_split(buddy_block_t* b, uint32_t size);
-void buddy_coalesce(void);
 void* buddy_alloc(uint32_t size);
 int32_t buddy_free(void* mem);
-slab_t* slab_create(uint32_t size);
+void slab_init(void);
+slab_t* slab_create(kmem_cache_t* c);
 void* slab_alloc(uint32_t size);
 int32_t slab_free(void* mem);
 void slab_traverse(void);
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align, void (*ctor)(void*));
+void* kmem_cache_alloc(kmem_cache_t* c);
+int32_t kmem_cache_free(kmem_cache_t* c, void* obj);
+int32_t kmem_stats(int8_t* buf, uint32_t size);
+int32_t meminfo_open(file_t* file, const uint8_t* fname, int32_t dump);
 
 // DEBUG
 int32_t buddy_traverse(void);
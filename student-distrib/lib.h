@@ -67,6 +67,34 @@ lcr3(uint32_t val)
     asm volatile("movl %0, %%cr3" : : "r" (val));
 }
 
+/* Reads register `cr2` : the linear address of the last page fault. */
+static inline uint32_t
+rcr2(void)
+{
+    uint32_t val;
+    asm volatile("movl %%cr2, %0" : "=r" (val));
+    return val;
+}
+
+/* Reads the low 32 bits of the time-stamp counter. Used for benchmarks,
+ * wraps after about one second so only time short spans with it. */
+static inline uint32_t
+rdtsc(void)
+{
+    uint32_t lo;
+    asm volatile("rdtsc" : "=a" (lo) : : "edx");
+    return lo;
+}
+
+/* Returns the index of the lowest set bit of a non-zero value (bsf). */
+static inline uint32_t
+bsf(uint32_t val)
+{
+    uint32_t idx;
+    asm("bsfl %1, %0" : "=r" (idx) : "rm" (val) : "cc");
+    return idx;
+}
+
 /* Port read functions */
 /* Inb reads a byte and returns its value as a zero-extended 32-bit
  * unsigned int */
@@ -134,13 +162,31 @@ do {                                    \
 /* Writes four bytes to four consecutive ports */
 #define outl(data, port)                \
 do {                                    \
-    asm volatile ("outl %l1, (%w0)"     \
+    asm volatile ("outl %k1, (%w0)"     \
             :                           \
             : "d"(port), "a"(data)      \
             : "memory", "cc"            \
     );                                  \
 } while (0)
 
+/* Reads "count" words from a port into buf with one rep insw */
+static inline void insw(uint32_t port, void* buf, uint32_t count) {
+    asm volatile ("cld; rep insw"
+            : "+D"(buf), "+c"(count)
+            : "d"(port)
+            : "memory", "cc"
+    );
+}
+
+/* Writes "count" words from buf to a port with one rep outsw */
+static inline void outsw(uint32_t port, const void* buf, uint32_t count) {
+    asm volatile ("cld; rep outsw"
+            : "+S"(buf), "+c"(count)
+            : "d"(port)
+            : "memory", "cc"
+    );
+}
+
 /* Clear interrupt flag - disables interrupts on this processor */
 #define cli()                           \
 do {                                    \
@@ -31,6 +31,10 @@
 #define PAGE_PS         (1L << 7)           // Page size (0 indicates 4 KB)
 #define PAGE_PAT        (1L << 7)           // Page table attribute index
 #define PAGE_G          (1L << 8)           // Global page
+#define PAGE_COW        (1L << 9)           // Available to software : copy on write
+#define PAGE_OWN        (1L << 10)          // Available to software : private copy, freed on unmap
+#define PF_P            (1L << 0)           // Page fault error code : page was present
+#define PF_W            (1L << 1)           // Page fault error code : write access
 #define VIDEO           0xB8000             // Copied from `lib.c`.
 #define VIDEO_SIZE      (4<<10)             // each video buffer size : 4KB
 #define VGA_START       (0xA0000)            // start of VGA
@@ -57,6 +61,10 @@
 #define UVM_START   0x08000000  // Starting virtual address of user memory.
 #define IMG_START   0x08048000  // Starting address of program image.
 #define UVM_SIZE    0x400000    // 4MB.
+#define MMAP_START  (UVM_START + 2 * UVM_SIZE)  // File mappings, after the video page : 136MB.
+#define MMAP_PAGES  1024        // One page table of file mappings per process.
+#define MMAP_MAX    8           // File mappings per process.
+#define MMAP_COW_PAGES 16       // Largest private (copy-on-write) mapping : 64KB.
 
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
@@ -69,6 +77,15 @@ void vm_init(void);
 /* Map one extended page for user program. */
 extern int32_t uvmmap_ext(uint32_t pa);
 
+/* Map the program page of a process, text shared through the program image cache, and load the program. */
+extern int32_t uvmmap_prog(uint32_t pid, const uint8_t* prog_name);
+
+/* Update the program page mapping before context switch. */
+extern int32_t uvmremap_prog(uint32_t pid);
+
+/* Drop the program page table and shared text of a process. */
+extern void uvmfree_prog(uint32_t pid);
+
 /* Map terminal buffer to correct starting address */
 extern int32_t uvmmap_tbuf(uint32_t tbufa);
 
@@ -81,4 +98,19 @@ extern int32_t uvmunmap_vid(void);
 /* Update user video memory mapping before context switch. */
 extern int32_t uvmremap_vid(uint32_t pid);
 
+/* Map the data blocks of a file into user space and send back address. */
+extern int32_t uvmmap_file(uint32_t inode, uint32_t length, uint32_t cow, uint8_t** start);
+
+/* Undo one file mapping. */
+extern int32_t uvmunmap_file(uint8_t* start);
+
+/* Update user file mappings before context switch. */
+extern int32_t uvmremap_file(uint32_t pid);
+
+/* Drop every file mapping of a process. */
+extern void uvmfree_file(uint32_t pid);
+
+/* Resolve a page fault on a copy-on-write page. */
+extern int32_t do_page_fault(uint32_t err);
+
 #endif /* _MMU_H */
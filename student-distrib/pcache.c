@@ -0,0 +1,268 @@
+/**
+ * @file pcache.c
+ * @brief Program image cache. The ELF headers of a program are parsed on its
+ * first exec; its read-only text segment is read once into page frames that
+ * every process running the program maps read-only at IMG_START. An exec then
+ * only copies the writable segments (data) and zeroes bss in the process's own
+ * 4 MB page. The frames come from the page frame allocator : the entry holds
+ * one reference and every process mapping them another. A write to the file,
+ * or its removal, drops the entry and its references; processes still running
+ * the old text keep its frames until they exit. A file that is not a usable
+ * ELF (or a full cache) falls back to copying the whole file.
+ */
+#include "pcache.h"
+#include "filesystem.h"
+#include "frame.h"
+#include "process.h"
+#include "lib.h"
+#include "pit.h"
+
+#define ELF_PT_LOAD   1
+#define ELF_PF_W      2
+#define ELF_PHDR_MAX  16
+
+/* the fields of the ELF header the loader looks at, 52 Bytes */
+typedef struct elf32_ehdr {
+    uint8_t  ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} elf32_ehdr_t;
+
+/* program header, 32 Bytes */
+typedef struct elf32_phdr {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} elf32_phdr_t;
+
+static pcache_ent_t progs[PCACHE_PROGS];
+static uint32_t t_exec;     /* rdtsc when the current exec started */
+
+pcache_stats_t pcache_stats;
+
+/**
+ * @brief drop the references of an entry to its text frames
+ * @param e - entry
+ * @return ** void
+ */
+static void
+pcache_free(pcache_ent_t* e) {
+    uint32_t i;
+    for (i = 0; i < e->npages; i++) {
+        frame_put(e->text[i]);
+    }
+    e->npages = 0;
+    e->valid = 0;
+}
+
+/**
+ * @brief parse the ELF headers of a file into an entry : one read-only
+ * PT_LOAD at file offset 0 and IMG_START is the text, every other PT_LOAD is
+ * copied at exec. Segments must stay inside the program page.
+ * @param e - entry to fill (text frames not read yet)
+ * @param inode - regular file
+ * @return ** int32_t 0 on success
+ * -1 if the file can't be loaded this way
+ */
+static int32_t
+pcache_parse(pcache_ent_t* e, uint32_t inode) {
+    elf32_ehdr_t eh;
+    elf32_phdr_t ph[ELF_PHDR_MAX];
+    uint32_t i, len = fs.flength[inode], text = 0, first;
+    if (sizeof(eh) != fs.f_rw.read_data(inode, 0, (uint8_t*) &eh, sizeof(eh))) return -1;
+    if (eh.ident[0] != 0x7f || eh.ident[1] != 'E' || eh.ident[2] != 'L' || eh.ident[3] != 'F'
+        || eh.phentsize != sizeof(elf32_phdr_t) || eh.phnum == 0 || eh.phnum > ELF_PHDR_MAX) return -1;
+    if (eh.phnum * sizeof(elf32_phdr_t) != fs.f_rw.read_data(inode, eh.phoff, (uint8_t*) ph, eh.phnum * sizeof(elf32_phdr_t))) return -1;
+    e->nseg = 0;
+    for (i = 0; i < eh.phnum; i++) {
+        if (ph[i].type != ELF_PT_LOAD) continue;
+        if (ph[i].vaddr < IMG_START || ph[i].memsz < ph[i].filesz || ph[i].memsz > UVM_START + UVM_SIZE - ph[i].vaddr
+            || ph[i].filesz > len || ph[i].offset > len - ph[i].filesz) return -1;
+        if (!text && !(ph[i].flags & ELF_PF_W) && ph[i].offset == 0 && ph[i].vaddr == IMG_START
+            && ph[i].filesz == ph[i].memsz) {
+            text = 1;
+            e->text_len = ph[i].filesz;
+            continue;
+        }
+        if (e->nseg == PCACHE_SEGS) return -1;
+        e->seg[e->nseg].offset = ph[i].offset;
+        e->seg[e->nseg].vaddr = ph[i].vaddr;
+        e->seg[e->nseg].filesz = ph[i].filesz;
+        e->seg[e->nseg].memsz = ph[i].memsz;
+        e->nseg++;
+    }
+    if (!text || e->text_len > PCACHE_TEXT_PAGES * PGSIZE) return -1;
+    /* a page shared with a copied segment must be the process's own */
+    e->npages = PGROUNDUP(e->text_len) / PGSIZE;
+    for (i = 0; i < e->nseg; i++) {
+        first = (PGROUNDDOWN(e->seg[i].vaddr) - IMG_START) / PGSIZE;
+        if (first < e->npages) e->npages = first;
+    }
+    e->entry = eh.entry;
+    return 0;
+}
+
+/**
+ * @brief find the image of a program, reading its text on the first exec.
+ * Starts timing the exec, pcache_load ends it.
+ * @param inode - program file
+ * @return ** pcache_ent_t* entry with one more user, release with pcache_put
+ * NULL if the file is not a usable ELF or every entry is in use : copy it flat
+ */
+pcache_ent_t*
+pcache_get(uint32_t inode) {
+    pcache_ent_t *e, *victim = NULL;
+    uint32_t i, n, len;
+    t_exec = rdtsc();
+    pcache_stats.execs++;
+    for (i = 0; i < PCACHE_PROGS; i++) {
+        e = &progs[i];
+        if (e->valid && e->inode == inode) {
+            e->refs++;
+            e->last_use = pcache_stats.execs;
+            pcache_stats.hits++;
+            return e;
+        }
+        /* a free slot first, then the least recently used idle one */
+        if (e->refs == 0 && (victim == NULL || (victim->valid && (!e->valid || e->last_use < victim->last_use)))) {
+            victim = e;
+        }
+    }
+    if (victim == NULL) return NULL;
+    if (victim->valid) {
+        pcache_free(victim);
+        pcache_stats.evictions++;
+    }
+    e = victim;
+    if (pcache_parse(e, inode)) {
+        e->npages = 0;
+        return NULL;
+    }
+    for (n = 0; n < e->npages; n++) {
+        if (0 == (e->text[n] = frame_alloc())) break;
+        len = e->text_len - n * PGSIZE;
+        if (len > PGSIZE) len = PGSIZE;
+        if (len != fs.f_rw.read_data(inode, n * PGSIZE, (uint8_t*) e->text[n], len)) {
+            frame_put(e->text[n]);
+            break;
+        }
+        memset((uint8_t*) e->text[n] + len, 0, PGSIZE - len);
+    }
+    if (n != e->npages) {
+        e->npages = n;
+        pcache_free(e);
+        return NULL;
+    }
+    e->inode = inode;
+    e->valid = 1;
+    e->refs = 1;
+    e->last_use = pcache_stats.execs;
+    pcache_stats.misses++;
+    return e;
+}
+
+/**
+ * @brief a process running the program exits
+ * @param e - entry from pcache_get
+ * @return ** void
+ */
+void
+pcache_put(pcache_ent_t* e) {
+    if (e == NULL || e->refs == 0) return;
+    e->refs--;
+}
+
+/**
+ * @brief fill the private part of the program page, which must be mapped :
+ * text past the shared pages, then every copied segment with its bss zeroed.
+ * Without an entry the whole file is copied to IMG_START.
+ * @param e - entry from pcache_get, NULL : flat copy
+ * @param inode - program file
+ * @return ** int32_t 0 on success
+ * -1 on a read error or a file too large
+ */
+int32_t
+pcache_load(pcache_ent_t* e, uint32_t inode) {
+    uint32_t i, off, len, khz;
+    int32_t ret = 0;
+    if (e == NULL) {
+        pcache_stats.flat++;
+        len = fs.flength[inode];
+        if (len > PROG_SIZE - (IMG_START - UVM_START)
+            || len != fs.f_rw.read_data(inode, 0, (uint8_t*) IMG_START, len)) ret = -1;
+        pcache_stats.bytes_copied += len;
+    } else {
+        off = e->npages * PGSIZE;
+        if (e->text_len > off) {
+            len = e->text_len - off;
+            if (len != fs.f_rw.read_data(inode, off, (uint8_t*) IMG_START + off, len)) ret = -1;
+            pcache_stats.bytes_copied += len;
+        }
+        for (i = 0; i < e->nseg; i++) {
+            if (e->seg[i].filesz && e->seg[i].filesz != fs.f_rw.read_data(inode, e->seg[i].offset,
+                                                                           (uint8_t*) e->seg[i].vaddr, e->seg[i].filesz)) {
+                ret = -1;
+            }
+            memset((uint8_t*) e->seg[i].vaddr + e->seg[i].filesz, 0, e->seg[i].memsz - e->seg[i].filesz);
+            pcache_stats.bytes_copied += e->seg[i].memsz;
+        }
+    }
+    /* one load fits in 32 bits of cycles, the sum over all execs does not */
+    khz = pit_tsc_khz();
+    pcache_stats.us_last = khz >= 1000 ? (rdtsc() - t_exec) / (khz / 1000) : 0;
+    pcache_stats.us_total += pcache_stats.us_last;
+    return ret;
+}
+
+/**
+ * @brief the file changed : the next exec reads it again. The slot is reused
+ * once nobody runs the old text, its frames go with the last mapping.
+ * @param inode - file written or removed
+ * @return ** void
+ */
+void
+pcache_invalidate(uint32_t inode) {
+    uint32_t i;
+    for (i = 0; i < PCACHE_PROGS; i++) {
+        if (progs[i].valid && progs[i].inode == inode) pcache_free(&progs[i]);
+    }
+}
+
+/**
+ * @brief print cache counters and exec load latency
+ * @return ** void
+ */
+void
+pcache_print_stats(void) {
+    uint32_t i, progs_n = 0, pages = 0, khz = pit_tsc_khz();
+    for (i = 0; i < PCACHE_PROGS; i++) {
+        if (progs[i].valid) {
+            progs_n++;
+            pages += progs[i].npages;
+        }
+    }
+    printf("pcache : %d programs, %d text pages, %d execs, %d hits, %d misses, %d flat, %d evictions\n",
+           progs_n, pages, pcache_stats.execs, pcache_stats.hits, pcache_stats.misses,
+           pcache_stats.flat, pcache_stats.evictions);
+    if (khz >= 1000 && pcache_stats.execs) {
+        printf("pcache : load avg %d us last %d us, %d bytes copied\n",
+               pcache_stats.us_total / pcache_stats.execs, pcache_stats.us_last,
+               pcache_stats.bytes_copied);
+    }
+}
@@ -0,0 +1,52 @@
+/* program image cache : ELF headers and read-only text pages shared by every process running a program */
+#ifndef _PCACHE_H
+#define _PCACHE_H
+
+#include "types.h"
+
+#define PCACHE_PROGS      8    /* programs kept */
+#define PCACHE_TEXT_PAGES 64   /* largest shared text : 256 KB */
+#define PCACHE_SEGS       4    /* writable segments copied at each exec */
+
+/* a writable PT_LOAD segment : filesz bytes from offset go to vaddr, the rest up to memsz is zeroed */
+typedef struct pcache_seg {
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t filesz;
+    uint32_t memsz;
+} pcache_seg_t;
+
+typedef struct pcache_ent {
+    uint32_t inode;
+    uint32_t valid;                     /* 0 : free, or dropped by a write and reused when unused */
+    uint32_t refs;                      /* processes running the program */
+    uint32_t last_use;                  /* pcache_stats.execs at the last exec, for LRU */
+    uint32_t entry;                     /* e_entry */
+    uint32_t text_len;                  /* bytes of the text segment, loaded at IMG_START */
+    uint32_t npages;                    /* pages of text shared from IMG_START, the rest is copied */
+    uint32_t text[PCACHE_TEXT_PAGES];   /* page frames of the shared pages, one reference each */
+    uint32_t nseg;
+    pcache_seg_t seg[PCACHE_SEGS];
+} pcache_ent_t;
+
+/* counters, since boot */
+typedef struct pcache_stats {
+    uint32_t execs;         /* programs loaded */
+    uint32_t hits;          /* text found in the cache */
+    uint32_t misses;        /* text read from the file system */
+    uint32_t flat;          /* not a usable ELF : whole file copied */
+    uint32_t evictions;
+    uint32_t bytes_copied;  /* data/bss copied or zeroed at exec */
+    uint32_t us_total;      /* microseconds spent loading, summed over execs */
+    uint32_t us_last;
+} pcache_stats_t;
+
+extern pcache_stats_t pcache_stats;
+
+extern pcache_ent_t* pcache_get(uint32_t inode);
+extern void          pcache_put(pcache_ent_t* e);
+extern int32_t       pcache_load(pcache_ent_t* e, uint32_t inode);
+extern void          pcache_invalidate(uint32_t inode);
+extern void          pcache_print_stats(void);
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @file pci.c
+ * @brief PCI configuration space access through ports 0xCF8/0xCFC, enough
+ * to find a device by class and read/write its registers.
+ */
+#include "pci.h"
+#include "lib.h"
+
+/**
+ * @brief read a dword of a device's configuration space
+ * @param bdf - PCI_BDF(bus, device, function)
+ * @param reg - register offset, dword aligned
+ * @return ** uint32_t register value, 0xFFFFFFFF if no device answers
+ */
+uint32_t
+pci_read32(uint32_t bdf, uint32_t reg) {
+    outl(0x80000000 | bdf | (reg & 0xFC), PCI_CONFIG_ADDRESS);
+    return inl(PCI_CONFIG_DATA);
+}
+
+/**
+ * @brief write a dword of a device's configuration space
+ * @param bdf - PCI_BDF(bus, device, function)
+ * @param reg - register offset, dword aligned
+ * @param val - value to write
+ * @return ** void
+ */
+void
+pci_write32(uint32_t bdf, uint32_t reg, uint32_t val) {
+    outl(0x80000000 | bdf | (reg & 0xFC), PCI_CONFIG_ADDRESS);
+    outl(val, PCI_CONFIG_DATA);
+}
+
+/**
+ * @brief brute-force scan of bus 0-255 for the first device of a class
+ * @param class - base class (e.g. 0x01 mass storage)
+ * @param subclass - sub class (e.g. 0x01 IDE)
+ * @return ** uint32_t PCI_BDF of the device, PCI_NONE if there is none
+ */
+uint32_t
+pci_find_class(uint32_t class, uint32_t subclass) {
+    uint32_t bus, dev, fn, bdf, nfn, cls;
+    for (bus = 0; bus < 256; bus++) {
+        for (dev = 0; dev < 32; dev++) {
+            if ((pci_read32(PCI_BDF(bus, dev, 0), PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) continue;
+            /* multi-function devices (the PIIX bridge is one) answer on 8 functions */
+            nfn = (pci_read32(PCI_BDF(bus, dev, 0), PCI_HEADER_TYPE) & 0x800000) ? 8 : 1;
+            for (fn = 0; fn < nfn; fn++) {
+                bdf = PCI_BDF(bus, dev, fn);
+                if ((pci_read32(bdf, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) continue;
+                cls = pci_read32(bdf, PCI_CLASS_REVISION);
+                if ((cls >> 24) == class && ((cls >> 16) & 0xFF) == subclass) return bdf;
+            }
+        }
+    }
+    return PCI_NONE;
+}
@@ -0,0 +1,29 @@
+/* PCI configuration space access (mechanism #1, ports 0xCF8/0xCFC) */
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "types.h"
+
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+/* configuration space registers */
+#define PCI_VENDOR_ID       0x00
+#define PCI_COMMAND         0x04
+#define PCI_CLASS_REVISION  0x08
+#define PCI_HEADER_TYPE     0x0C    /* byte 2 of the dword */
+#define PCI_BAR4            0x20
+
+#define PCI_COMMAND_IO      0x0001
+#define PCI_COMMAND_MASTER  0x0004  /* device may initiate bus-master DMA */
+
+#define PCI_NONE            0xFFFFFFFF
+
+/* bus/device/function packed the way CONFIG_ADDRESS wants it */
+#define PCI_BDF(bus, dev, fn)   (((bus) << 16) | ((dev) << 11) | ((fn) << 8))
+
+extern uint32_t pci_read32(uint32_t bdf, uint32_t reg);
+extern void     pci_write32(uint32_t bdf, uint32_t reg, uint32_t val);
+extern uint32_t pci_find_class(uint32_t class, uint32_t subclass);
+
+#endif
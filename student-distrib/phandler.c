@@ -21,6 +21,7 @@
 #include "process.h"
 #include "signal.h"
 #include "sb16.h"
+#include "ata.h"
 
 #define SCROLL_SCREEN_ENABLE 0
 
@@ -155,6 +156,9 @@ do_interrupt(old_ireg_t *oldregs) {
         case 0x0C:
             psmouse_handler();
             break;
+        case 0x0E:
+            ata_handler();
+            break;
         default:
             printf("unknown interrupt %d\n", interrupt_index);
             break;
@@ -174,4 +178,5 @@ install_interrupt_hanlder() {
     SET_IDT_ENTRY(idt[0x25], interrupt_handler_jump_table[2]);
     SET_IDT_ENTRY(idt[0x28], interrupt_handler_jump_table[3]);
     SET_IDT_ENTRY(idt[0x2C], interrupt_handler_jump_table[4]);
+    SET_IDT_ENTRY(idt[0x2E], interrupt_handler_jump_table[5]);
 }
@@ -1,4 +1,5 @@
 #include "pit.h"
+#include "ata.h"
 
 void
 pit_init(void) {
@@ -14,8 +15,35 @@ pit_init(void) {
     enable_irq(PIT_IRQ);
 }
 
+/*!
+ * @brief Measure the time-stamp counter frequency against PIT channel 2 by polling,
+ * so it works with interrupts off. The result is cached after the first call.
+ * @param None.
+ * @return TSC ticks per millisecond.
+ */
+uint32_t
+pit_tsc_khz(void) {
+    static uint32_t khz = 0;
+    uint32_t latch = PIT_FREQ / (1000 / CALIB_MS);
+    uint32_t t0;
+
+    if (khz) { return khz; }
+
+    // Gate channel 2 on, keep the speaker off.
+    outb((inb(PIT_GATE) & ~0x02) | 0x01, PIT_GATE);
+    outb(PIT_BIN | PIT_ONESHOT | PIT_LH | PIT_CH2, PIT_CMD);
+    outb(latch, PIT_CH2_DATA);
+    outb(latch >> 8, PIT_CH2_DATA);
+
+    t0 = rdtsc();
+    while (!(inb(PIT_GATE) & 0x20));  // Output goes high at terminal count.
+    khz = (rdtsc() - t0) / CALIB_MS;
+    return khz;
+}
+
 void
 pit_handler(void) {
     send_eoi(PIT_IRQ);
+    fs_flush_tick(1000 / SCHED_FREQ);  // Only marks a commit due, it runs on the way back to user space.
     scheduler();
 }
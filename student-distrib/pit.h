@@ -10,6 +10,11 @@
 #define PIT_LH      (0x3 << 4)  // Access mode: lobyte/hibyte.
 #define PIT_CH0     (0x0 << 6)  // Channel 0.
 #define SCHED_FREQ  100         // Scheduled frequency: 100 Hz.
+#define PIT_CH2_DATA 0x42       // Channel 2 data port, gated through port 0x61.
+#define PIT_GATE    0x61        // Bit 0 : channel 2 gate, bit 1 : speaker, bit 5 : channel 2 output.
+#define PIT_CH2     (0x2 << 6)  // Channel 2.
+#define PIT_ONESHOT (0x0 << 1)  // Operating mode: Interrupt on terminal count.
+#define CALIB_MS    10          // Length of the TSC calibration window.
 
 #include "types.h"
 #include "i8259.h"
@@ -20,5 +25,6 @@
 
 void pit_init(void);
 void pit_handler(void);
+uint32_t pit_tsc_khz(void);
 
 #endif
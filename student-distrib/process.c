@@ -16,16 +16,40 @@
 #include "mmu.h"
 #include "err.h"
 #include "tests.h"
+#include "kmalloc.h"
 
 uint32_t top_pcb = PCB_BASE;
 uint8_t  run_as_base=1;
+static kmem_cache_t* file_table_cache; /* open file tables, cache-line aligned */
+
+/**
+ * @brief constructor of the file table cache : every entry closed
+ * @param obj - table of FILE_ARRAY_MAX entries
+ * @return ** void
+ */
+static void
+file_table_ctor(void* obj){
+    file_t* table=obj;
+    int32_t i;
+    for(i=0;i<FILE_ARRAY_MAX;i++){
+        table[i].flags=0;
+        table[i].inode=-1;
+        table[i].pos=0;
+    }
+}
 
 void init_pcb(){
     int32_t i;
+    file_table_cache=kmem_cache_create("file_table",FILE_ARRAY_MAX*sizeof(file_t),CACHE_LINE,file_table_ctor);
     for(i=1;i<=PCB_MAX;i++){
         pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-i*PCB_SIZE);
         _pcb_ptr->state=UNUSED;
         _pcb_ptr->vidmap=0;
+        _pcb_ptr->mmap_pt=NULL;
+        _pcb_ptr->prog_pa=0;
+        _pcb_ptr->img_pt=NULL;
+        _pcb_ptr->img=NULL;
+        _pcb_ptr->file_entry=NULL;
     }
 }
 
@@ -108,12 +132,7 @@ init_terminal(pcb_t* _pcb_ptr, int32_t i){
  * @return ** int32_t always 0
  */
 static int32_t clean_up_fda(pcb_t* _pcb_ptr){
-    int32_t i;
-    for(i=0;i<FILE_ARRAY_MAX;i++){
-        _pcb_ptr->file_entry[i].flags=0;
-        _pcb_ptr->file_entry[i].inode=-1;
-        _pcb_ptr->file_entry[i].pos=0;
-    }
+    file_table_ctor(_pcb_ptr->file_entry);
     return 0;
 }
 
@@ -159,7 +178,13 @@ pcb_open(uint32_t ppid,uint32_t pid,const uint8_t* prog_name){
     if(ppid!=0){
         PCB(ppid)->state=SLEEPING;
     }
+    /* a table left by a failed open is reused */
+    if(_pcb_ptr->file_entry==NULL && NULL==(_pcb_ptr->file_entry=kmem_cache_alloc(file_table_cache))){
+        return -1;
+    }
     clean_up_fda(_pcb_ptr);
+    _pcb_ptr->mmap_pt=NULL;
+    memset(_pcb_ptr->mmap_pages,0,sizeof(_pcb_ptr->mmap_pages));
     init_terminal(_pcb_ptr,0);
     init_terminal(_pcb_ptr,1);
 
@@ -289,6 +314,38 @@ get_file_entry(uint32_t fd){
     return &(_pcb_ptr->file_entry[fd]);
 }
 
+/**
+ * @brief undo an exec that failed after pcb_create : the child goes back to
+ * unused with its file table and program page released, and the parent runs
+ * again with its own user pages installed
+ * @param pid - child being set up
+ * @return ** void
+ */
+void
+pcb_abort(uint32_t pid){
+    pcb_t* _pcb_ptr=PCB(pid);
+    uint32_t ppid=_pcb_ptr->ppid;
+    int32_t i;
+    _pcb_ptr->state=UNUSED;
+    if(_pcb_ptr->file_entry!=NULL){
+        for(i=0;i<2;i++){
+            if((_pcb_ptr->file_entry[i].flags&F_OPEN)&&_pcb_ptr->file_entry[i].fops.close!=NULL)
+                _pcb_ptr->file_entry[i].fops.close(&_pcb_ptr->file_entry[i]);
+        }
+        clean_up_fda(_pcb_ptr); /* back to the constructed state */
+        kmem_cache_free(file_table_cache,_pcb_ptr->file_entry);
+        _pcb_ptr->file_entry=NULL;
+    }
+    uvmfree_prog(pid);
+    if((PCB_BASE-pid*PCB_SIZE)==top_pcb)
+        top_pcb+=PCB_SIZE;
+    if(ppid!=0){
+        PCB(ppid)->state=RUNNING;
+        uvmremap_prog(ppid);
+        uvmremap_file(ppid);
+    }
+}
+
 /**
  * @brief Discard the current process given pid and return status
  * 
@@ -315,6 +372,9 @@ discard_proc(uint32_t pid,uint32_t status){
     _pcb_ptr->state=UNUSED; /* turn off old pcb */
     _pcb_ptr->file_entry[0].fops.close(&_pcb_ptr->file_entry[0]);
     _pcb_ptr->file_entry[1].fops.close(&_pcb_ptr->file_entry[1]);
+    clean_up_fda(_pcb_ptr); /* back to the constructed state */
+    kmem_cache_free(file_table_cache,_pcb_ptr->file_entry);
+    _pcb_ptr->file_entry=NULL;
     ppid=_pcb_ptr->ppid; /* get parent pid : pid to recover */
     if(ppid!=0){
         ((pcb_t*)(PCB_BASE-ppid*PCB_SIZE))->state = RUNNABLE;
@@ -325,6 +385,8 @@ discard_proc(uint32_t pid,uint32_t status){
 
     _pcb_ptr->vidmap = 0;
     uvmunmap_vid();
+    uvmfree_file(pid);
+    uvmfree_prog(pid);
 
     /* re-spawn a shell immediately */
     if(ppid==0){ 
@@ -342,7 +404,8 @@ discard_proc(uint32_t pid,uint32_t status){
 
         _pcb_ptr=(pcb_t*)(PCB_BASE-ppid*PCB_SIZE); /* recover pid */
         recover_tss(_pcb_ptr); /* recover tss */
-        if (0 != uvmmap_ext(PCB_BASE+(_pcb_ptr->pid-1)*PROG_SIZE)) {
+        if (0 != uvmremap_prog(_pcb_ptr->pid)
+            || 0 != uvmremap_file(_pcb_ptr->pid)) {
             return ERR_VM_FAILURE;
         }; /* re-open last program */
         /* recover stack frame, return in exec() */
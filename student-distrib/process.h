@@ -59,9 +59,17 @@ typedef struct PCB{
     uint8_t pname[33]; /* program name, aligned with filesystem, max length 32 : 33 with NUL*/
     /* Below is file struct array (open file table) */
     /* file struct entries array : with maximum items 8, defined in FILE_ARRAY_MAX */
-    file_t file_entry[FILE_ARRAY_MAX];
+    /* from the file table cache at pcb_open, NULL : none */
+    file_t* file_entry;
     int8_t args[CMD_MAX_LEN]; /* arguments */
     uint8_t vidmap;
+    uint32_t prog_pa; /* physical 4MB program page, frames from frame_alloc_contig, 0 : none yet */
+    pte_t* img_pt; /* page table of the program page, NULL : none yet */
+    struct pcache_ent* img; /* shared text in the program image cache, NULL : one 4MB page */
+    pte_t* mmap_pt; /* page table of file mappings at MMAP_START, NULL : none yet */
+    uint16_t mmap_first[MMAP_MAX]; /* first page of each mapping in mmap_pt */
+    uint16_t mmap_pages[MMAP_MAX]; /* pages of each mapping, 0 : slot free */
+    uint16_t mmap_inode[MMAP_MAX]; /* file of each mapping, counted in fs.fmapped */
     enum proc_state state;
     context_t* context;
     /* after PCB, we have kernel stack for each process */
@@ -76,6 +84,7 @@ extern void setup_tss(uint32_t pid);
 extern file_t* get_file_entry(uint32_t fd);
 extern uint32_t get_pid();
 extern int32_t discard_proc(uint32_t pid,uint32_t status);
+extern void pcb_abort(uint32_t pid);
 extern int32_t copy_to_command(const uint8_t* command,uint8_t* _command,int32_t nbytes);
 extern int32_t set_proc_args(const uint8_t* command,int32_t start,int32_t nbytes,uint32_t pid);
 extern void init_pcb();
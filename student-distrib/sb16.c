@@ -180,6 +180,28 @@ int32_t sb16_write(file_t* file, const void* buf, int32_t nbytes) {
     return nbytes;
 }
 
+/**
+ * @brief Fill the SB16 buffer straight from a file (sendfile) : the data is
+ * copied once, from the file system to the DMA page.
+ * 
+ * @param inode file to read from
+ * @param offset first byte in the file
+ * @param nbytes size of data transferred
+ * @return int32_t bytes transferred, negative on failure as sb16_write
+ */
+int32_t sb16_write_file(uint32_t inode, uint32_t offset, int32_t nbytes) {
+    // SANITY CHECKS
+    if (!sb16.sb16_busy) {
+        return -1;
+    }
+
+    if (nbytes > SB16_DATA_LENGTH) {
+        return -3;
+    }
+
+    return fs.f_rw.read_data(inode, offset, (uint8_t*)SB16_PAGE_ADDRESS, nbytes);
+}
+
 /**
  * @brief Close the SB16 driver.
  * 
@@ -41,6 +41,7 @@ volatile sb16_t sb16;
 extern void sb16_init(void);
 extern void sb16_handler(void);
 extern int32_t sb16_command(int32_t command, int32_t argument);
+extern int32_t sb16_write_file(uint32_t inode, uint32_t offset, int32_t nbytes);
 
 #endif
 
@@ -22,7 +22,9 @@ scheduler(void) {
     // Update status of process in the current terminal.
     cur = PCB(pid);
     terminal[terminal_index].pid = pid;
-    cur->state = RUNNABLE;
+    if (SLEEPING != cur->state) {  // A process waiting for the disk stays asleep.
+        cur->state = RUNNABLE;
+    }
 
     if (-1 == terminal_update(cur->terminal)) {
         panic("scheduler: terminal fatal error\n");
@@ -35,6 +37,10 @@ scheduler(void) {
         }
     }
 
+    if (RUNNABLE != p->state) {
+        return;  // Everyone sleeps : keep idling in the current process.
+    }
+
     pid = (pid - 1 + i) % PCB_MAX + 1;  // Commit update of `pid`.
 
     if (-1 == prog_video_update((PCB(pid))->terminal)) {
@@ -44,8 +50,9 @@ scheduler(void) {
     p->state = RUNNING;
 
     // Change user page table.
-    if (0 != uvmmap_ext((pid - 1) * PROG_SIZE + PCB_BASE)
-        || 0 != uvmremap_vid(pid)) {
+    if (0 != uvmremap_prog(pid)
+        || 0 != uvmremap_vid(pid)
+        || 0 != uvmremap_file(pid)) {
         return;  // Failed to set up user memory.
     }
     setup_tss(pid);
@@ -13,6 +13,7 @@
 #include "lib.h"
 #include "syscall.h"
 #include "terminal.h"
+#include "ata.h"
 
 static void sigkill_handler (int32_t signum);
 static void sigignore_handler(int32_t signum);
@@ -140,6 +141,13 @@ do_signal(uint32_t kesp,uint32_t uesp,uint8_t* prog_start,uint8_t* prog_end){
     uint32_t ret_addr;
     uint32_t pid=get_pid();
     pcb_t*   _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    /* going back to user level, the context is saved on this process's kernel
+     * stack : a commit the PIT tick asked for can sleep on the disk here */
+    if(pid!=0&&fs_flush_due&&*((uint32_t*)(kesp)+9)!=KERNEL_CS){
+        sti();
+        fs_flush_run();
+        cli();
+    }
     if(pid==0||_pcb_ptr->sig_num==-1||
     sig_table[_pcb_ptr->sig_num].handler==NULL){
         /* no signal, change back to original stack */
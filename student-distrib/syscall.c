@@ -32,6 +32,8 @@
 #include "keyboard.h"
 #include "vga.h"
 #include "psmouse.h"
+#include "ata.h"
+#include "pit.h"
 
 extern void swtchret(void);
 extern void pseudoret(void);
@@ -87,19 +89,16 @@ int32_t _execute(const uint8_t* command,uint32_t pid,uint32_t ppid){
     /* open PCB */
     if(pcb_open(ppid,pid,_command)==-1){
         printf("not enough space for PCB\n");
+        pcb_abort(pid);
         return ERR_BAD_PID; /* errono to be defined */
     }
 
-    /* program is under PCB base */
-    if (0 != uvmmap_ext((pid-1)*PROG_SIZE+PCB_BASE)) {
+    /* program is under PCB base, text shared with other processes running it */
+    if (0 != uvmmap_prog(pid,_command)
+        || 0 != uvmremap_file(pid)) {
+        pcb_abort(pid); /* no memory, read error or a program too large : the parent carries on */
         return ERR_VM_FAILURE;
-    } /* TLB flushed */
-
-    /* to this point, everything is checked, nothing should fail */
-
-
-    /* program loader */
-    fs.load_prog(_command,IMG_START,PROG_SIZE);
+    } /* TLB flushed, program loaded */
 
     p->state = RUNNABLE;
     p->terminal = pid;
@@ -175,19 +174,16 @@ int32_t execute (const uint8_t* command){
     /* open PCB */
     if(pcb_open(ppid,pid,_command)==-1){
         printf("not enough space for PCB\n");
+        pcb_abort(pid);
         return ERR_BAD_PID; /* errono to be defined */
     }
 
-    /* program is under PCB base */
-    if (0 != uvmmap_ext((pid-1)*PROG_SIZE+PCB_BASE)) {
+    /* program is under PCB base, text shared with other processes running it */
+    if (0 != uvmmap_prog(pid,_command)
+        || 0 != uvmremap_file(pid)) {
+        pcb_abort(pid); /* no memory, read error or a program too large : the parent carries on */
         return ERR_VM_FAILURE;
-    } /* TLB flushed */
-
-    /* to this point, everything is checked, nothing should fail */
-
-
-    /* program loader */
-    fs.load_prog(_command,IMG_START,PROG_SIZE);
+    } /* TLB flushed, program loaded */
 
     /* set up TSS, only esp0 is needed to be modified */
     setup_tss(pid);
@@ -306,6 +302,10 @@ int32_t open (const uint8_t* filename){
             return -1;
         }
     }
+    /* if allocator statistics */
+    else if (strncmp((int8_t*)"meminfo", (int8_t*)filename,8) == 0) {
+        meminfo_open(file_entry, filename, 0);
+    }
     else{
         /* if regular file */
         if(fs.openr(file_entry,filename,0)==-1){
@@ -409,7 +409,7 @@ int32_t sigreturn (void){
      * local variables
      * old ebp <- ebp
      * ret address 
-     * para1~3
+     * para1~4 (the 4th is ESI, for pread/pwrite)
      * eflag
      * ------------------ should discard before iret
      * 8regs
@@ -419,13 +419,13 @@ int32_t sigreturn (void){
      * uesp
      */
     asm volatile("                \n\
-    movl 68(%%ebp),%%ebx          \n\
+    movl 72(%%ebp),%%ebx          \n\
     movl %%ebp,%%ecx              \n\
     "
     :"=b"(uesp),"=c"(kebp)
     :
     :"memory"
-    ); /* from old ebp to uesp 17 * 4 = 68 Bytes */
+    ); /* from old ebp to uesp 18 * 4 = 72 Bytes */
 
 
     /** user stack right now
@@ -438,7 +438,7 @@ int32_t sigreturn (void){
      * SS
      */
 
-    kebp=kebp+6; /* 6 : from old ebp to 8 regs */
+    kebp=kebp+7; /* 7 : from old ebp to 8 regs */
     uesp=uesp+1; /* 1: from signum to 8 regs */
     counter=8+5; /* 8 : 8 regs + 5 : 5 parameters to IRET */
 
@@ -454,7 +454,7 @@ int32_t sigreturn (void){
     /* discard kernel stack and iret to normal program */
     asm volatile("              \n\
     leave                       \n\
-    addl    $20,%%esp           \n\
+    addl    $24,%%esp           \n\
     popal                       \n\
     iret                        \n\
     "
@@ -498,6 +498,251 @@ int32_t file_rename(const uint8_t* src, const uint8_t* dest){
     return fs.f_rw.rename_file(src,dest,strlen((int8_t*)dest));
 }
 
+/**
+ * @brief make written data durable now instead of at the next background
+ * write-back. The journal commits the whole file system at once, so every
+ * pending change is written, not only fd's.
+ * @param fd - an open file
+ * @return ** int32_t - 0 on success
+ * -1 on bad fd
+ */
+int32_t fsync(int32_t fd){
+    uint32_t pid=get_pid();
+    pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    if(fd<0||fd>=FILE_ARRAY_MAX) return -1;
+    if(get_file_entry(fd)==NULL||!(_pcb_ptr->file_entry[fd].flags&F_OPEN)){
+        return -1;
+    }
+    sti(); /* sleep on the disk like write does */
+    sync_fs();
+    return 0;
+}
+
+/*!
+ * @brief Maps the data blocks of an open file into user space, starting at a page boundary, and writes the
+ * start of the mapping to the pointer passed in. Bytes past the end of the file up to the page boundary are
+ * whatever the last block holds. A shared mapping is read-only and sees later writes to the file; a private
+ * one (small files only) is copy-on-write and never changes the file.
+ * @param fd is an open regular file.
+ * @param start is pointer to user buffer which holds starting virtual address of the mapping.
+ * @param private is 1 for a private writable copy-on-write mapping, 0 for a shared read-only one.
+ * @return length of the file if successful, -1 otherwise.
+ */
+int32_t mmap(int32_t fd, uint8_t** start, int32_t private){
+    uint32_t pid=get_pid();
+    pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    file_t* file_entry;
+    if(fd<0||fd>=FILE_ARRAY_MAX||NULL==start) return -1;
+    if((file_entry=get_file_entry(fd))==NULL||!(_pcb_ptr->file_entry[fd].flags&F_OPEN)
+    ||(file_entry->flags&~F_OPEN)!=DESCRIPTOR_ENTRY_FILE){
+        return -1;
+    }
+    if(-1==uvmmap_file(file_entry->inode,fs.flength[file_entry->inode],private!=0,start)){
+        return -1;
+    }
+    return fs.flength[file_entry->inode];
+}
+
+/**
+ * @brief undo a mapping made by mmap
+ * @param start - starting address mmap sent back
+ * @return ** int32_t - 0 on success
+ * -1 if no mapping starts there
+ */
+int32_t munmap(uint8_t* start){
+    return uvmunmap_file(start);
+}
+
+/**
+ * @brief move bytes of an open file, from its position on, to a device in one
+ * write, without a trip through user space. The SB16 reads them into its DMA
+ * page itself; other devices get them straight from the file system image
+ * when they sit in one run of contiguous blocks, or from a kernel buffer they
+ * are gathered in otherwise.
+ * @param out_fd - open device (not a file or directory)
+ * @param in_fd - open regular file, its position moves by what the device took
+ * @param nbytes - bytes wanted, more than SENDFILE_MAX moves SENDFILE_MAX
+ * @return ** int32_t - bytes the device took, short when clamped, 0 at end of file
+ * -1 on bad fds, or what the device returned on failure
+ */
+int32_t sendfile(int32_t out_fd, int32_t in_fd, uint32_t nbytes){
+    uint32_t pid=get_pid(),len;
+    pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    file_t *in,*out;
+    uint8_t* bounce=NULL;
+    int32_t addr,ret;
+    if(out_fd<0||out_fd>=FILE_ARRAY_MAX||in_fd<0||in_fd>=FILE_ARRAY_MAX) return -1;
+    in=&_pcb_ptr->file_entry[in_fd];
+    out=&_pcb_ptr->file_entry[out_fd];
+    if(!(in->flags&F_OPEN)||!(out->flags&F_OPEN)||(in->flags&~F_OPEN)!=DESCRIPTOR_ENTRY_FILE
+    ||(out->flags&~F_OPEN)==DESCRIPTOR_ENTRY_FILE||(out->flags&~F_OPEN)==DESCRIPTOR_ENTRY_DIR){
+        return -1;
+    }
+    len=fs.flength[in->inode];
+    if(in->pos>=len||nbytes==0) return 0;
+    if(nbytes>SENDFILE_MAX) nbytes=SENDFILE_MAX;
+    if(nbytes>len-in->pos) nbytes=len-in->pos;
+    if((out->flags&~F_OPEN)==DESCRIPTOR_ENTRY_SB16){
+        ret=sb16_write_file(in->inode,in->pos,nbytes);
+        if(ret>0) in->pos+=ret;
+        return ret;
+    }
+    if(-1==(addr=fs.f_rw.data_addr(in->inode,in->pos,nbytes))){
+        /* the span crosses two runs : gather it */
+        if(NULL==(bounce=kmalloc(nbytes))) return -1;
+        if((int32_t)nbytes!=fs.f_rw.read_data(in->inode,in->pos,bounce,nbytes)){
+            kfree(bounce);
+            return -1;
+        }
+        addr=(int32_t)bounce;
+    }
+    ret=out->fops.write(out,(const void*)addr,nbytes);
+    if(bounce!=NULL) kfree(bounce);
+    if(ret>0) in->pos+=ret;
+    return ret;
+}
+
+/**
+ * @brief read as many entries of a directory as fit in buf : name, type,
+ * inode and size of each, so a listing takes one call instead of one per file
+ * @param fd - open directory
+ * @param buf - array of dirent_t
+ * @param nbytes - size of buf
+ * @return ** int32_t - bytes filled, a multiple of sizeof(dirent_t), 0 at the end
+ * -1 on bad fd
+ */
+int32_t getdents(int32_t fd, void* buf, uint32_t nbytes){
+    uint32_t pid=get_pid();
+    pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    file_t* file_entry;
+    if(fd<0||fd>=FILE_ARRAY_MAX||buf==NULL) return -1;
+    if((file_entry=get_file_entry(fd))==NULL||!(_pcb_ptr->file_entry[fd].flags&F_OPEN)
+    ||(file_entry->flags&~F_OPEN)!=DESCRIPTOR_ENTRY_DIR){
+        return -1;
+    }
+    return fs.getdents(file_entry,(dirent_t*)buf,nbytes);
+}
+
+/**
+ * @brief type, inode, length, block count and whether it is executable of a
+ * file by name, from cached metadata, without opening it
+ * @param filename - name of the file
+ * @param buf - stat_t result
+ * @return ** int32_t - 0 on success
+ * -1 on no such file
+ */
+int32_t stat(const uint8_t* filename, void* buf){
+    dentry_t dentry;
+    if(filename==NULL||buf==NULL) return -1;
+    if(-1==fs.f_rw.read_dentry_by_name(filename,&dentry)) return -1;
+    return fs.stat(dentry.inode_num,dentry.filetype,(stat_t*)buf);
+}
+
+/**
+ * @brief stat of an open file; a device or the directory gets its type only
+ * @param fd - open file
+ * @param buf - stat_t result
+ * @return ** int32_t - 0 on success
+ * -1 on bad fd
+ */
+int32_t fstat(int32_t fd, void* buf){
+    uint32_t pid=get_pid();
+    pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    file_t* file_entry;
+    if(fd<0||fd>=FILE_ARRAY_MAX||buf==NULL) return -1;
+    if((file_entry=get_file_entry(fd))==NULL||!(_pcb_ptr->file_entry[fd].flags&F_OPEN)){
+        return -1;
+    }
+    return fs.stat(file_entry->inode,file_entry->flags&~F_OPEN,(stat_t*)buf);
+}
+
+/**
+ * @brief move the position of an open file or directory. A file position may
+ * pass the end : the next write fills the gap with zeros. A directory position
+ * counts entries, so seeking to 0 rewinds a listing. No file outgrows the
+ * data blocks, a file position past them is refused.
+ * @param fd - open file or directory
+ * @param offset - bytes (entries) relative to whence
+ * @param whence - SEEK_SET, SEEK_CUR or SEEK_END
+ * @return ** int32_t - the new position
+ * -1 on bad fd, device, whence, or a position below 0 or past the data blocks
+ */
+int32_t lseek(int32_t fd, int32_t offset, int32_t whence){
+    uint32_t pid=get_pid(),type;
+    pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    file_t* file_entry;
+    uint32_t base,pos;
+    if(fd<0||fd>=FILE_ARRAY_MAX) return -1;
+    if((file_entry=get_file_entry(fd))==NULL||!(_pcb_ptr->file_entry[fd].flags&F_OPEN)) return -1;
+    type=file_entry->flags&~F_OPEN;
+    if(type!=DESCRIPTOR_ENTRY_FILE&&type!=DESCRIPTOR_ENTRY_DIR) return -1;
+    switch(whence){
+        case SEEK_SET: base=0; break;
+        case SEEK_CUR: base=file_entry->pos; break;
+        case SEEK_END: base=(type==DESCRIPTOR_ENTRY_FILE)?fs.flength[file_entry->inode]:fs.file_num; break;
+        default: return -1;
+    }
+    if(offset<0&&0U-(uint32_t)offset>base) return -1;
+    pos=base+offset;
+    if(type==DESCRIPTOR_ENTRY_FILE&&pos>fs.dblock_num*fs.block_size) return -1;
+    if(type==DESCRIPTOR_ENTRY_DIR&&pos>MAX_DENTRY) return -1;
+    file_entry->pos=pos;
+    return file_entry->pos;
+}
+
+/**
+ * @brief read from a file at an offset, leaving its position where it was
+ * @param fd - open regular file
+ * @param buf - read result
+ * @param nbytes - bytes to read
+ * @param offset - first byte in the file
+ * @return ** int32_t - bytes read, 0 at or past the end
+ * -1 on bad fd
+ */
+int32_t pread(int32_t fd, void* buf, uint32_t nbytes, uint32_t offset){
+    uint32_t pid=get_pid(),pos;
+    pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    file_t* file_entry;
+    int32_t ret;
+    if(fd<0||fd>=FILE_ARRAY_MAX) return -1;
+    if((file_entry=get_file_entry(fd))==NULL||!(_pcb_ptr->file_entry[fd].flags&F_OPEN)
+    ||(file_entry->flags&~F_OPEN)!=DESCRIPTOR_ENTRY_FILE){
+        return -1;
+    }
+    pos=file_entry->pos;
+    file_entry->pos=offset;
+    ret=file_entry->fops.read(file_entry,buf,nbytes);
+    file_entry->pos=pos;
+    return ret;
+}
+
+/**
+ * @brief write to a file at an offset, leaving its position where it was
+ * @param fd - open regular file
+ * @param buf - bytes to write
+ * @param nbytes - number of bytes
+ * @param offset - first byte in the file, past the end grows it
+ * @return ** int32_t - bytes written
+ * -1 on bad fd or failure
+ */
+int32_t pwrite(int32_t fd, const void* buf, uint32_t nbytes, uint32_t offset){
+    uint32_t pid=get_pid(),pos;
+    pcb_t* _pcb_ptr=(pcb_t*)(PCB_BASE-pid*PCB_SIZE);
+    file_t* file_entry;
+    int32_t ret;
+    if(fd<0||fd>=FILE_ARRAY_MAX) return -1;
+    if((file_entry=get_file_entry(fd))==NULL||!(_pcb_ptr->file_entry[fd].flags&F_OPEN)
+    ||(file_entry->flags&~F_OPEN)!=DESCRIPTOR_ENTRY_FILE){
+        return -1;
+    }
+    sti(); /* may sleep on the disk like write */
+    pos=file_entry->pos;
+    file_entry->pos=offset;
+    ret=file_entry->fops.write(file_entry,buf,nbytes);
+    file_entry->pos=pos;
+    return ret;
+}
+
 int32_t sb16_ioctl(int32_t fd,int32_t command, int32_t args) {
     sb16_command(command,args);
     return 0;
@@ -509,6 +754,8 @@ int32_t kmalloc_demo(void) {
     uint32_t dealloc_cnt = 0;
     uint32_t size;
     uint32_t round_total_size;
+    uint32_t round_alloc, round_free, cycles, cyc_alloc, cyc_free;
+    uint32_t mhz = pit_tsc_khz() / 1000;
     static const int32_t round_size = 1000;  // Cannot be too large -- the PCB may get corrupted.
     static const int32_t round_cnt = 100;  // Stress test.
     void* res[round_size];
@@ -516,27 +763,40 @@ int32_t kmalloc_demo(void) {
     for (j = 0; j < round_cnt; ++j) {
         memset(res, NULL, sizeof(res) / sizeof(res[0]));
         round_total_size = 0;
+        round_alloc = round_free = 0;
+        cyc_alloc = cyc_free = 0;
         for (i = 0; i < round_size; ++i) {
             size = rand() % ((1 << 20) + 1 - (8)) + (8);
-            if (NULL != (res[i] = kmalloc(size))) {
-                alloc_cnt++;
+            cycles = rdtsc();
+            res[i] = kmalloc(size);
+            cyc_alloc += rdtsc() - cycles;
+            if (NULL != res[i]) {
+                round_alloc++;
                 round_total_size += size;
             }
         }
+        cycles = rdtsc();
         for (i = 0; i < round_size; ++i) {
             if (NULL == res[i]) {
                 continue;
             }
             if (0 == kfree(res[i])) {
-                dealloc_cnt++;
+                round_free++;
             }
         }
+        cyc_free = rdtsc() - cycles;
+        alloc_cnt += round_alloc;
+        dealloc_cnt += round_free;
         printf("\nIn round %d:\n", j);
         printf("Successfully allocated %d blocks of memory.\n", alloc_cnt);
         printf("Memory involved in this round: 0x%x bytes.\n", round_total_size);
         printf("Buddy allocator called %u times.\n", buddy_cnt);
         printf("Slab allocator called %u times.\n", slab_cnt);
         printf("Successfully reclaimed %d blocks of memory.\n", dealloc_cnt);
+        if (mhz) {
+            printf("%d ns per kmalloc, %d ns per kfree.\n", cyc_alloc / round_size * 1000 / mhz,
+                   round_free ? cyc_free / round_free * 1000 / mhz : 0);
+        }
     }
     return 0;
 }
@@ -582,5 +842,15 @@ install_syscall(){
     syscall_table[SYS_SB16_IOCTL]=(uint32_t)sb16_ioctl;
     syscall_table[SYS_KMALLOC_DEMO]=(uint32_t)kmalloc_demo;
     syscall_table[SYS_BUDDY_TRAVERSE]=(uint32_t)buddy_traverse;
+    syscall_table[SYS_FSYNC]=(uint32_t)fsync;
+    syscall_table[SYS_MMAP]=(uint32_t)mmap;
+    syscall_table[SYS_MUNMAP]=(uint32_t)munmap;
+    syscall_table[SYS_SENDFILE]=(uint32_t)sendfile;
+    syscall_table[SYS_GETDENTS]=(uint32_t)getdents;
+    syscall_table[SYS_STAT]=(uint32_t)stat;
+    syscall_table[SYS_FSTAT]=(uint32_t)fstat;
+    syscall_table[SYS_LSEEK]=(uint32_t)lseek;
+    syscall_table[SYS_PREAD]=(uint32_t)pread;
+    syscall_table[SYS_PWRITE]=(uint32_t)pwrite;
 }
 
@@ -20,11 +20,27 @@
 #define SYS_SB16_IOCTL  17
 #define SYS_KMALLOC_DEMO 18
 #define SYS_BUDDY_TRAVERSE 19
+#define SYS_FSYNC       20
+#define SYS_MMAP        21
+#define SYS_MUNMAP      22
+#define SYS_SENDFILE    23
+#define SYS_GETDENTS    24
+#define SYS_STAT        25
+#define SYS_FSTAT       26
+#define SYS_LSEEK       27
+#define SYS_PREAD       28
+#define SYS_PWRITE      29
 
 #define CMD_MAX_LEN 128
 #define ARG_MAX_NUM 10
+#define SENDFILE_MAX (64<<10) /* bytes one sendfile moves at most */
 
-#define SYSCALL_NUM 19
+/* lseek whence */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+#define SYSCALL_NUM 29
 
 #ifndef ASM
 #include "types.h"
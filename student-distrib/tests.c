@@ -6,6 +6,12 @@
 #include "terminal.h"
 #include "cursor.h"
 #include "kmalloc.h"
+#include "ata.h"
+#include "bcache.h"
+#include "blk.h"
+#include "pit.h"
+#include "pcache.h"
+#include "frame.h"
 
 
 /* Include constants for testing purposes. */
@@ -873,6 +879,826 @@ int32_t test_write_file() {
     return PASS;
 }
 
+/**
+ * @brief test written data lands in the file and the file grows across blocks
+ * OUTPUT: PASS/FAIL
+ * Coverage : write data, block allocation on append, overwrite at block boundary, read back
+ * @return ** int32_t 
+ */
+int32_t test_write_read_back() {
+    static uint8_t wbuf[3 * 4096 + 100];
+    static uint8_t rbuf[3 * 4096 + 100];
+    uint32_t i, len = sizeof(wbuf);
+    int32_t result = PASS;
+    file_t file;
+    if (-1 == fs.f_rw.create_file((uint8_t*) "rwtest.txt", strlen("rwtest.txt"))) {
+        return FAIL;
+    }
+    if (-1 == fs.openr(&file, (uint8_t*) "rwtest.txt", 0)) {
+        return FAIL;
+    }
+    for (i = 0; i < len; i++) wbuf[i] = 'a' + i % 26;
+    /* append in uneven pieces so writes straddle block boundaries */
+    for (i = 0; i < len; i += 1000) {
+        if (-1 == fs.f_rw.write_data(file.inode, i, wbuf + i, len - i < 1000 ? len - i : 1000)) {
+            return FAIL;
+        }
+    }
+    /* overwrite the start of the second block in place */
+    wbuf[4096] = 'X';
+    if (1 != fs.f_rw.write_data(file.inode, 4096, wbuf + 4096, 1)) {
+        result = FAIL;
+    }
+    if (len != fs.f_rw.read_data(file.inode, 0, rbuf, sizeof(rbuf)) || fs.flength[file.inode] != len) {
+        result = FAIL;
+    }
+    for (i = 0; i < len && result == PASS; i++) {
+        if (rbuf[i] != wbuf[i]) result = FAIL;
+    }
+    fs.f_ioctl.close(&file);
+    if (-1 == fs.f_rw.remove_file((uint8_t*) "rwtest.txt", strlen("rwtest.txt"))) {
+        return FAIL;
+    }
+    return result;
+}
+
+/**
+ * @brief test data block allocation keeps a growing file contiguous
+ * OUTPUT: PASS/FAIL
+ * Coverage : bitmap allocator, allocation next to previous block, extent merging
+ * @return ** int32_t 
+ */
+int32_t test_dblock_locality() {
+    static uint8_t buf[4 * 4096];
+    int32_t i, result = PASS;
+    uint32_t breaks = 0, last;
+    file_t file;
+    inode_ext_t* inode;
+    if (-1 == fs.f_rw.create_file((uint8_t*) "loctest.txt", strlen("loctest.txt"))) {
+        return FAIL;
+    }
+    if (-1 == fs.openr(&file, (uint8_t*) "loctest.txt", 0)) {
+        return FAIL;
+    }
+    inode = (inode_ext_t*) (fs.sys_st_addr + (file.inode + 1) * fs.block_size);
+    if (inode->magic != INODE_EXT_MAGIC) {
+        result = FAIL;
+    }
+    /* grow one block at a time, like an appending logger */
+    for (i = 0; i < 4; i++) {
+        /* whenever the block after the last one is free, it must be taken and extend the extent */
+        last = inode->extent[inode->extent_num - 1].start + inode->extent[inode->extent_num - 1].len - 1;
+        if (i && (last + 1 >= fs.dblock_num || MAP_TEST(fs.dmap, last + 1))) {
+            breaks++;
+        }
+        if (4096 != fs.f_rw.write_data(file.inode, i * 4096, buf, 4096)) {
+            result = FAIL;
+        }
+    }
+    if (inode->extent_num != 1 + breaks) {
+        printf("%d extents, %d expected\n", inode->extent_num, 1 + breaks);
+        result = FAIL;
+    }
+    fs.f_ioctl.close(&file);
+    if (-1 == fs.f_rw.remove_file((uint8_t*) "loctest.txt", strlen("loctest.txt"))) {
+        return FAIL;
+    }
+    return result;
+}
+
+/**
+ * @brief test files created by the kernel use extents, read back through runs,
+ * and give every block back on remove, next to flat createfs inodes
+ * OUTPUT: PASS/FAIL
+ * Coverage : inode_ext_t create/append/read/remove, flat inode read
+ * @return ** int32_t 
+ */
+int32_t test_extent_inode() {
+    static uint8_t buf[16 * 4096], back[16 * 4096];
+    uint32_t i, used_before = 0, used_after = 0;
+    int32_t result = PASS;
+    dentry_t dentry;
+    for (i = 0; i < fs.dblock_num; i++) used_before += MAP_TEST(fs.dmap, i);
+    for (i = 0; i < sizeof(buf); i++) buf[i] = (uint8_t) (i * 7 + 3);
+    if (-1 == fs.f_rw.create_file((uint8_t*) "exttest.txt", strlen("exttest.txt"))
+        || -1 == fs.f_rw.read_dentry_by_name((uint8_t*) "exttest.txt", &dentry)) {
+        return FAIL;
+    }
+    if (((inode_ext_t*) (fs.sys_st_addr + (dentry.inode_num + 1) * fs.block_size))->magic != INODE_EXT_MAGIC) {
+        result = FAIL;
+    }
+    /* write in odd pieces so runs start and end inside blocks */
+    for (i = 0; i < sizeof(buf); i += 5000) {
+        fs.f_rw.write_data(dentry.inode_num, i, buf + i, sizeof(buf) - i < 5000 ? sizeof(buf) - i : 5000);
+    }
+    if (sizeof(buf) - 100 != fs.f_rw.read_data(dentry.inode_num, 100, back, sizeof(back))) {
+        result = FAIL;
+    }
+    for (i = 0; i < sizeof(buf) - 100; i++) {
+        if (back[i] != buf[i + 100]) {
+            result = FAIL;
+            break;
+        }
+    }
+    /* flat inode from createfs still reads */
+    if (-1 == fs.f_rw.read_dentry_by_name((uint8_t*) "frame0.txt", &dentry)
+        || 187 != fs.f_rw.read_data(dentry.inode_num, 0, back, sizeof(back))) {
+        result = FAIL;
+    }
+    if (-1 == fs.f_rw.remove_file((uint8_t*) "exttest.txt", strlen("exttest.txt"))) {
+        return FAIL;
+    }
+    for (i = 0; i < fs.dblock_num; i++) used_after += MAP_TEST(fs.dmap, i);
+    return used_before == used_after ? result : FAIL;
+}
+
+/**
+ * @brief test allocation maps sized from the boot block agree with the inodes
+ * OUTPUT: PASS/FAIL
+ * Coverage : kmalloc'ed imap/dmap/flength, padding bits past the image, any image size
+ * @return ** int32_t 
+ */
+int32_t test_fs_maps() {
+    uint32_t i, used = 0, owned = 0;
+    for (i = fs.dblock_num; i < (MAP_WORDS(fs.dblock_num) << 5); i++) {
+        if (!MAP_TEST(fs.dmap, i)) return FAIL;
+    }
+    for (i = fs.iblock_num; i < (MAP_WORDS(fs.iblock_num) << 5); i++) {
+        if (!MAP_TEST(fs.imap, i)) return FAIL;
+    }
+    for (i = 0; i < fs.dblock_num; i++) {
+        used += MAP_TEST(fs.dmap, i);
+    }
+    for (i = 0; i < fs.iblock_num; i++) {
+        if (MAP_TEST(fs.imap, i)) {
+            owned += fs.flength[i] ? (fs.flength[i] - 1) / fs.block_size + 1 : 1;
+        }
+    }
+    printf("%d of %d dblocks used, inodes own %d\n", used, fs.dblock_num, owned);
+    return used == owned ? PASS : FAIL;
+}
+
+/**
+ * @brief test filename index stays consistent through create, rename and remove
+ * OUTPUT: PASS/FAIL
+ * Coverage : read dentry by name after create/rename/remove, duplicated create
+ * @return ** int32_t 
+ */
+int32_t test_dentry_index() {
+    dentry_t dentry;
+    if (-1 == fs.f_rw.create_file((uint8_t*) "idxtest.txt", strlen("idxtest.txt"))) {
+        return FAIL;
+    }
+    if (-1 != fs.f_rw.create_file((uint8_t*) "idxtest.txt", strlen("idxtest.txt"))) {
+        return FAIL; /* duplicated name must be refused */
+    }
+    if (-1 == fs.f_rw.rename_file((uint8_t*) "idxtest.txt", (uint8_t*) "idxtest2.txt", strlen("idxtest2.txt"))) {
+        return FAIL;
+    }
+    if (-1 != fs.f_rw.read_dentry_by_name((uint8_t*) "idxtest.txt", &dentry)
+        || -1 == fs.f_rw.read_dentry_by_name((uint8_t*) "idxtest2.txt", &dentry)) {
+        return FAIL;
+    }
+    if (-1 == fs.f_rw.remove_file((uint8_t*) "idxtest2.txt", strlen("idxtest2.txt"))) {
+        return FAIL;
+    }
+    /* the dentry swapped into the removed slot must still be found */
+    if (-1 != fs.f_rw.read_dentry_by_name((uint8_t*) "idxtest2.txt", &dentry)
+        || -1 == fs.f_rw.read_dentry_by_name((uint8_t*) "shell", &dentry)
+        || -1 == fs.f_rw.read_dentry_by_name((uint8_t*) "verylargetextwithverylongname.tx", &dentry)) {
+        return FAIL;
+    }
+    return PASS;
+}
+
+/**
+ * @brief benchmark disk write-back cost of the write path
+ * Appends a short line to a fresh file through file_write and reports the
+ * number of bytes sent to the ATA disk per write, against the size of the
+ * whole image which is what the full dump used to write every time.
+ * OUTPUT: bytes written per write + PASS/FAIL
+ * @return ** int32_t 
+ */
+int32_t fs_writeback_bench() {
+    int32_t i;
+    const int32_t rounds = 64;
+    uint32_t st_sectors;
+    file_t file;
+    if (-1 == fs.f_rw.create_file((uint8_t*) "benchwb.txt", strlen("benchwb.txt"))) {
+        return FAIL;
+    }
+    if (-1 == fs.openr(&file, (uint8_t*) "benchwb.txt", 0)) {
+        return FAIL;
+    }
+    st_sectors = ata_sectors_written;
+    for (i = 0; i < rounds; i++) {
+        if (-1 == fs.f_ioctl.write(&file, "hello,world\n", strlen("hello,world\n"))) {
+            return FAIL;
+        }
+    }
+    sync_fs(); /* count the last, partially filled batch too */
+    printf("full image dump : %u bytes per write\n", fs.sys_ed_addr - fs.sys_st_addr);
+    printf("dirty write-back : %u bytes per write\n",
+           (ata_sectors_written - st_sectors) * 512 / rounds);
+    fs.f_ioctl.close(&file);
+    if (-1 == fs.f_rw.remove_file((uint8_t*) "benchwb.txt", strlen("benchwb.txt"))) {
+        return FAIL;
+    }
+    return PASS;
+}
+
+/**
+ * @brief background write-back : writes only copy into the memory image, the
+ * PIT tick asks for a commit once the changes are fs_flush_ms old and
+ * fs_flush_run does it (ticks are simulated since tests run with interrupts off), and fsync-style sync_fs costs a commit
+ * OUTPUT: us per write with the flusher against write + commit + PASS/FAIL
+ * Coverage : fs_flush_tick interval, fs_busy postponing, fs_flush_run
+ * @return ** int32_t PASS if writes reach the disk only through the flusher
+ */
+int32_t fs_flusher_test() {
+    int32_t i;
+    const int32_t rounds = 32;
+    uint32_t t, sectors, cycles, us_async, us_sync, flushes;
+    file_t file;
+    TEST_HEADER;
+    sync_fs();
+    if (-1 == fs.f_rw.create_file((uint8_t*) "flushtst.txt", strlen("flushtst.txt"))
+        || -1 == fs.openr(&file, (uint8_t*) "flushtst.txt", 0)) {
+        return FAIL;
+    }
+    sync_fs();
+    sectors = ata_sectors_written;
+    flushes = fs_bg_flushes;
+    cycles = rdtsc();
+    for (i = 0; i < rounds; i++) fs.f_ioctl.write(&file, "hello,world\n", strlen("hello,world\n"));
+    us_async = (rdtsc() - cycles) / (pit_tsc_khz() / 1000) / rounds;
+    if (ata_sectors_written != sectors || fs_dirty_blocks == 0) return FAIL;
+    /* nothing before the interval, nothing while an operation is open */
+    for (t = 10; t < fs_flush_ms; t += 10) {
+        fs_flush_tick(10);
+        fs_flush_run();
+    }
+    fs_busy++;
+    fs_flush_tick(10);
+    fs_flush_run();
+    fs_busy--;
+    if (ata_sectors_written != sectors) return FAIL;
+    fs_flush_tick(10);
+    if (ata_sectors_written != sectors) return FAIL; /* nothing written in the interrupt */
+    fs_flush_run();
+    if (fs_bg_flushes != flushes + 1 || fs_dirty_blocks != 0) return FAIL;
+
+    cycles = rdtsc();
+    for (i = 0; i < rounds; i++) {
+        fs.f_ioctl.write(&file, "hello,world\n", strlen("hello,world\n"));
+        sync_fs();
+    }
+    us_sync = (rdtsc() - cycles) / (pit_tsc_khz() / 1000) / rounds;
+    printf("write : %d us with the flusher, %d us with a commit each\n", us_async, us_sync);
+    fs.f_ioctl.close(&file);
+    fs.f_rw.remove_file((uint8_t*) "flushtst.txt", strlen("flushtst.txt"));
+    sync_fs();
+    return PASS;
+}
+
+/**
+ * @brief test a committed metadata transaction is found and replayed
+ * A commit is cut right after the journal write, as if the machine went
+ * down before the checkpoint, then the journal is read back from disk.
+ * OUTPUT: PASS/FAIL
+ * Coverage : journal write, checksum, replay, batched commit
+ * @return ** int32_t 
+ */
+int32_t test_journal_replay() {
+    int32_t replayed;
+    dentry_t dentry;
+    sync_fs(); /* start from a clean journal */
+    if (-1 == fs.f_rw.create_file((uint8_t*) "jrtest.txt", strlen("jrtest.txt"))) {
+        return FAIL;
+    }
+    journal_crash_point = 1;
+    sync_fs();
+    journal_crash_point = 0;
+    replayed = replay_journal_ata();
+    printf("%d metadata blocks replayed\n", replayed);
+    if (replayed <= 0 || -1 == fs.f_rw.read_dentry_by_name((uint8_t*) "jrtest.txt", &dentry)) {
+        return FAIL;
+    }
+    if (-1 == fs.f_rw.remove_file((uint8_t*) "jrtest.txt", strlen("jrtest.txt"))) {
+        return FAIL;
+    }
+    sync_fs();
+    /* nothing is left to replay once the transaction is checkpointed */
+    return 0 == replay_journal_ata() ? PASS : FAIL;
+}
+
+/**
+ * @brief time reading a whole file through read_data in cat-sized chunks
+ * Internal use
+ * @param fname - file to read
+ * @param rounds - number of times the file is read
+ * @return ** int32_t PASS/FAIL
+ */
+static int32_t read_throughput(const int8_t* fname, uint32_t rounds) {
+    static uint8_t buf[1024]; /* same chunk size as cat */
+    dentry_t dentry;
+    uint32_t i, offset, bytes = 0, cycles, us = 0, mhz = pit_tsc_khz() / 1000;
+    int32_t ret;
+    if (-1 == fs.f_rw.read_dentry_by_name((uint8_t*) fname, &dentry) || mhz == 0) {
+        return FAIL;
+    }
+    for (i = 0; i < rounds; i++) {
+        /* rdtsc wraps after about a second : time one round at a time */
+        cycles = rdtsc();
+        offset = 0;
+        while ((ret = fs.f_rw.read_data(dentry.inode_num, offset, buf, sizeof(buf))) > 0) {
+            offset += ret;
+        }
+        if (ret == -1) {
+            return FAIL;
+        }
+        us += (rdtsc() - cycles) / mhz;
+        bytes += offset;
+    }
+    printf("%s : %u bytes in %u us, %u MB/s\n", fname, bytes, us, us ? bytes / us : 0);
+    return PASS;
+}
+
+/**
+ * @brief benchmark file data read throughput (MB/s)
+ * OUTPUT: throughput for a text file and a large binary + PASS/FAIL
+ * Coverage : read data fast path, multi-block files
+ * @return ** int32_t 
+ */
+int32_t fs_read_throughput_bench() {
+    if (FAIL == read_throughput("verylargetextwithverylongname.tx", 256)) {
+        return FAIL;
+    }
+    if (FAIL == read_throughput("statue.photo", 8)) {
+        return FAIL;
+    }
+    return PASS;
+}
+
+/**
+ * @brief time moving "total" sectors of the image on the slave drive with
+ * commands of "per_cmd" sectors. Writes put back what was just read, so the
+ * image is unchanged.
+ * @param per_cmd - sectors per command, 1 .. 256
+ * @param write - 0 : read, 1 : write, 2 : write and flush after every command
+ * @param buf - 256 sectors of scratch memory
+ * @param total - sectors to move, a multiple of 256
+ * @return ** uint32_t sectors per second
+ */
+static uint32_t pio_rate(uint32_t per_cmd, uint32_t write, uint8_t* buf, uint32_t total) {
+    uint32_t s, k, cycles, us = 0;
+    for (s = 0; s < total; s += 256) {
+        if (write) read_sectors_ATA_PIO((uint32_t) buf, FS_LBA_BASE + s, 256, 1);
+        cycles = rdtsc();
+        for (k = 0; k < 256; k += per_cmd) {
+            if (!write) {
+                read_sectors_ATA_PIO((uint32_t) buf + k * 512, FS_LBA_BASE + s + k, per_cmd, 1);
+                continue;
+            }
+            write_sectors_ATA_PIO(FS_LBA_BASE + s + k, per_cmd, (uint32_t) buf + k * 512, 1);
+            if (write == 2) ata_flush(1);
+        }
+        if (write == 1) ata_flush(1);
+        /* each chunk is short enough for the 32-bit TSC */
+        us += (rdtsc() - cycles) / (pit_tsc_khz() / 1000);
+    }
+    us /= 100; /* total * 10^6 / us without overflowing 32 bits */
+    return us ? total * 10000 / us : 0;
+}
+
+/**
+ * @brief benchmark ATA PIO sectors/second for 1, 8 and 256 sectors per command,
+ * and for writes flushed per command versus once per batch
+ * OUTPUT: sectors/second per configuration + PASS/FAIL
+ * Coverage : multi-sector commands, rep insw/outsw, flush batching
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t ata_pio_bench() {
+    static const uint32_t per_cmd[] = {1, 8, 256};
+    uint32_t i, total;
+    uint8_t* buf;
+    TEST_HEADER;
+    total = ((fs.sys_ed_addr - fs.sys_st_addr) / 512) & ~255;
+    if (total > 2048) total = 2048; /* 1 MB */
+    if (total == 0 || NULL == (buf = kmalloc(256 * 512))) return FAIL;
+    for (i = 0; i < sizeof(per_cmd) / sizeof(per_cmd[0]); i++) {
+        printf("read  %d sectors/cmd : %d sectors/s\n", per_cmd[i], pio_rate(per_cmd[i], 0, buf, total));
+    }
+    for (i = 0; i < sizeof(per_cmd) / sizeof(per_cmd[0]); i++) {
+        printf("write %d sectors/cmd : %d sectors/s flush per cmd, %d sectors/s flush per batch\n", per_cmd[i],
+               pio_rate(per_cmd[i], 2, buf, total), pio_rate(per_cmd[i], 1, buf, total));
+    }
+    kfree(buf);
+    return PASS;
+}
+
+/**
+ * @brief time moving "total" sectors of the image through ata_read/ata_write
+ * in 256-sector commands; writes put back what was just read
+ * @param write - 0 : read, 1 : write
+ * @param buf - 256 sectors of kernel memory
+ * @param total - sectors to move, a multiple of 256
+ * @return ** uint32_t sectors per second
+ */
+static uint32_t disk_rate(uint32_t write, uint8_t* buf, uint32_t total) {
+    uint32_t s, cycles, us = 0;
+    for (s = 0; s < total; s += 256) {
+        if (write) ata_read((uint32_t) buf, FS_LBA_BASE + s, 256, 1);
+        cycles = rdtsc();
+        if (write) {
+            ata_write(FS_LBA_BASE + s, 256, (uint32_t) buf, 1);
+            ata_flush(1);
+        } else {
+            ata_read((uint32_t) buf, FS_LBA_BASE + s, 256, 1);
+        }
+        us += (rdtsc() - cycles) / (pit_tsc_khz() / 1000);
+    }
+    us /= 100;
+    return us ? total * 10000 / us : 0;
+}
+
+/**
+ * @brief compare bus-master DMA against PIO for 256-sector commands
+ * OUTPUT: sectors/second and MB/s for both paths + PASS/FAIL
+ * Coverage : PRD table setup, DMA completion, PIO fallback
+ * @return ** int32_t PASS if both paths move the same bytes
+ */
+int32_t ata_dma_bench() {
+    uint32_t i, total, rate, dma = ata_use_dma;
+    uint8_t *buf, *pio_buf;
+    TEST_HEADER;
+    total = ((fs.sys_ed_addr - fs.sys_st_addr) / 512) & ~255;
+    if (total > 2048) total = 2048;
+    if (!dma) printf("no bus-master IDE controller, DMA numbers are PIO\n");
+    if (total == 0 || NULL == (buf = kmalloc(256 * 512)) || NULL == (pio_buf = kmalloc(256 * 512))) return FAIL;
+    for (i = 0; i < 2; i++) {
+        ata_use_dma = i ? 0 : dma;
+        rate = disk_rate(0, buf, total);
+        printf("%s read  : %d sectors/s, %d KB/s\n", i ? "PIO" : "DMA", rate, rate / 2);
+        rate = disk_rate(1, buf, total);
+        printf("%s write : %d sectors/s, %d KB/s\n", i ? "PIO" : "DMA", rate, rate / 2);
+    }
+    ata_use_dma = dma;
+    ata_read((uint32_t) buf, FS_LBA_BASE, 256, 1);
+    read_sectors_ATA_PIO((uint32_t) pio_buf, FS_LBA_BASE, 256, 1);
+    for (i = 0; i < 256 * 512 && buf[i] == pio_buf[i]; i++);
+    kfree(buf);
+    kfree(pio_buf);
+    return i == 256 * 512 ? PASS : FAIL;
+}
+
+/**
+ * @brief IDENTIFY the slave drive, then read the image with LBA48 commands of
+ * ata_max_sectors() against 256-sector LBA28 commands
+ * OUTPUT: drive model/size, sectors/second for both + PASS/FAIL
+ * Coverage : IDENTIFY parsing, EXT register order, 16-bit sector counts
+ * @return ** int32_t PASS if the drive answers and both command forms read the same bytes
+ */
+int32_t ata_lba48_test() {
+    uint32_t i, k, total, cycles, us, lba48;
+    uint8_t *big, *small;
+    TEST_HEADER;
+    if (ata_identify(1)) return FAIL;
+    lba48 = ata_drives[1].lba48;
+    printf("hdb : %s, %d sectors, %s\n", ata_drives[1].model, ata_drives[1].sectors, lba48 ? "LBA48" : "LBA28");
+    if (ata_drives[1].sectors <= FS_LBA_BASE) return FAIL;
+    total = ((fs.sys_ed_addr - fs.sys_st_addr) / 512) & ~255;
+    if (total > 2048) total = 2048;
+    if (total == 0 || NULL == (big = kmalloc(total * 512)) || NULL == (small = kmalloc(total * 512))) return FAIL;
+    for (k = 0; k < 2; k++) {
+        ata_drives[1].lba48 = k ? 0 : lba48;
+        cycles = rdtsc();
+        ata_read((uint32_t) (k ? small : big), FS_LBA_BASE, total, 1);
+        us = (rdtsc() - cycles) / (pit_tsc_khz() / 1000);
+        printf("%d-sector commands : %d sectors in %d us\n", ata_max_sectors(1), total, us);
+    }
+    ata_drives[1].lba48 = lba48;
+    for (i = 0; i < total * 512 && big[i] == small[i]; i++);
+    kfree(big);
+    kfree(small);
+    return i == total * 512 ? PASS : FAIL;
+}
+
+/**
+ * @brief block queue : 64 one-block reads of the image submitted in scrambled
+ * order come back sorted and merged into a few commands, against the same
+ * reads done one at a time
+ * OUTPUT: commands, merges and time for both + PASS/FAIL
+ * Coverage : elevator order, front/back merge, completion of merged commands
+ * @return ** int32_t PASS if the data matches the image and requests were merged
+ */
+int32_t blk_queue_test() {
+    static blk_req_t req[BLK_BATCH];
+    uint32_t i, k, n, cmds, merged, cycles, us_one, us_queue;
+    uint8_t* buf;
+    TEST_HEADER;
+    n = (fs.sys_ed_addr - fs.sys_st_addr) / 4096;
+    if (n > BLK_BATCH) n = BLK_BATCH;
+    if (n < 2 || NULL == (buf = kmalloc(n * 4096))) return FAIL;
+
+    cmds = blk_stats.commands;
+    cycles = rdtsc();
+    for (i = 0; i < n; i++) ata_read((uint32_t) buf + i * 4096, FS_LBA_BASE + i * 8, 8, 1);
+    us_one = (rdtsc() - cycles) / (pit_tsc_khz() / 1000);
+    printf("one at a time : %d commands, %d us\n", blk_stats.commands - cmds, us_one);
+
+    memset(buf, 0, n * 4096);
+    cmds = blk_stats.commands;
+    merged = blk_stats.merged;
+    cycles = rdtsc();
+    for (i = 0; i < n; i++) {
+        k = (i * 37) % n;  /* 37 is prime : every block once, scattered */
+        req[i].lba = FS_LBA_BASE + k * 8;
+        req[i].count = 8;
+        req[i].addr = (uint32_t) buf + k * 4096;
+        req[i].write = 0;
+        req[i].slave = 1;
+        blk_submit(&req[i]);
+    }
+    for (i = 0; i < n; i++) {
+        if (blk_wait(&req[i])) return FAIL;
+    }
+    us_queue = (rdtsc() - cycles) / (pit_tsc_khz() / 1000);
+    printf("queued        : %d commands, %d merged, %d us\n",
+           blk_stats.commands - cmds, blk_stats.merged - merged, us_queue);
+    blk_print_stats();
+    for (i = 0; i < n * 4096 && buf[i] == ((uint8_t*) fs.sys_st_addr)[i]; i++);
+    kfree(buf);
+    if (i != n * 4096) return FAIL;
+    return (blk_stats.merged > merged && blk_stats.commands - cmds < n) ? PASS : FAIL;
+}
+
+/**
+ * @brief mmap : every block address of statue.photo holds what read_data
+ * returns for it, and no block past the end is handed out. Times a read of the
+ * whole file against walking the blocks in place, which is what a mapping costs.
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t mmap_block_test() {
+    dentry_t dentry;
+    uint32_t i, n, len, cycles, us_read, us_map;
+    int32_t addr;
+    uint8_t* buf;
+    TEST_HEADER;
+    if (-1 == fs.f_rw.read_dentry_by_name((uint8_t*) "statue.photo", &dentry)) return FAIL;
+    len = fs.flength[dentry.inode_num];
+    n = (len + fs.block_size - 1) / fs.block_size;
+    if (NULL == (buf = kmalloc(len))) return FAIL;
+    cycles = rdtsc();
+    if (len != fs.f_rw.read_data(dentry.inode_num, 0, buf, len)) return FAIL;
+    us_read = (rdtsc() - cycles) / (pit_tsc_khz() / 1000);
+    cycles = rdtsc();
+    for (i = 0; i < n; i++) {
+        if (-1 == fs.f_rw.data_addr(dentry.inode_num, i * fs.block_size, fs.block_size)) return FAIL;
+    }
+    us_map = (rdtsc() - cycles) / (pit_tsc_khz() / 1000);
+    printf("statue.photo : %d blocks, read %d us, block lookup %d us\n", n, us_read, us_map);
+    for (i = 0, addr = 0; i < len; i++) {
+        if (i % fs.block_size == 0) addr = fs.f_rw.data_addr(dentry.inode_num, i, fs.block_size - i % fs.block_size);
+        if (((uint8_t*) addr)[i % fs.block_size] != buf[i]) break;
+    }
+    kfree(buf);
+    if (i != len || -1 != fs.f_rw.data_addr(dentry.inode_num, n * fs.block_size, 1)) return FAIL;
+    return PASS;
+}
+
+/**
+ * @brief mmap pins a file : while a mapping counts in fs.fmapped the file
+ * can't be removed (its blocks are mapped in place), once it goes it can
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t mmap_pin_test() {
+    dentry_t dentry;
+    TEST_HEADER;
+    if (-1 == fs.f_rw.create_file((uint8_t*) "pintst", strlen("pintst"))
+        || -1 == fs.f_rw.read_dentry_by_name((uint8_t*) "pintst", &dentry)) return FAIL;
+    fs.fmapped[dentry.inode_num]++; /* what uvmmap_file does */
+    if (-1 != fs.f_rw.remove_file((uint8_t*) "pintst", strlen("pintst"))) return FAIL;
+    if (-1 == fs.f_rw.read_dentry_by_name((uint8_t*) "pintst", &dentry)) return FAIL;
+    fs.fmapped[dentry.inode_num]--; /* uvmunmap_file */
+    if (0 != fs.f_rw.remove_file((uint8_t*) "pintst", strlen("pintst"))) return FAIL;
+    sync_fs();
+    return PASS;
+}
+
+/**
+ * @brief sendfile : 4 KB spans of stopandsmell8.wav after the header. A span
+ * data_addr hands out must hold what read_data returns; a span over two runs
+ * must be refused (sendfile then gathers it, except for the SB16).
+ * OUTPUT: how many spans go to the device straight from the image
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t sendfile_span_test() {
+    static uint8_t buf[4096];
+    dentry_t dentry;
+    uint32_t off, i, len, direct = 0, gathered = 0;
+    int32_t addr;
+    TEST_HEADER;
+    if (-1 == fs.f_rw.read_dentry_by_name((uint8_t*) "stopandsmell8.wav", &dentry)) return FAIL;
+    len = fs.flength[dentry.inode_num];
+    for (off = 44; off + sizeof(buf) <= len; off += sizeof(buf)) {
+        if (sizeof(buf) != fs.f_rw.read_data(dentry.inode_num, off, buf, sizeof(buf))) return FAIL;
+        if (-1 == (addr = fs.f_rw.data_addr(dentry.inode_num, off, sizeof(buf)))) {
+            gathered++;
+            continue;
+        }
+        for (i = 0; i < sizeof(buf); i++) {
+            if (((uint8_t*) addr)[i] != buf[i]) return FAIL;
+        }
+        direct++;
+    }
+    printf("%d spans straight from the image, %d gathered\n", direct, gathered);
+    return (direct + gathered) ? PASS : FAIL;
+}
+
+/**
+ * @brief getdents : one batched read of "." returns the same names, in the same
+ * order, as reading the directory one name at a time, with types and sizes
+ * from the dentries; a buffer smaller than one entry gets nothing
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t getdents_test() {
+    static dirent_t dents[64];
+    uint8_t name[33];
+    file_t dir, one;
+    int32_t i, n, cnt;
+    dentry_t dentry;
+    TEST_HEADER;
+    if (-1 == fs.openr(&dir, (uint8_t*) ".", 0) || -1 == fs.openr(&one, (uint8_t*) ".", 0)) return FAIL;
+    if (0 != fs.getdents(&dir, dents, sizeof(dirent_t) - 1)) return FAIL;
+    cnt = fs.getdents(&dir, dents, sizeof(dents));
+    if (cnt <= 0 || cnt % sizeof(dirent_t)) return FAIL;
+    n = cnt / sizeof(dirent_t);
+    printf("%d entries in one call\n", n);
+    for (i = 0; i < n; i++) {
+        if (0 >= fs.d_ioctl.read(&one, name, 32)) return FAIL;
+        if (strncmp((int8_t*) name, (int8_t*) dents[i].name, 32)) return FAIL;
+        if (-1 == fs.f_rw.read_dentry_by_name(dents[i].name, &dentry)) return FAIL;
+        if (dentry.inode_num != dents[i].inode || dentry.filetype != dents[i].type) return FAIL;
+        if (dents[i].type == DESCRIPTOR_ENTRY_FILE && dents[i].size != fs.flength[dents[i].inode]) return FAIL;
+    }
+    if (n < 64 && 0 != fs.getdents(&dir, dents, sizeof(dents))) return FAIL;
+    return PASS;
+}
+
+/**
+ * @brief stat : length and blocks come from the cached metadata, the ELF check
+ * is cached until the file is written, and check_exec agrees with it
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t stat_test() {
+    static const uint8_t magic[4] = {0x7f, 0x45, 0x4c, 0x46};
+    dentry_t dentry;
+    stat_t st;
+    TEST_HEADER;
+    if (1 != fs.check_exec((uint8_t*) "shell") || 0 != fs.check_exec((uint8_t*) "frame0.txt")
+        || 0 != fs.check_exec((uint8_t*) ".")) return FAIL;
+    if (-1 == fs.f_rw.read_dentry_by_name((uint8_t*) "frame0.txt", &dentry)
+        || fs.stat(dentry.inode_num, dentry.filetype, &st)) return FAIL;
+    if (st.type != DESCRIPTOR_ENTRY_FILE || st.size != fs.flength[dentry.inode_num] || st.exec
+        || st.blocks != (st.size + fs.block_size - 1) / fs.block_size) return FAIL;
+    if (-1 == fs.f_rw.create_file((uint8_t*) "stattst", strlen("stattst"))
+        || -1 == fs.f_rw.read_dentry_by_name((uint8_t*) "stattst", &dentry)) return FAIL;
+    if (0 != fs.check_exec((uint8_t*) "stattst")) return FAIL;
+    fs.f_rw.write_data(dentry.inode_num, 0, magic, 4);
+    if (1 != fs.check_exec((uint8_t*) "stattst")) return FAIL;
+    fs.f_rw.remove_file((uint8_t*) "stattst", strlen("stattst"));
+    sync_fs();
+    return PASS;
+}
+
+/**
+ * @brief random access : a position moved backwards reads the same bytes
+ * again, a read at or past the end returns 0, and a write past the end
+ * zero-fills the gap (what lseek/pread/pwrite rely on), unless the gap does
+ * not fit on the disk
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t seek_test() {
+    uint8_t buf[16];
+    file_t f;
+    int32_t i;
+    TEST_HEADER;
+    if (-1 == fs.f_rw.create_file((uint8_t*) "seektst", strlen("seektst"))
+        || -1 == fs.f_ioctl.open(&f, (uint8_t*) "seektst", 0)) return FAIL;
+    if (6 != f.fops.write(&f, (uint8_t*) "abcdef", 6) || f.pos != 6) return FAIL;
+    f.pos = 2;
+    if (3 != f.fops.read(&f, buf, 3) || strncmp((int8_t*) buf, "cde", 3) || f.pos != 5) return FAIL;
+    f.pos = fs.flength[f.inode];
+    if (0 != f.fops.read(&f, buf, sizeof(buf))) return FAIL;
+    f.pos = 10;
+    if (2 != f.fops.write(&f, (uint8_t*) "xy", 2) || fs.flength[f.inode] != 12) return FAIL;
+    f.pos = 0;
+    if (12 != f.fops.read(&f, buf, sizeof(buf))) return FAIL;
+    for (i = 6; i < 10; i++) {
+        if (buf[i] != 0) return FAIL;
+    }
+    if (strncmp((int8_t*) buf, "abcdef", 6) || strncmp((int8_t*) buf + 10, "xy", 2)) return FAIL;
+    /* a gap larger than the disk is refused up front : no block is taken */
+    f.pos = (fs.dblock_num - 1) * fs.block_size;
+    if (-1 != f.fops.write(&f, (uint8_t*) "z", 1) || fs.flength[f.inode] != 12) return FAIL;
+    f.pos = 10;
+    if (2 != f.fops.write(&f, (uint8_t*) "xy", 2)) return FAIL;
+    fs.f_rw.remove_file((uint8_t*) "seektst", strlen("seektst"));
+    sync_fs();
+    return PASS;
+}
+
+/**
+ * @brief program image cache : the text of shell is read once, a second exec
+ * shares the same frames, a write drops the entry and a file that is not an
+ * ELF is copied flat. Prints what an exec copies, flat and cached.
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t pcache_test() {
+    pcache_ent_t *e, *e2;
+    dentry_t dentry;
+    uint8_t* buf;
+    uint32_t i, j, len, entry, cycles, cyc_flat, cyc_cached, khz = pit_tsc_khz();
+    TEST_HEADER;
+    if (-1 == fs.f_rw.read_dentry_by_name((uint8_t*) "shell", &dentry)
+        || 4 != fs.f_rw.read_data(dentry.inode_num, 24, (uint8_t*) &entry, 4)) return FAIL;
+    if (NULL == (buf = kmalloc(fs.flength[dentry.inode_num]))) return FAIL;
+    pcache_invalidate(dentry.inode_num);
+    if (NULL == (e = pcache_get(dentry.inode_num)) || e->entry != entry || e->npages == 0) return FAIL;
+    for (i = 0; i < e->npages; i++) {
+        len = e->text_len - i * PGSIZE;
+        if (len > PGSIZE) len = PGSIZE;
+        if (len != fs.f_rw.read_data(dentry.inode_num, i * PGSIZE, buf, len)) return FAIL;
+        for (j = 0; j < len; j++) {
+            if (buf[j] != ((uint8_t*) e->text[i])[j]) return FAIL;
+        }
+    }
+    /* what an exec copies : the whole file before, data segments now */
+    cycles = rdtsc();
+    fs.f_rw.read_data(dentry.inode_num, 0, buf, fs.flength[dentry.inode_num]);
+    cyc_flat = rdtsc() - cycles;
+    cycles = rdtsc();
+    e2 = pcache_get(dentry.inode_num);
+    for (i = 0; i < e2->nseg; i++) {
+        fs.f_rw.read_data(dentry.inode_num, e2->seg[i].offset, buf, e2->seg[i].filesz);
+    }
+    cyc_cached = rdtsc() - cycles;
+    if (khz >= 1000) {
+        printf("shell : %d text pages shared, load %d us flat, %d us cached\n",
+               e->npages, cyc_flat / (khz / 1000), cyc_cached / (khz / 1000));
+    }
+    if (e2 != e || e->refs != 2) return FAIL;
+    pcache_put(e2);
+    /* still in use after the write, freed by the last put */
+    pcache_invalidate(dentry.inode_num);
+    if (e->valid || e->npages == 0) return FAIL;
+    pcache_put(e);
+    if (e->npages) return FAIL;
+    kfree(buf);
+    if (-1 == fs.f_rw.read_dentry_by_name((uint8_t*) "frame0.txt", &dentry)
+        || NULL != pcache_get(dentry.inode_num)) return FAIL;
+    pcache_print_stats();
+    return PASS;
+}
+
+/**
+ * @brief block cache : a sequential scan of the image is read ahead in growing
+ * windows, every block matches the memory image, and a recent block is a hit.
+ * The image has to be on disk (sync_fs at boot writes it).
+ * @return ** int32_t PASS/FAIL
+ */
+int32_t bcache_readahead_test() {
+    uint32_t b, i, nblock, lba0, reads;
+    uint32_t* blk;
+    TEST_HEADER;
+    if (bcache_init()) return FAIL;
+    nblock = (fs.sys_ed_addr - fs.sys_st_addr) / BCACHE_BLOCK_SIZE;
+    if (nblock > 128) nblock = 128;
+    lba0 = FS_LBA_BASE;
+    for (b = 0; b < nblock; b++) {
+        blk = (uint32_t*) bcache_read(lba0 + b * BCACHE_BLOCK_SECTORS, lba0 + nblock * BCACHE_BLOCK_SECTORS);
+        if (blk == NULL) return FAIL;
+        for (i = 0; i < BCACHE_BLOCK_SIZE / 4; i++) {
+            if (blk[i] != ((uint32_t*) (fs.sys_st_addr + b * BCACHE_BLOCK_SIZE))[i]) {
+                printf("block %d differs from the image\n", b);
+                return FAIL;
+            }
+        }
+    }
+    bcache_print_stats();
+    /* 1+2+4+8+16+32+32... : far fewer commands than blocks */
+    if (bcache_stats.misses + bcache_stats.hits != nblock || bcache_stats.reads > 6 + nblock / BCACHE_RA_MAX) return FAIL;
+    if (bcache_stats.ra_hits == 0) return FAIL;
+    reads = bcache_stats.reads;
+    bcache_read(lba0 + (nblock - 1) * BCACHE_BLOCK_SECTORS, 0);
+    if (bcache_stats.reads != reads) return FAIL;
+    /* a write drops the block it covers */
+    bcache_invalidate(lba0 + (nblock - 1) * BCACHE_BLOCK_SECTORS + 3, 1);
+    bcache_read(lba0 + (nblock - 1) * BCACHE_BLOCK_SECTORS, 0);
+    return bcache_stats.reads == reads + 1 ? PASS : FAIL;
+}
+
 int cursor_test(void) {
     uint16_t pos;
     pos = get_cursor();
@@ -944,15 +1770,22 @@ int buddy_block_search_test(void) {
 
 int buddy_block_coalesce_test(void) {
     uint32_t i;
+    static void* res[1000];
     buddy_init((void*) 0x4000000, 4 << 20, 1);
-    for (i = 0; i < 10000; ++i) {
-        (void) buddy_search(rand() % ((1 << 20) + 1 - (4 << 10)) + (4 << 10));
+    for (i = 0; i < 1000; ++i) {
+        res[i] = buddy_alloc(rand() % ((1 << 12) + 1 - 16) + 16);
+    }
+    for (i = 0; i < 1000; ++i) {
+        if (NULL != res[i] && 0 != buddy_free(res[i])) {
+            return FAIL;
+        }
     }
-    buddy_traverse();
-    buddy_coalesce();
     buddy_traverse();
 
-    // Succeeded if no panics & correct statistics.
+    // Every block merged back on free : one free block of the whole arena is left.
+    if (!buddy_allocator.start->free || (4 << 20) != buddy_allocator.start->size) {
+        return FAIL;
+    }
     return PASS;
 }
 
@@ -960,36 +1793,50 @@ int buddy_alloc_stress_test(void) {
     uint32_t i, j;
     uint32_t alloc_cnt = 0;
     uint32_t dealloc_cnt = 0;
+    uint32_t size, round_alloc, round_free, cycles, cyc_alloc, cyc_free;
+    uint32_t mhz = pit_tsc_khz() / 1000;
     static const int32_t round_size = 1000;  // Cannot be too large -- the PCB may get corrupted.
     static const int32_t round_cnt = 1000;  // Stress test.
     void* res[round_size];
 
     for (j = 0; j < round_cnt; ++j) {
         memset(res, NULL, sizeof(res) / sizeof(res[0]));
+        round_alloc = round_free = 0;
+        cyc_alloc = 0;
         for (i = 0; i < round_size; ++i) {
-            if (NULL != (res[i] = buddy_alloc(rand() % ((4 << 19) + 1 - (1 << 10)) + (1 << 10)))) {
-                alloc_cnt++;
+            size = rand() % ((4 << 19) + 1 - (1 << 10)) + (1 << 10);
+            cycles = rdtsc();
+            res[i] = buddy_alloc(size);
+            cyc_alloc += rdtsc() - cycles;
+            if (NULL != res[i]) {
+                round_alloc++;
             }
         }
+        cycles = rdtsc();
         for (i = 0; i < round_size; ++i) {
             if (NULL == res[i]) {
                 continue;
             }
             if (0 == buddy_free(res[i])) {
-                dealloc_cnt++;
+                round_free++;
             }
         }
+        cyc_free = rdtsc() - cycles;
+        alloc_cnt += round_alloc;
+        dealloc_cnt += round_free;
         printf("\nIn round %d:\n", j);
         printf("Successfully allocated %d blocks of memory.\n", alloc_cnt);
         printf("Successfully reclaimed %d blocks of memory.\n", dealloc_cnt);
+        if (mhz) {
+            printf("%d ns per alloc, %d ns per free.\n", cyc_alloc / round_size * 1000 / mhz,
+                   round_free ? cyc_free / round_free * 1000 / mhz : 0);
+        }
 
         if (alloc_cnt != dealloc_cnt) {
             assertion_failure();
             return FAIL;
         }
     }
-//    buddy_coalesce();
-//    buddy_traverse();
     // Succeeded if no panics & correct statistics.
     return PASS;
 }
@@ -1005,6 +1852,183 @@ int slab_alloc_test() {
     return PASS;
 }
 
+/*!
+ * @brief Slab caches : filling more than one slab moves slabs to the full list, freeing everything gives the pages
+ * back but SLAB_EMPTY_MAX, kfree tells slab objects from buddy blocks, and both run in constant time.
+ */
+static uint32_t slab_count(const slab_t* s) {
+    uint32_t n = 0;
+    for (; s; s = s->next) { ++n; }
+    return n;
+}
+
+int slab_cache_test() {
+    static void* res[600];
+    slab_cache_t* c = &slab_caches[2];  // 24 bytes come from the 32-byte class.
+    void* page;
+    uint32_t i, cycles, cyc_alloc, cyc_free, in_use;
+    uint32_t mhz = pit_tsc_khz() / 1000;
+
+    in_use = slab_count(c->full) + slab_count(c->partial);  // Other kernel objects of this class.
+    cycles = rdtsc();
+    for (i = 0; i < 600; ++i) {
+        if (NULL == (res[i] = kmalloc(24)) || 0 == ((uint32_t) res[i] & (PGSIZE - 1))) {
+            return FAIL;
+        }
+    }
+    cyc_alloc = rdtsc() - cycles;
+    if (NULL == c->full || NULL == (page = kmalloc(PGSIZE)) || ((uint32_t) page & (PGSIZE - 1))) {
+        return FAIL;
+    }
+    cycles = rdtsc();
+    for (i = 0; i < 600; ++i) {
+        if (0 != kfree(res[i])) {
+            return FAIL;
+        }
+    }
+    cyc_free = rdtsc() - cycles;
+    if (0 != kfree(page) || slab_count(c->full) + slab_count(c->partial) != in_use || c->nempty > SLAB_EMPTY_MAX) {
+        return FAIL;
+    }
+    if (mhz) {
+        printf("%d ns per kmalloc, %d ns per kfree.\n", cyc_alloc / 600 * 1000 / mhz, cyc_free / 600 * 1000 / mhz);
+    }
+    slab_traverse();
+    return PASS;
+}
+
+/*!
+ * @brief Object caches : objects are aligned and come back constructed, statistics count every call, a pointer
+ * from another cache is refused, and objects larger than a slab are buddy blocks reused from the cache.
+ */
+#define KMEM_TEST_PATTERN 0x5A5A5A5A
+
+static void kmem_test_ctor(void* obj) {
+    uint32_t i;
+    for (i = 0; i < 40 / sizeof(uint32_t); ++i) {
+        ((uint32_t*) obj)[i] = KMEM_TEST_PATTERN;
+    }
+}
+
+int kmem_cache_test() {
+    static kmem_cache_t* c = NULL;
+    static kmem_cache_t* big = NULL;
+    static void* res[200];
+    void* page;
+    uint32_t i, j, allocs, frees;
+
+    if (NULL == c && (NULL == (c = kmem_cache_create("test", 40, CACHE_LINE, kmem_test_ctor))
+                      || NULL == (big = kmem_cache_create("test_big", 2 * PGSIZE, PGSIZE, NULL)))) {
+        return FAIL;
+    }
+    allocs = c->allocs;
+    frees = c->frees;
+    for (i = 0; i < 200; ++i) {
+        if (NULL == (res[i] = kmem_cache_alloc(c)) || ((uint32_t) res[i] & (CACHE_LINE - 1))) {
+            return FAIL;
+        }
+        for (j = 0; j < 40 / sizeof(uint32_t); ++j) {
+            if (KMEM_TEST_PATTERN != ((uint32_t*) res[i])[j]) {
+                return FAIL;
+            }
+        }
+    }
+    if (0 == kmem_cache_free(&slab_caches[0], res[0])) {
+        return FAIL;
+    }
+    for (i = 0; i < 200; ++i) {
+        if (0 != kmem_cache_free(c, res[i])) {
+            return FAIL;
+        }
+    }
+    if (c->allocs - allocs != 200 || c->frees - frees != 200 || NULL != c->full || NULL != c->partial) {
+        return FAIL;
+    }
+
+    // A freed large object is handed out again.
+    if (NULL == (page = kmem_cache_alloc(big)) || ((uint32_t) page & (PGSIZE - 1))
+        || 0 != kmem_cache_free(big, page) || page != kmem_cache_alloc(big) || 0 != kmem_cache_free(big, page)) {
+        return FAIL;
+    }
+    slab_traverse();
+    return PASS;
+}
+
+/*!
+ * @brief Allocator statistics : the per-order free counts add up to the free blocks of the arena, an allocation
+ * shows in the counters, and the "meminfo" pseudo-file reads the report in pieces.
+ */
+int meminfo_test() {
+    static int8_t report[KMEM_STAT_SIZE];
+    static int8_t chunk[100];
+    buddy_block_t* b;
+    file_t file;
+    uint32_t o, free_walk = 0, free_count = 0, allocs;
+    int32_t len, n, total = 0;
+    void* mem;
+
+    for (b = buddy_allocator.start; b < buddy_allocator.end; b = (buddy_block_t*) ((uint8_t*) b + b->size)) {
+        if (b->free) { free_walk += b->size; }
+    }
+    for (o = 0; o < BUDDY_ORDERS; ++o) {
+        free_count += buddy_allocator.nfree[o] * (buddy_allocator.align << o);
+    }
+    if (free_walk != free_count) {
+        return FAIL;
+    }
+
+    allocs = buddy_allocator.allocs;
+    if (NULL == (mem = kmalloc(3 * PGSIZE)) || buddy_allocator.allocs != allocs + 1 || 0 != kfree(mem)) {
+        return FAIL;
+    }
+
+    len = kmem_stats(report, KMEM_STAT_SIZE);
+    meminfo_open(&file, (uint8_t*) "meminfo", 0);
+    while (0 < (n = file.fops.read(&file, chunk, sizeof(chunk)))) {
+        total += n;
+    }
+    file.fops.close(&file);
+    if (0 >= len || n != 0 || total != len || -1 != file.fops.write(&file, chunk, 1)) {
+        return FAIL;
+    }
+    printf("%s", report);
+    return PASS;
+}
+
+/*!
+ * @brief Page frames : a frame comes back to the free list with its last reference, runs are aligned, frames are
+ * mapped 1:1 and never in the user window, and the kernel heap lies in frames the allocator handed out.
+ */
+int frame_test() {
+    uint32_t f, run, i, free = frame_stats.free;
+
+    if (0 == (f = frame_alloc()) || (f & (PGSIZE - 1)) || 1 != frame_refs(f)
+        || (f >= UVM_START && f < MMAP_START + UVM_SIZE) || !(kpgdir[PDX(f)] & PAGE_P)) {
+        return FAIL;
+    }
+    memset((void*) f, 0xA5, PGSIZE);  // Reachable through the 1:1 map.
+    frame_get(f);
+    if (1 != frame_put(f) || free - 1 != frame_stats.free || 0 != frame_put(f) || free != frame_stats.free
+        || -1 != frame_put(f)) {
+        return FAIL;
+    }
+
+    if (0 == (run = frame_alloc_contig(PROG_SIZE, PROG_SIZE)) || (run & (PROG_SIZE - 1))) {
+        return FAIL;
+    }
+    for (i = 0; i < PROG_SIZE; i += PGSIZE) {
+        if (0 != frame_put(run + i)) {
+            return FAIL;
+        }
+    }
+    if (free != frame_stats.free || 0 == frame_refs((uint32_t) buddy_allocator.start)
+        || -1 != frame_put(FRAME_KERNEL_END - PGSIZE)) {
+        return FAIL;
+    }
+    printf("%d KB of RAM, %d KB free\n", frame_stats.ram * 4, frame_stats.free * 4);
+    return PASS;
+}
+
 int slab_stress_test() {
     uint32_t i, j;
     uint32_t alloc_cnt = 0;
@@ -1139,6 +2163,27 @@ void launch_tests() {
     // TEST_OUTPUT("test_rename_file",test_rename_file());
     // TEST_OUTPUT("test_remove_file",test_remove_file());
     // TEST_OUTPUT("test_write_file",test_write_file());
+    // TEST_OUTPUT("test_write_read_back",test_write_read_back());
+    // TEST_OUTPUT("test_dentry_index",test_dentry_index());
+    // TEST_OUTPUT("test_dblock_locality",test_dblock_locality());
+    // TEST_OUTPUT("test_fs_maps",test_fs_maps());
+    // TEST_OUTPUT("test_extent_inode",test_extent_inode());
+    // TEST_OUTPUT("test_journal_replay",test_journal_replay());
+    // TEST_OUTPUT("fs_flusher_test",fs_flusher_test());
+    // TEST_OUTPUT("fs_writeback_bench",fs_writeback_bench());
+    // TEST_OUTPUT("fs_read_throughput_bench",fs_read_throughput_bench());
+    // TEST_OUTPUT("bcache_readahead_test",bcache_readahead_test());
+    // TEST_OUTPUT("ata_pio_bench",ata_pio_bench());
+    // TEST_OUTPUT("ata_dma_bench",ata_dma_bench());
+    // TEST_OUTPUT("blk_queue_test",blk_queue_test());
+    // TEST_OUTPUT("ata_lba48_test",ata_lba48_test());
+    // TEST_OUTPUT("mmap_block_test",mmap_block_test());
+    // TEST_OUTPUT("mmap_pin_test",mmap_pin_test());
+    // TEST_OUTPUT("sendfile_span_test",sendfile_span_test());
+    // TEST_OUTPUT("getdents_test",getdents_test());
+    // TEST_OUTPUT("stat_test",stat_test());
+    // TEST_OUTPUT("seek_test",seek_test());
+    // TEST_OUTPUT("pcache_test",pcache_test());
     // TEST_OUTPUT("exception_squash_program_check", exception_squash_program_test());
     /* TEST_OUTPUT("cursor_test", cursor_test()); */
     // TEST_OUTPUT("bool_test", bool_test());
@@ -1149,6 +2194,10 @@ void launch_tests() {
     // TEST_OUTPUT("buddy_block_coalesce_test", buddy_block_coalesce_test());
     // TEST_OUTPUT("buddy_alloc_stress_test", buddy_alloc_stress_test());
     // TEST_OUTPUT("slab_alloc_test", slab_alloc_test());
+    // TEST_OUTPUT("slab_cache_test", slab_cache_test());
+    // TEST_OUTPUT("kmem_cache_test", kmem_cache_test());
+    // TEST_OUTPUT("meminfo_test", meminfo_test());
+    // TEST_OUTPUT("frame_test", frame_test());
     // TEST_OUTPUT("slab_stress_test", slab_stress_test());
     // TEST_OUTPUT("kmalloc_stress_test", kmalloc_stress_test());
 }
@@ -13,35 +13,70 @@
 #include "kmalloc.h"
 #include "process.h"
 #include "terminal.h"
+#include "filesystem.h"
+#include "pcache.h"
+#include "frame.h"
 
 static pte_t* pgtbl;
 static pte_t* pgtbl_vid;
+static kmem_cache_t* pgtbl_cache;  // Page tables, free ones kept zeroed.
+
+/**
+ * @brief constructor of the page table cache : no page mapped
+ * @param obj - page table
+ * @return ** void
+ */
+static void
+pgtbl_ctor(void* obj) {
+    memset(obj, 0, PGSIZE);
+}
+
+/**
+ * @brief give a page table back to its cache in the constructed (zeroed) state
+ * @param pt - page table from pgtbl_cache
+ * @return ** void
+ */
+static void
+pgtbl_free(pte_t* pt) {
+    memset(pt, 0, PGSIZE);
+    if (0 != kmem_cache_free(pgtbl_cache, pt)) {
+        panic("pgtbl_free : not a page table of the cache");
+    }
+}
 
 /* vm_init
  * 
  * Sets up the page directory, the first page table, creates direct mapping
- * for the second 4M-page in physical memory, and maps video memory. Then it
- * set control registers to enable paging.
+ * for the second 4M-page and every 4M-page of RAM above it but the user ones,
+ * and maps video memory. The page frame allocator is set up first and the
+ * kernel heap is a run of its frames. Then it set control registers to enable
+ * paging.
  * Inputs: None
  * Outputs: None
  * Side Effects: Modifies `cr0`, `cr3`, `cr4`. Set up paging mechanism.
  */
 void
 vm_init(void) {
-    uint32_t i;
+    uint32_t i, arena, size;
+    frame_init();
     kpgdir[1] = (1U << PDXOFF) | PAGE_P | PAGE_RW | PAGE_PS | PAGE_G;  // PDE #1 --> 4M ~ 8M
-    for (i = 16; i < 24; ++i) {
-        kpgdir[i] = (i << PDXOFF) | PAGE_P | PAGE_RW | PAGE_PS | PAGE_G;  // PDE #16 ~ #25 --> 64M ~ 100M
+    for (i = 2; (i << PDXOFF) < frame_count * PGSIZE; ++i) {
+        if (i < PDX(UVM_START) || i > PDX(MMAP_START)) {  // 128M ~ 140M are user pages.
+            kpgdir[i] = (i << PDXOFF) | PAGE_P | PAGE_RW | PAGE_PS | PAGE_G;  // PDE #i --> RAM 1:1
+        }
     }
 
-    buddy_init((void*) BUDDY_START, BUDDY_SIZE, PGSIZE);
-    if (NULL == (pgtbl = kmalloc(PGSIZE)) || NULL == (pgtbl_vid = kmalloc(PGSIZE))) {
+    // Kernel heap : the largest run of frames up to BUDDY_SIZE.
+    for (size = BUDDY_SIZE; size >= BUDDY_SIZE_MIN && 0 == (arena = frame_alloc_contig(size, PGSIZE)); size >>= 1);
+    if (size < BUDDY_SIZE_MIN) {
+        panic("vm_init fail to find memory for the kernel heap");
+    }
+    buddy_init((void*) arena, size, PGSIZE);
+    if (NULL == (pgtbl_cache = kmem_cache_create("pgtbl", PGSIZE, PGSIZE, pgtbl_ctor))
+        || NULL == (pgtbl = kmem_cache_alloc(pgtbl_cache)) || NULL == (pgtbl_vid = kmem_cache_alloc(pgtbl_cache))) {
         panic("vm_init fail to allocate page table");
     }
 
-    memset(pgtbl, 0, PGSIZE);
-    memset(pgtbl_vid, 0, PGSIZE);
-
     kpgdir[0] = (uint32_t) pgtbl | PAGE_P | PAGE_RW | PAGE_G;  // Map the first page table.
 
     pgtbl[PTX(VIDEO)] = VIDEO | PAGE_P | PAGE_RW;   // Map PTE: 0xB8000 ~ 0xB9000
@@ -98,6 +133,119 @@ uvmmap_ext(uint32_t pa) {
     return 0;
 }
 
+/**
+ * @brief drop the references of a process to shared text frames : the read-only pages of its program page table
+ * @param p - pcb of the process
+ * @return ** void
+ */
+static void
+uvmput_text(pcb_t* p) {
+    uint32_t i;
+    if (NULL == p->img_pt) {
+        return;
+    }
+    for (i = 0; i < PGSIZE / sizeof(pte_t); ++i) {
+        if ((p->img_pt[i] & PAGE_P) && !(p->img_pt[i] & PAGE_RW)) {
+            frame_put(PAGE_ADDR(p->img_pt[i]));
+            p->img_pt[i] = 0;
+        }
+    }
+}
+
+/*!
+ * @brief This function maps the 4MB program page of a process at 128MB and loads the program into it. With an entry
+ * in the program image cache, the page is mapped through a page table of its own : the text pages are the cached
+ * frames, read-only and shared with every process running the program (one frame reference per process), the other
+ * pages are the process's 4MB region, where only data and bss are filled in. Otherwise it is one extended page and
+ * the whole file is copied. The region is a 4MB-aligned run of page frames taken on the first exec of the process.
+ * @param pid is process to map, it becomes the one whose program page is installed.
+ * @param prog_name is name of an executable file.
+ * @return 0 if succeeded, -1 otherwise.
+ * @sideeffect It allocates the process's program page table on first use and flushes TLB.
+ */
+int32_t
+uvmmap_prog(uint32_t pid, const uint8_t* prog_name) {
+    uint32_t i, va;
+    dentry_t dentry;
+    pcache_ent_t* e;
+    pcb_t* p = PCB(pid);
+
+    if (-1 == fs.f_rw.read_dentry_by_name(prog_name, &dentry)) {
+        return -1;
+    }
+    if (0 == p->prog_pa && 0 == (p->prog_pa = frame_alloc_contig(PROG_SIZE, PROG_SIZE))) {
+        return -1;
+    }
+    uvmput_text(p);  // Left by an exec that failed.
+    pcache_put(p->img);
+    e = pcache_get(dentry.inode_num);
+    if (NULL != e && NULL == p->img_pt && NULL == (p->img_pt = kmem_cache_alloc(pgtbl_cache))) {
+        pcache_put(e);
+        e = NULL;
+    }
+    p->img = e;
+    if (NULL != e) {
+        for (i = 0; i < PGSIZE / sizeof(pte_t); ++i) {
+            va = UVM_START + i * PGSIZE;
+            if (va >= IMG_START && va < IMG_START + e->npages * PGSIZE) {
+                p->img_pt[i] = e->text[(va - IMG_START) / PGSIZE] | PAGE_P | PAGE_U;  // Shared, read-only.
+                frame_get(p->img_pt[i]);
+            } else {
+                p->img_pt[i] = (p->prog_pa + i * PGSIZE) | PAGE_P | PAGE_RW | PAGE_U;
+            }
+        }
+    }
+    if (0 != uvmremap_prog(pid)) {
+        return -1;
+    }
+    return pcache_load(e, dentry.inode_num);
+}
+
+/**
+ * @brief install the program page of a process before running it
+ * @param pid - process to run
+ * @return ** int32_t 0 on success, -1 if it has no 4MB region
+ */
+int32_t
+uvmremap_prog(uint32_t pid) {
+    pcb_t* p = PCB(pid);
+    if (0 == p->prog_pa) {
+        return -1;
+    }
+    if (NULL == p->img) {
+        return uvmmap_ext(p->prog_pa);
+    }
+    kpgdir[PDX(UVM_START)] = (uint32_t) p->img_pt | PAGE_P | PAGE_RW | PAGE_U;
+    lcr3((uint32_t) kpgdir);  // Flush TLB.
+    return 0;
+}
+
+/**
+ * @brief release the shared text, the program page table and the 4MB region of a process, at halt
+ * @param pid - process being discarded
+ * @return ** void
+ */
+void
+uvmfree_prog(uint32_t pid) {
+    uint32_t i;
+    pcb_t* p = PCB(pid);
+    kpgdir[PDX(UVM_START)] = 0;  // Unmapped before its frames go.
+    lcr3((uint32_t) kpgdir);  // Flush TLB.
+    uvmput_text(p);
+    pcache_put(p->img);
+    p->img = NULL;
+    if (NULL != p->img_pt) {
+        pgtbl_free(p->img_pt);
+        p->img_pt = NULL;
+    }
+    if (0 != p->prog_pa) {
+        for (i = 0; i < PROG_SIZE; i += PGSIZE) {
+            frame_put(p->prog_pa + i);
+        }
+        p->prog_pa = 0;
+    }
+}
+
 /**
  * @brief map terminal buffer pages 
  * 4KB aligned, each buffer size == size of video memory
@@ -193,3 +341,183 @@ uvmunmap_vid(void) {
 
     return 0;
 }
+
+/*!
+ * @brief This function maps the data blocks of a file read-only into the current process, one page per block,
+ * at the first free run of pages after MMAP_START, and writes the starting virtual address to the pointer passed
+ * in. The pages are the file system image itself, so nothing is copied. A private mapping marks its pages
+ * copy-on-write instead : the first write to a page gives the process its own copy (see `do_page_fault`).
+ * The file is pinned until the mapping goes : `remove_file` refuses a mapped file.
+ * @param inode is inode number of the file.
+ * @param length is length of the file in bytes.
+ * @param cow is 1 for a private (copy-on-write) mapping, 0 for a shared read-only one.
+ * @param start is pointer to user buffer which holds starting virtual address of the mapping.
+ * @return 0 if successful, -1 otherwise.
+ * @sideeffect It allocates the process's mapping page table on first use and flushes TLB.
+ */
+int32_t
+uvmmap_file(uint32_t inode, uint32_t length, uint32_t cow, uint8_t** start) {
+    uint32_t va = (uint32_t) start;
+    uint32_t n = PGROUNDUP(length) / PGSIZE;
+    uint32_t i, first, slot;
+    int32_t pa;
+    pcb_t* p = PCB(get_pid());
+
+    // Check input pointer validity.
+    if (UVM_START > va || UVM_START + UVM_SIZE - sizeof(uint32_t*) < va) {
+        return -1;
+    }
+    // A block must be a page, and the image page-aligned (GRUB page-aligns modules).
+    if (0 == n || PGSIZE != fs.block_size || (fs.sys_st_addr & (PGSIZE - 1))
+        || (cow && n > MMAP_COW_PAGES)) {
+        return -1;
+    }
+    for (slot = 0; slot < MMAP_MAX && p->mmap_pages[slot]; ++slot);
+    if (MMAP_MAX == slot) {
+        return -1;
+    }
+    if (NULL == p->mmap_pt) {
+        if (NULL == (p->mmap_pt = kmem_cache_alloc(pgtbl_cache))) {
+            return -1;
+        }
+    }
+
+    // First fit : n free pages in a row.
+    for (first = 0, i = 0; i < MMAP_PAGES && i - first < n; ++i) {
+        if (p->mmap_pt[i]) {
+            first = i + 1;
+        }
+    }
+    if (i - first < n) {
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i) {
+        if (-1 == (pa = fs.f_rw.data_addr(inode, i * PGSIZE, PGSIZE))) {
+            while (i--) {
+                p->mmap_pt[first + i] = 0;
+            }
+            return -1;
+        }
+        p->mmap_pt[first + i] = (uint32_t) pa | PAGE_P | PAGE_U | (cow ? PAGE_COW : 0);
+    }
+    p->mmap_first[slot] = first;
+    p->mmap_pages[slot] = n;
+    p->mmap_inode[slot] = inode;
+    fs.fmapped[inode]++;  // The file can't be removed while its blocks are mapped.
+
+    // Commit changes to user pointer.
+    *start = (uint8_t*) (MMAP_START + first * PGSIZE);
+
+    return uvmremap_file(p->pid);  // Flush TLB.
+}
+
+/*!
+ * @brief This function undoes one mapping made by `uvmmap_file`, freeing the pages copied on write.
+ * @param start is starting virtual address of the mapping, as sent back by `uvmmap_file`.
+ * @return 0 on success, -1 if no mapping starts there.
+ * @sideeffect It modifies page table and flushes TLB.
+ */
+int32_t
+uvmunmap_file(uint8_t* start) {
+    uint32_t va = (uint32_t) start;
+    uint32_t i, slot;
+    pte_t* pte;
+    pcb_t* p = PCB(get_pid());
+
+    if (NULL == p->mmap_pt || MMAP_START > va || (va & (PGSIZE - 1))) {
+        return -1;
+    }
+    for (slot = 0; slot < MMAP_MAX; ++slot) {
+        if (p->mmap_pages[slot] && MMAP_START + p->mmap_first[slot] * PGSIZE == va) {
+            break;
+        }
+    }
+    if (MMAP_MAX == slot) {
+        return -1;
+    }
+
+    pte = &p->mmap_pt[p->mmap_first[slot]];
+    for (i = 0; i < p->mmap_pages[slot]; ++i) {
+        if (pte[i] & PAGE_OWN) {
+            frame_put(PAGE_ADDR(pte[i]));
+        }
+        pte[i] = 0;
+    }
+    p->mmap_pages[slot] = 0;
+    fs.fmapped[p->mmap_inode[slot]]--;
+
+    lcr3((uint32_t) kpgdir);  // Flush TLB.
+    return 0;
+}
+
+/**
+ * @brief install the file mappings of a process (or none) before running it
+ * @param pid - process to run
+ * @return ** int32_t always 0
+ */
+int32_t
+uvmremap_file(uint32_t pid) {
+    pcb_t* p = PCB(pid);
+    if (NULL == p->mmap_pt) {
+        kpgdir[PDX(MMAP_START)] = 0;
+    } else {
+        kpgdir[PDX(MMAP_START)] = (uint32_t) p->mmap_pt | PAGE_P | PAGE_RW | PAGE_U;
+    }
+    lcr3((uint32_t) kpgdir);  // Flush TLB.
+    return 0;
+}
+
+/**
+ * @brief drop every file mapping of a process and its mapping page table, at halt.
+ * The process must be the one running.
+ * @param pid - process being discarded
+ * @return ** void
+ */
+void
+uvmfree_file(uint32_t pid) {
+    uint32_t slot;
+    pcb_t* p = PCB(pid);
+    if (NULL == p->mmap_pt) {
+        return;
+    }
+    for (slot = 0; slot < MMAP_MAX; ++slot) {
+        if (p->mmap_pages[slot]) {
+            uvmunmap_file((uint8_t*) (MMAP_START + p->mmap_first[slot] * PGSIZE));
+        }
+    }
+    pgtbl_free(p->mmap_pt);
+    p->mmap_pt = NULL;
+    uvmremap_file(pid);
+}
+
+/*!
+ * @brief This function is called by the page fault handler before the process is squashed. A write to a present
+ * copy-on-write page of a file mapping gets a private copy of the page, mapped writable, and the faulting
+ * instruction is restarted. The kernel writing to such a page (e.g. `read` into a mapped buffer) is handled the
+ * same way, since CR0.WP is set.
+ * @param err is error code pushed by the processor.
+ * @return 0 if the fault is resolved, -1 if it is a real fault.
+ * @sideeffect It allocates one page frame and flushes TLB.
+ */
+int32_t
+do_page_fault(uint32_t err) {
+    uint32_t va = rcr2();
+    pte_t* pte;
+    void* page;
+    pcb_t* p = PCB(get_pid());
+
+    if ((PF_P | PF_W) != (err & (PF_P | PF_W)) || MMAP_START > va || MMAP_START + UVM_SIZE <= va
+        || NULL == p->mmap_pt) {
+        return -1;
+    }
+    pte = &p->mmap_pt[PTX(va)];
+    if (!(*pte & PAGE_COW) || NULL == (page = (void*) frame_alloc())) {
+        return -1;
+    }
+    memcpy(page, (void*) PAGE_ADDR(*pte), PGSIZE);
+    *pte = (uint32_t) page | PAGE_P | PAGE_RW | PAGE_U | PAGE_OWN;
+
+    lcr3((uint32_t) kpgdir);  // Flush TLB.
+    return 0;
+}
@@ -203,11 +203,11 @@ sigint_handler (int signum){
     ece391_set_handler(INTERRUPT,NULL);
     ece391_set_cursor(ocx,ocy); /* recover cursor */
     recover_video();
-    ece391_close(fd);
-    fd=ece391_open(fname);
-    if(-1==ece391_write(fd,BUF,flength)){
+    /* save over the file from its start, no need to reopen it to rewind */
+    if(-1==ece391_pwrite(fd,BUF,flength,0)){
         ece391_fdputs (1, (uint8_t*)"write to file failed\n");
     }
+    ece391_fsync(fd); /* saved text is on disk before the editor exits */
     ece391_close(fd);
     ece391_halt(0);
 }
@@ -4,7 +4,7 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
-#define SBUFSIZE 33
+#define DENTS 16     /* entries fetched per call */
 
 int32_t
 do_one_file (const char* s, const char* fname) 
@@ -67,8 +67,8 @@ do_one_file (const char* s, const char* fname)
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i;
+    ece391_dirent_t dents[DENTS];
     uint8_t search[BUFSIZE];
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
@@ -81,16 +81,17 @@ int main ()
 	return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, dents, sizeof(dents)))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	    return 3;
 	}
-	if ('.' == buf[0]) /* a directory... */
-	    continue;
-	buf[cnt] = '\0';
-	if (0 != do_one_file ((char*)search, (char*)buf))
-	    return 3;
+	for (i = 0; i < cnt / (int32_t)sizeof(ece391_dirent_t); i++) {
+	    if ('.' == dents[i].name[0]) /* a directory... */
+		continue;
+	    if (0 != do_one_file ((char*)search, (char*)dents[i].name))
+		return 3;
+	}
     }
 
     return 0;
@@ -965,6 +965,7 @@ struct login_t{
 
 /* FSM 2 */
 #define EXEC_CMD_LEN  40
+#define DIR_DENTS     16 /* directory entries fetched per getdents */
 
 struct region_t{
     int32_t x;
@@ -1071,7 +1072,7 @@ void reverse_img(image_t* p){
  * @brief from file raw data RGB 5:6:5 to extracted image RGB 5:6:5 with
  * width w and height h, centering at center_x,center_y(those are w.r.t. raw image)
  * Raw image is too large, hence this function
- * @param fd - fd to read
+ * @param src - raw pixels, right after the header in the mapped file
  * @param p  - p  to store
  * @param ux  - upper left coordinate
  * @param uy  - upper left coordinate
@@ -1080,8 +1081,8 @@ void reverse_img(image_t* p){
  * @return ** int32_t - read success or not
  */
 int32_t 
-draw_img(int32_t fd,image_t* p,int32_t ux,int32_t uy, int32_t w,int32_t h){
-    /* read from fd a image center at center_x, center_y */
+draw_img(const uint16_t* src,image_t* p,int32_t ux,int32_t uy, int32_t w,int32_t h){
+    /* read from the mapped file a image center at center_x, center_y */
     int32_t i,j,x,y;
     uint16_t read_val;
     if(!coordinate_check(ux+w-1,uy+h-1,p->hdr.width,p->hdr.height)
@@ -1090,9 +1091,7 @@ draw_img(int32_t fd,image_t* p,int32_t ux,int32_t uy, int32_t w,int32_t h){
     for(i=0;i<p->hdr.height;i++){
         x=0;
         for(j=0;j<p->hdr.width;j++){
-            if(-1==ece391_read(fd,&read_val,sizeof(read_val))){
-                return -1;
-            }
+            read_val=*src++;
             if(i>=uy&&j>=ux&&j<ux+w&&i<uy+h){
             // current (i,j) falls within expected region (center_x,center_y,w,h)
                 p->img[y][x++]=read_val;
@@ -1933,6 +1932,8 @@ int main(){
     int32_t fd;
     int32_t text_len;
     int32_t label_len;
+    int32_t photo_len;
+    uint8_t* photo;
 
     if(-1==ece391_set_handler(USER1,siguser_handler)){
         ece391_fdputs (1, (uint8_t*)"handler install failed\n");  
@@ -1944,8 +1945,14 @@ int main(){
         return 2;
     }
 
-    if(-1==ece391_read(fd,&background.hdr,sizeof(background.hdr))){
-        ece391_fdputs (1, (uint8_t*)"file read failed\n");
+    /* the photo is used in place in the file system image, no copy */
+    if(-1==(photo_len=ece391_mmap(fd,&photo,0))||photo_len<(int32_t)sizeof(background.hdr)){
+        ece391_fdputs (1, (uint8_t*)"file map failed\n");
+        return 2;
+    }
+    memcpy(&background.hdr,photo,sizeof(background.hdr));
+    if(photo_len<(int32_t)(sizeof(background.hdr)+background.hdr.width*background.hdr.height*2)){
+        ece391_fdputs (1, (uint8_t*)"file too short\n");
         return 2;
     }
     text_len=ece391_strlen((uint8_t*)"MINI OS");
@@ -1956,11 +1963,13 @@ int main(){
     (IMAGE_Y_DIM-(FONT_HEIGHT+PADDING_HEIGHT*2))>>1,
     WHITE_COL,BLACK_COL,-1);
     
-    if(-1==draw_img(fd,&background, 
+    if(-1==draw_img((const uint16_t*)(photo+sizeof(background.hdr)),&background, 
     (background.hdr.width-IMAGE_X_DIM)>>1, (background.hdr.height-IMAGE_Y_DIM)>>1,
     IMAGE_X_DIM,IMAGE_Y_DIM)){
         ece391_fdputs (1, (uint8_t*)"background draw failed\n");
     }
+    ece391_munmap(photo);
+    ece391_close(fd);
 
     if(-1==draw_text("MINI OS",text_len,&text[0],1)){
         ece391_fdputs (1, (uint8_t*)"text draw failed\n");
@@ -2045,7 +2054,9 @@ int main(){
     FSM1_clear();
 
     char buf[EXEC_CMD_LEN],dbuf[EXEC_CMD_LEN];
-    int32_t d_fd,cnt,fcount=0,fx=0,fy=0;
+    ece391_dirent_t dents[DIR_DENTS];
+    ece391_stat_t st;
+    int32_t d_fd,cnt,i,fcount=0,fx=0,fy=0;
     int32_t f_displacement=40;
 
     if (-1 == (d_fd = ece391_open ((uint8_t*)"."))) {
@@ -2053,32 +2064,35 @@ int main(){
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (d_fd, buf, EXEC_CMD_LEN-1))) {
+    while (0 != (cnt = ece391_getdents (d_fd, dents, sizeof(dents)))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-        if(ece391_strcmp((uint8_t*)buf,(uint8_t*)".")==0){
-            continue;
-        }
-	    buf[cnt] = '\0';
-        ece391_strcpy((uint8_t*)dbuf,(uint8_t*)buf);
-	    if(fname_display_processing(buf)){
-            draw_icont_E(&icon[fcount],fx,fy,buf,fcount,25,25,WHITE_COL,BLACK_COL,BLUE_COL);
-            FSM2_insert(fx,fy,dbuf,ICON_E,fcount);
-        }
-        else{
-            draw_icont_T(&icon[fcount],fx,fy,buf,fcount,25,25,WHITE_COL,BLACK_COL,BLUE_COL);
-            FSM2_insert(fx,fy,dbuf,ICON_T,fcount);
-        }
+        for(i=0;i<cnt/(int32_t)sizeof(ece391_dirent_t);i++){
+            if(ece391_strcmp(dents[i].name,(uint8_t*)".")==0){
+                continue;
+            }
+            ece391_strcpy((uint8_t*)buf,dents[i].name);
+            ece391_strcpy((uint8_t*)dbuf,dents[i].name);
+            fname_display_processing(buf);
+            /* executable icon for ELF files, from metadata : nothing is read */
+            if(0==ece391_stat(dents[i].name,&st)&&st.exec){
+                draw_icont_E(&icon[fcount],fx,fy,buf,fcount,25,25,WHITE_COL,BLACK_COL,BLUE_COL);
+                FSM2_insert(fx,fy,dbuf,ICON_E,fcount);
+            }
+            else{
+                draw_icont_T(&icon[fcount],fx,fy,buf,fcount,25,25,WHITE_COL,BLACK_COL,BLUE_COL);
+                FSM2_insert(fx,fy,dbuf,ICON_T,fcount);
+            }
 
-        fy+=f_displacement;
-        if(fy+f_displacement>IMAGE_Y_DIM){
-            fy=0;
-            fx+=f_displacement;
+            fy+=f_displacement;
+            if(fy+f_displacement>IMAGE_Y_DIM){
+                fy=0;
+                fx+=f_displacement;
+            }
+            fcount++;
         }
-        fcount++;
-        
     }
 
     assemble_picture();
@@ -3,26 +3,73 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define DENTS 16     /* entries fetched per call */
+#define ARGSIZE 128
+
+/* print a number right-aligned in a column of width characters */
+static void
+put_col (uint32_t value, int32_t width)
+{
+    uint8_t num[12];
+    int32_t len;
+
+    ece391_itoa (value, num, 10);
+    for (len = ece391_strlen (num); len < width; len++)
+        ece391_fdputs (1, (uint8_t*)" ");
+    ece391_fdputs (1, num);
+    ece391_fdputs (1, (uint8_t*)" ");
+}
+
+/* ls -l : kind, inode, size and blocks of a file, from stat, then its name */
+static int32_t
+put_long (const uint8_t* name)
+{
+    ece391_stat_t st;
+
+    if (-1 == ece391_stat (name, &st))
+        return -1;
+    if (1 == st.type)
+        ece391_fdputs (1, (uint8_t*)"d ");
+    else if (2 != st.type)
+        ece391_fdputs (1, (uint8_t*)"c ");
+    else if (st.exec)
+        ece391_fdputs (1, (uint8_t*)"x ");
+    else
+        ece391_fdputs (1, (uint8_t*)"- ");
+    put_col (st.inode, 3);
+    put_col (st.size, 7);
+    put_col (st.blocks, 4);
+    return 0;
+}
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i, len, longfmt;
+    ece391_dirent_t dents[DENTS];
+    uint8_t args[ARGSIZE];
+
+    longfmt = (0 == ece391_getargs (args, ARGSIZE) && 0 == ece391_strcmp (args, (uint8_t*)"-l"));
 
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, dents, sizeof(dents)))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
-	        return 3;
+	    for (i = 0; i < cnt / (int32_t)sizeof(ece391_dirent_t); i++) {
+	        if (longfmt && -1 == put_long (dents[i].name)) {
+	            ece391_fdputs (1, (uint8_t*)"stat failed\n");
+	            return 3;
+	        }
+	        len = ece391_strlen (dents[i].name);
+	        dents[i].name[len] = '\n';
+	        if (-1 == ece391_write (1, dents[i].name, len + 1))
+	            return 3;
+	    }
     }
 
     return 0;
@@ -71,10 +71,28 @@ sigint_handler (int signum){
     ece391_halt(0);
 }
 
+/* hand the next chunk of the file to the SB16 : straight from the file system
+ * with sendfile, or read and padded with silence when it is the last, short one */
+static int32_t
+send_chunk(int32_t n, uint8_t* pad) {
+    int32_t i;
+    if (n == SB16_CHUNK_LENGTH) {
+        return ece391_sendfile(sb16_fd, audio_fd, n);
+    }
+    if (n != ece391_read(audio_fd, pad, n)) {
+        return -1;
+    }
+    for (i = n; i < SB16_CHUNK_LENGTH; i++) {
+        pad[i] = 0;
+    }
+    return SB16_CHUNK_LENGTH == ece391_write(sb16_fd, pad, SB16_CHUNK_LENGTH) ? n : -1;
+}
+
 int main() {
     wav_meta_t wav_meta;
+    int32_t wav_len;        // bytes of samples in the file
+    int32_t played;         // bytes of samples handed to the SB16
     int32_t data_input_size;
-    int32_t i;
     uint8_t data_input[SB16_CHUNK_LENGTH];
     uint8_t file_name[1024]; // used for file input, hardcoded file for now
     uint8_t debug_buf[1024];
@@ -114,8 +132,11 @@ int main() {
 
 
 
-    // read in wave meta data
-    ece391_read(audio_fd, &wav_meta, (int32_t)sizeof(wav_meta_t));
+    // read in wave meta data : samples follow, sendfile takes them from there
+    if ((int32_t)sizeof(wav_meta_t) != ece391_read(audio_fd, &wav_meta, (int32_t)sizeof(wav_meta_t))) {
+        ece391_fdputs(1, (uint8_t*) "invalid wav file\n");
+        return 1;
+    }
 
     // verify wave metadata
     if (0x46464952 != wav_meta.chunk_id // RIFF
@@ -129,6 +150,8 @@ int main() {
         ece391_fdputs(1, (uint8_t*) "invalid wav file\n");
         return 1;
     }
+    wav_len = wav_meta.subchunk_2_size;
+    played = 0;
 
     // HARDWARE LIMITATION CHECKS
 
@@ -165,25 +188,20 @@ int main() {
     ece391_fdputs(1, (uint8_t*)debug_buf);
     ece391_fdputs(1, (uint8_t*)"\n");
 
-    // Load first data chunk
-    data_input_size = ece391_read(audio_fd, data_input, SB16_CHUNK_LENGTH);
+    // First data chunk
+    data_input_size = wav_len < SB16_CHUNK_LENGTH ? wav_len : SB16_CHUNK_LENGTH;
 
-    // Check for read failure
     if (data_input_size <= 0) {
         ece391_fdputs(1, (uint8_t*)"file read failed\n");
         return 3;
     }
 
-    // Pad as necessary
-    for (i = data_input_size; i < SB16_CHUNK_LENGTH; i++) {
-        data_input[i] = 0;
-    }
-
     // Write to SB16
-    if (data_input_size != ece391_write(sb16_fd, data_input, SB16_CHUNK_LENGTH)) {
+    if (data_input_size != send_chunk(data_input_size, data_input)) {
         ece391_fdputs(1, (uint8_t*)"SB16 write failed\n");
         return 3;
     }
+    played = data_input_size;
 
     // default sample rate and stuff for testing
     outb(SB16_SET_SAMPLE_RATE, SB16_WRITE_PORT);
@@ -212,26 +230,17 @@ int main() {
         
         outb(SB16_8_BIT_PAUSE, SB16_WRITE_PORT);
 
-        data_input_size = ece391_read(audio_fd, data_input, SB16_CHUNK_LENGTH);
-
-        if (data_input_size < 0) {
-            ece391_fdputs(1, (uint8_t*)"file read failed\n");
-            return 4;
-        }
+        data_input_size = wav_len - played < SB16_CHUNK_LENGTH ? wav_len - played : SB16_CHUNK_LENGTH;
 
         if (data_input_size == 0) {
             break;
         }
 
-        // Pad as necessary
-        for (i = data_input_size; i < SB16_CHUNK_LENGTH; i++) {
-            data_input[i] = 0;
-        }
-
-        if (data_input_size != ece391_write(sb16_fd, data_input, data_input_size)) {
+        if (data_input_size != send_chunk(data_input_size, data_input)) {
             ece391_fdputs(1, (uint8_t*)"file write failed\n");
             return 4;
         }
+        played += data_input_size;
 
         outb(SB16_8_BIT_RESUME, SB16_WRITE_PORT);
 
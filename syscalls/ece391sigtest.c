@@ -9,6 +9,8 @@ static uint8_t charbuf;
 static volatile uint8_t* badbuf = 0;
 void segfault_sighandler (int signum);
 void alarm_sighandler (int signum);
+void sigreturn_sighandler (int signum);
+int32_t sigreturn_test (void);
 
 int main ()
 {
@@ -26,6 +28,10 @@ int main ()
 		ece391_set_handler(ALARM, alarm_sighandler);
 	}
 
+    if (buf[0] == '3') {
+        return sigreturn_test();
+    }
+
     if(buf[0] == '2') {
         ece391_fdputs(1, (uint8_t*)"Installing signal handlers\n");
 		ece391_set_handler(SEGFAULT, segfault_sighandler);
@@ -86,3 +92,51 @@ alarm_sighandler (int signum)
         default: ece391_fdputs(1, (uint8_t*)"invalid\n"); break;
     }
 }
+
+/*
+ * "sigtest 3" : a fault is delivered to a handler that points the faulting
+ * store at charbuf, sigreturn restarts it; every register must come back
+ */
+int32_t
+sigreturn_test (void)
+{
+    uint32_t regs[4];
+    ece391_set_handler(SEGFAULT, sigreturn_sighandler);
+    charbuf = 0;
+    asm volatile ("                 \n\
+        pushl   %%ebx               \n\
+        pushl   %%esi               \n\
+        pushl   %%edi               \n\
+        movl    $0x11111111, %%ebx  \n\
+        movl    $0x22222222, %%esi  \n\
+        movl    $0x33333333, %%edi  \n\
+        movl    $0x44444444, %%edx  \n\
+        movl    $0, %%eax           \n\
+        movb    $1, (%%eax)         \n\
+        movl    %%ebx, 0(%%ecx)     \n\
+        movl    %%esi, 4(%%ecx)     \n\
+        movl    %%edi, 8(%%ecx)     \n\
+        movl    %%edx, 12(%%ecx)    \n\
+        popl    %%edi               \n\
+        popl    %%esi               \n\
+        popl    %%ebx               \n\
+        "
+        :
+        : "c" (regs)
+        : "eax", "edx", "memory"
+    );
+    if (charbuf == 1 && regs[0] == 0x11111111 && regs[1] == 0x22222222
+        && regs[2] == 0x33333333 && regs[3] == 0x44444444) {
+        ece391_fdputs(1, (uint8_t*)"sigreturn test: PASS\n");
+        return 0;
+    }
+    ece391_fdputs(1, (uint8_t*)"sigreturn test: FAIL\n");
+    return 1;
+}
+
+void
+sigreturn_sighandler (int signum)
+{
+    uint32_t* eax = (uint32_t*)(&signum + 7);
+    *eax = (uint32_t)&charbuf;
+}
@@ -30,6 +30,38 @@ extern int32_t ece391_file_rename(const uint8_t* src, const uint8_t* dest);
 extern int32_t ece391_getc();
 extern int32_t ece391_sb16_ioctl(int32_t fd,int32_t command, int32_t args);
 extern int32_t ece391_kmalloc_demo(void);
+extern int32_t ece391_fsync(int32_t fd);
+extern int32_t ece391_mmap(int32_t fd, uint8_t** start, int32_t private);
+extern int32_t ece391_munmap(uint8_t* start);
+extern int32_t ece391_sendfile(int32_t out_fd, int32_t in_fd, uint32_t nbytes);
+extern int32_t ece391_getdents(int32_t fd, void* buf, uint32_t nbytes);
+extern int32_t ece391_stat(const uint8_t* filename, void* buf);
+extern int32_t ece391_fstat(int32_t fd, void* buf);
+extern int32_t ece391_lseek(int32_t fd, int32_t offset, int32_t whence);
+extern int32_t ece391_pread(int32_t fd, void* buf, uint32_t nbytes, uint32_t offset);
+extern int32_t ece391_pwrite(int32_t fd, const void* buf, uint32_t nbytes, uint32_t offset);
+
+/* ece391_lseek whence */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+/* directory entry filled by ece391_getdents, same layout as the kernel's dirent_t */
+typedef struct ece391_dirent {
+    uint32_t inode;
+    uint32_t size;      /* bytes, 0 for devices and the directory */
+    uint32_t type;      /* 0 : rtc, 1 : directory, 2 : file */
+    uint8_t  name[33];  /* NUL terminated */
+} ece391_dirent_t;
+
+/* file metadata filled by ece391_stat/ece391_fstat, same layout as the kernel's stat_t */
+typedef struct ece391_stat {
+    uint32_t inode;
+    uint32_t type;      /* 0 : rtc, 1 : directory, 2 : file, 3 and up : devices */
+    uint32_t size;      /* bytes */
+    uint32_t blocks;    /* 4 KB data blocks the file owns */
+    uint32_t exec;      /* 1 : executable */
+} ece391_stat_t;
 
 enum signums {
 	DIV_ZERO = 0,